@@ -0,0 +1,20 @@
+/* allocation hooks chipmunk2d is built with when ALLOC_TRACKING is on
+ *
+ * vendor/CMakeLists.txt force-includes this header into the chipmunk2d
+ * sources, and defines cpcalloc & cprealloc to these, so every allocation
+ * chipmunk2d makes is counted by alloc_tracker.cpp.
+ */
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void *physics_cpcalloc(size_t count, size_t size);
+void *physics_cprealloc(void *ptr, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,203 @@
+#include "alloc_tracker.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+
+#ifdef ALLOC_TRACKING
+#include <cstdlib>
+#include <flecs.h>
+#include <new>
+
+#include "alloc_hooks.h"
+
+// glibc's allocator entry points; our malloc() & friends below replace the
+// public symbols for the whole process, and forward to these.  free() is
+// not replaced, so everything is still freed by glibc.  This only works
+// with glibc, and not under the sanitizers, which replace them too.
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void *__libc_memalign(size_t alignment, size_t size);
+
+static std::atomic<uint64_t> allocs{0};
+
+extern "C" void *
+malloc(size_t size) noexcept
+{
+    allocs.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+extern "C" void *
+calloc(size_t count, size_t size) noexcept
+{
+    allocs.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *
+realloc(void *ptr, size_t size) noexcept
+{
+    allocs.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void *
+memalign(size_t alignment, size_t size) noexcept
+{
+    allocs.fetch_add(1, std::memory_order_relaxed);
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" void *
+aligned_alloc(size_t alignment, size_t size) noexcept
+{
+    allocs.fetch_add(1, std::memory_order_relaxed);
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" int
+posix_memalign(void **out, size_t alignment, size_t size) noexcept
+{
+    if (alignment % sizeof(void *) != 0
+            || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    allocs.fetch_add(1, std::memory_order_relaxed);
+    void *ptr = __libc_memalign(alignment, size);
+    if (!ptr) {
+        return ENOMEM;
+    }
+    *out = ptr;
+    return 0;
+}
+
+uint64_t
+alloc_count(void)
+{
+    return allocs.load(std::memory_order_relaxed);
+}
+
+#endif
+
+const char *
+alloc_phase_name(AllocPhase phase)
+{
+    switch (phase) {
+    case AllocPhase_Other:      return "other";
+    case AllocPhase_Systems:    return "systems";
+    case AllocPhase_Observers:  return "observers";
+    case AllocPhase_Step:       return "step";
+    case AllocPhase_Callbacks:  return "callbacks";
+    default:                    return "unknown";
+    }
+}
+
+const char *
+alloc_source_name(AllocSource source)
+{
+    switch (source) {
+    case AllocSource_Chipmunk:  return "chipmunk2d";
+    case AllocSource_Flecs:     return "flecs";
+    case AllocSource_New:       return "new";
+    default:                    return "unknown";
+    }
+}
+
+#ifdef ALLOC_TRACKING
+
+// per-thread, so a world's frame is only charged for its own allocations;
+// a thread progresses one world at a time
+static thread_local AllocCounts thread_counts;
+static thread_local AllocPhase current_phase = AllocPhase_Other;
+
+static void
+record(AllocSource source, size_t size)
+{
+    thread_counts.count[current_phase][source]++;
+    thread_counts.bytes[current_phase][source] += size;
+}
+
+void
+alloc_counts(AllocCounts *out)
+{
+    *out = thread_counts;
+}
+
+AllocPhase
+alloc_phase_set(AllocPhase phase)
+{
+    AllocPhase prev = current_phase;
+    current_phase = phase;
+    return prev;
+}
+
+// chipmunk2d, via cpcalloc & cprealloc; see alloc_hooks.h
+extern "C" void *
+physics_cpcalloc(size_t count, size_t size)
+{
+    record(AllocSource_Chipmunk, count * size);
+    return calloc(count, size);
+}
+
+extern "C" void *
+physics_cprealloc(void *ptr, size_t size)
+{
+    record(AllocSource_Chipmunk, size);
+    return realloc(ptr, size);
+}
+
+// flecs, via its OS API; installed before any world is created
+static ecs_os_api_malloc_t flecs_malloc;
+static ecs_os_api_calloc_t flecs_calloc;
+static ecs_os_api_realloc_t flecs_realloc;
+
+static bool
+hook_flecs(void)
+{
+    ecs_os_set_api_defaults();
+    ecs_os_api_t api = ecs_os_api;
+    flecs_malloc  = api.malloc_;
+    flecs_calloc  = api.calloc_;
+    flecs_realloc = api.realloc_;
+
+    api.malloc_ = [](ecs_size_t size) {
+        record(AllocSource_Flecs, size);
+        return flecs_malloc(size);
+    };
+    api.calloc_ = [](ecs_size_t size) {
+        record(AllocSource_Flecs, size);
+        return flecs_calloc(size);
+    };
+    api.realloc_ = [](void *ptr, ecs_size_t size) {
+        record(AllocSource_Flecs, size);
+        return flecs_realloc(ptr, size);
+    };
+    ecs_os_set_api(&api);
+    return true;
+}
+static bool flecs_hooked = hook_flecs();
+
+// everything else; the default operator delete frees with free()
+void *
+operator new(size_t size)
+{
+    record(AllocSource_New, size);
+    if (void *ptr = malloc(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void *
+operator new[](size_t size)
+{
+    record(AllocSource_New, size);
+    if (void *ptr = malloc(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+#endif
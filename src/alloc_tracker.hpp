@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+
+/// allocators told apart by the ALLOC_TRACKING build
+enum AllocSource {
+    AllocSource_Chipmunk,   // cpcalloc() & cprealloc()
+    AllocSource_Flecs,      // the flecs OS API
+    AllocSource_New,        // operator new; the wrappers, fmt, std::vector
+    AllocSource_Count,
+};
+
+/// frame phases allocations are attributed to
+enum AllocPhase {
+    AllocPhase_Other,       // outside of a frame
+    AllocPhase_Systems,     // within a frame, outside of the below
+    AllocPhase_Observers,
+    AllocPhase_Step,        // cpSpaceStep(), less collision callbacks
+    AllocPhase_Callbacks,   // chipmunk2d collision callbacks
+    AllocPhase_Count,
+};
+
+/// allocations, and bytes allocated, by phase & source
+struct AllocCounts {
+    uint64_t count[AllocPhase_Count][AllocSource_Count];
+    uint64_t bytes[AllocPhase_Count][AllocSource_Count];
+
+    /// total allocations from a phase
+    uint64_t phase_count(AllocPhase phase) const {
+        uint64_t total = 0;
+        for (int source = 0; source < AllocSource_Count; source++) {
+            total += count[phase][source];
+        }
+        return total;
+    }
+};
+
+/// name of a phase or source, for reporting
+const char *
+alloc_phase_name(AllocPhase phase);
+const char *
+alloc_source_name(AllocSource source);
+
+#ifdef ALLOC_TRACKING
+
+/// number of heap allocations made by the process
+///
+/// Counts every malloc(), calloc(), realloc() & aligned allocation, from any
+/// library or thread, including those made by `operator new`.  Take the
+/// difference across a block of code to check it does not allocate.  This
+/// build replaces glibc's allocator entry points to count them, so it needs
+/// glibc, and can't be combined with the sanitizers.
+uint64_t
+alloc_count(void);
+
+/// get the allocations made by the calling thread since it started
+///
+/// The counters are per-thread, so the difference across a frame covers only
+/// the world that thread was progressing, even with other worlds running on
+/// other threads.  Allocations the world makes on other threads are not
+/// included.
+void
+alloc_counts(AllocCounts *out);
+
+/// set the phase this thread's allocations are attributed to, returning the
+/// previous phase
+AllocPhase
+alloc_phase_set(AllocPhase phase);
+
+/// attribute this thread's allocations to a phase until the end of the scope
+struct AllocPhaseScope {
+    AllocPhaseScope(AllocPhase phase) : prev{alloc_phase_set(phase)} {}
+    AllocPhaseScope(const AllocPhaseScope&) = delete;
+    ~AllocPhaseScope() { alloc_phase_set(prev); }
+
+    AllocPhaseScope& operator=(const AllocPhaseScope&) = delete;
+
+    AllocPhase prev;
+};
+
+#define ALLOC_PHASE(phase) AllocPhaseScope __alloc_phase_scope(phase)
+
+#else
+
+#define ALLOC_PHASE(phase)
+
+#endif
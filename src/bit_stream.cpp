@@ -0,0 +1,89 @@
+#include "bit_stream.hpp"
+
+/// widths selected by the 2-bit prefix of write_varbits()
+static const int varbits_width[4] = { 4, 8, 16, 32 };
+
+BitWriter::BitWriter(std::vector<uint8_t>& out)
+    : out{out}, scratch{0}, pending{0}
+{
+    out.clear();
+}
+
+void
+BitWriter::write(uint32_t value, int bits)
+{
+    if (bits < 32) {
+        value &= (1u << bits) - 1;
+    }
+    scratch |= (uint64_t)value << pending;
+    pending += bits;
+    while (pending >= 8) {
+        out.push_back(scratch & 0xff);
+        scratch >>= 8;
+        pending -= 8;
+    }
+}
+
+void
+BitWriter::write_varbits(uint32_t value)
+{
+    uint32_t prefix = 0;
+    while (prefix < 3 && value >> varbits_width[prefix]) {
+        prefix++;
+    }
+    write(prefix, 2);
+    write(value, varbits_width[prefix]);
+}
+
+void
+BitWriter::write_signed(int32_t value)
+{
+    // zigzag: 0, -1, 1, -2, 2, ... -> 0, 1, 2, 3, 4, ...
+    write_varbits(((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+}
+
+size_t
+BitWriter::flush()
+{
+    if (pending > 0) {
+        out.push_back(scratch & 0xff);
+        scratch = 0;
+        pending = 0;
+    }
+    return out.size();
+}
+
+BitReader::BitReader(const uint8_t *data, size_t size)
+    : data{data}, size{size}, pos{0}, scratch{0}, pending{0}, overflow{false}
+{
+}
+
+uint32_t
+BitReader::read(int bits)
+{
+    while (pending < bits) {
+        if (pos == size) {
+            overflow = true;
+            return 0;
+        }
+        scratch |= (uint64_t)data[pos++] << pending;
+        pending += 8;
+    }
+    uint32_t value = bits < 32 ? scratch & ((1u << bits) - 1) : scratch;
+    scratch >>= bits;
+    pending -= bits;
+    return value;
+}
+
+uint32_t
+BitReader::read_varbits()
+{
+    return read(varbits_width[read(2)]);
+}
+
+int32_t
+BitReader::read_signed()
+{
+    uint32_t value = read_varbits();
+    return (int32_t)((value >> 1) ^ (0u - (value & 1)));
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// packs values of any width up to 32 bits into a byte buffer
+///
+/// Bits are written least significant first.  The buffer is cleared by the
+/// constructor but keeps its capacity, so a writer over a long-lived buffer
+/// does not allocate once the buffer has grown to its working size.
+struct BitWriter {
+    BitWriter(std::vector<uint8_t>& out);
+    BitWriter(const BitWriter&) = delete;
+
+    BitWriter& operator=(const BitWriter&) = delete;
+
+    /// write the low `bits` bits of `value`; bits must be 0-32
+    void write(uint32_t value, int bits);
+
+    /// write a value using a 2-bit width prefix, so small values are short
+    void write_varbits(uint32_t value);
+
+    /// write a signed value with zigzag & varbits encoding
+    void write_signed(int32_t value);
+
+    /// write any bits still pending to the buffer; returns its size
+    size_t flush();
+
+    std::vector<uint8_t>& out;
+    uint64_t scratch;   // bits not yet written to `out`
+    int pending;        // number of bits in scratch
+};
+
+/// reads values written by a BitWriter
+///
+/// Reading past the end returns zeros, and sets `overflow`; check it once
+/// after decoding, rather than after every read.
+struct BitReader {
+    BitReader(const uint8_t *data, size_t size);
+
+    /// read a `bits` wide value; bits must be 0-32
+    uint32_t read(int bits);
+
+    uint32_t read_varbits();
+
+    int32_t read_signed();
+
+    const uint8_t *data;
+    size_t size;
+    size_t pos;         // next byte of data to load into scratch
+    uint64_t scratch;
+    int pending;
+    bool overflow;
+};
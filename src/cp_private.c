@@ -0,0 +1,429 @@
+/* chipmunk2d internals used by the modules; see cp_private.h
+ *
+ * This is the only source including chipmunk_private.h.  Where chipmunk2d
+ * keeps something in a source file instead (cpSpaceArbiterSetTrans() &
+ * cpBodyPushArbiter() do a step's work with the arbiter pool & contact
+ * graph), it's done here the same way, with the same private macros.
+ */
+#ifdef ALLOC_TRACKING
+// allocate on chipmunk2d's behalf through the hooks it's built with
+#include "alloc_hooks.h"
+#define cpcalloc physics_cpcalloc
+#define cprealloc physics_cprealloc
+#endif
+
+#include <assert.h>
+#include <chipmunk/chipmunk_private.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "cp_private.h"
+
+/// add a block of arbiters to a space's pool, as cpSpaceArbiterSetTrans()
+/// does when the pool runs out
+static void
+grow_pool(cpSpace *space)
+{
+    int count = CP_BUFFER_BYTES / sizeof(cpArbiter);
+    cpArbiter *block = (cpArbiter *)cpcalloc(1, CP_BUFFER_BYTES);
+    assert(block != NULL);
+    cpArrayPush(space->allocatedBuffers, block);
+    for (int i = 0; i < count; i++) {
+        cpArrayPush(space->pooledArbiters, block + i);
+    }
+}
+
+/// take an arbiter for a pair of shapes from a space's pool, growing the
+/// pool a block at a time
+static cpArbiter *
+pooled_arbiter(cpSpace *space, cpShape *a, cpShape *b)
+{
+    if (space->pooledArbiters->num == 0) {
+        grow_pool(space);
+    }
+    return cpArbiterInit((cpArbiter *)cpArrayPop(space->pooledArbiters),
+            a, b);
+}
+
+/// push an arbiter onto a body's list of them, as cpBodyPushArbiter() does
+/// for the arbiters of a step
+static void
+thread_arbiter(cpArbiter *arb, cpBody *body)
+{
+    cpArbiter *next = body->arbiterList;
+    cpArbiterThreadForBody(arb, body)->next = next;
+    if (next) {
+        cpArbiterThreadForBody(next, body)->prev = arb;
+    }
+    body->arbiterList = arb;
+}
+
+/// grow an array to hold `count` objects, as pushing them would
+static void
+reserve_array(cpArray *arr, int count)
+{
+    int num = arr->num;
+    while (arr->max < count) {
+        cpArrayPush(arr, NULL);
+    }
+    arr->num = num;
+}
+
+void
+physics_reserve(cpSpace *space,
+        int bodies,
+        int shapes,
+        int contacts,
+        int arbiters)
+{
+    assert(!space->locked && "space reserved during cpSpaceStep()");
+    reserve_array(space->dynamicBodies, bodies);
+    reserve_array(space->rousedBodies, bodies);
+    reserve_array(space->arbiters, arbiters);
+    while (space->pooledArbiters->num < arbiters) {
+        grow_pool(space);
+    }
+
+    // the cached arbiter set's bins, by caching an arbiter for each pair of
+    // a set of shapes that are in no space, as cpSpaceCollideShapes() would,
+    // then putting them all back in the pool; the set keeps its bins
+    int count = 2;
+    while (count * (count - 1) / 2 < arbiters) {
+        count++;
+    }
+    cpBody *body = cpBodyNewStatic();
+    cpShape **pairs = (cpShape **)cpcalloc(count, sizeof(cpShape *));
+    cpArray *cached = cpArrayNew(arbiters);
+    for (int i = 0; i < count; i++) {
+        pairs[i] = cpCircleShapeNew(body, 1, cpvzero);
+    }
+    for (int i = 0; i < count && cached->num < arbiters; i++) {
+        for (int j = i + 1; j < count && cached->num < arbiters; j++) {
+            const cpShape *pair[] = { pairs[i], pairs[j] };
+            cpArbiter *arb = pooled_arbiter(space, pairs[i], pairs[j]);
+            cpHashSetInsert(space->cachedArbiters,
+                    CP_HASH_PAIR(pair[0], pair[1]), pair, NULL, arb);
+            cpArrayPush(cached, arb);
+        }
+    }
+    for (int i = 0; i < cached->num; i++) {
+        cpArbiter *arb = (cpArbiter *)cached->arr[i];
+        const cpShape *pair[] = { arb->a, arb->b };
+        cpHashSetRemove(space->cachedArbiters,
+                CP_HASH_PAIR(pair[0], pair[1]), pair);
+        cpArrayPush(space->pooledArbiters, arb);
+    }
+    cpArrayFree(cached);
+    for (int i = 0; i < count; i++) {
+        cpShapeFree(pairs[i]);
+    }
+    cpfree(pairs);
+    cpBodyFree(body);
+
+    // the contact buffer ring, enough for `contacts` per step to persist
+    // for collisionPersistence steps.  The buffers are pushed stamped as old
+    // as can be, so the first steps rotate through them rather than
+    // allocate.  Once a space has been stepped the stamp of its oldest
+    // buffer decides whether a push rotates the ring or allocates, so it
+    // keeps the buffers its steps grew instead.
+    if (!space->contactBuffersHead) {
+        // less the buffer header, which is smaller than a contact, and the
+        // room cpContactBufferGetArray() leaves for a full arbiter
+        int per_buffer = CP_BUFFER_BYTES / sizeof(struct cpContact) - 1
+            - CP_MAX_CONTACTS_PER_ARBITER;
+        int buffers = (contacts + per_buffer - 1) / per_buffer
+            * (space->collisionPersistence + 1) + 1;
+        cpTimestamp stamp = space->stamp;
+        space->stamp = stamp - space->collisionPersistence - 1;
+        for (int i = 0; i < buffers; i++) {
+            cpSpacePushFreshContactBuffer(space);
+        }
+        space->stamp = stamp;
+    }
+
+    // the dynamic index's leaves, nodes & pairs, by adding overlapping
+    // groups of shapes far from everything, then removing them again; the
+    // index keeps them pooled
+    const int group = 8;        // 28 pairs per group
+    int groups = (shapes + group - 1) / group;
+    if (groups < (arbiters + 27) / 28) {
+        groups = (arbiters + 27) / 28;
+    }
+    cpBody *far = cpBodyNewKinematic();
+    cpBodySetPosition(far, cpv(1e6, 1e6));
+    cpSpaceAddBody(space, far);
+    for (int i = 0; i < groups * group; i++) {
+        cpSpaceAddShape(space,
+                cpCircleShapeNew(far, 1, cpv((i / group) * 10.0, 0)));
+    }
+    while (far->shapeList) {
+        cpShape *shape = far->shapeList;
+        cpSpaceRemoveShape(space, shape);
+        cpShapeFree(shape);
+    }
+    cpSpaceRemoveBody(space, far);
+    cpBodyFree(far);
+}
+
+/// cpHashSetFilter() func returning an arbiter to the pool
+static cpBool
+drop_arbiter(void *elt, void *data)
+{
+    cpArbiter *arb = (cpArbiter *)elt;
+    cpArbiterUnthread(arb);
+    cpArrayPush(((cpSpace *)data)->pooledArbiters, arb);
+    return cpFalse;
+}
+
+/// cpHashSetFilter() func keeping the arbiters between two shapes still in
+/// the space, and returning the rest to the pool
+static cpBool
+keep_arbiter(void *elt, void *data)
+{
+    cpArbiter *arb = (cpArbiter *)elt;
+    if (arb->a->space && arb->b->space) {
+        return cpTrue;
+    }
+    return drop_arbiter(elt, data);
+}
+
+/// drop the bodies no longer in a space from one of its body arrays
+static void
+compact_bodies(cpArray *arr)
+{
+    int kept = 0;
+    for (int i = 0; i < arr->num; i++) {
+        cpBody *body = (cpBody *)arr->arr[i];
+        if (body->space) {
+            arr->arr[kept++] = body;
+        }
+    }
+    arr->num = kept;
+}
+
+void
+physics_take(cpSpace *space,
+        cpBody **bodies,
+        int body_count,
+        cpShape **shapes,
+        int shape_count)
+{
+    assert(!space->locked && "bodies taken during cpSpaceStep()");
+
+    // wake everything, so every shape is in the index for its body type,
+    // and every body is in the body arrays
+    while (space->sleepingComponents->num) {
+        cpBodyActivate((cpBody *)space->sleepingComponents->arr[0]);
+    }
+
+    // bodies; marked as removed, then dropped from the arrays together
+    for (int i = 0; i < body_count; i++) {
+        if (bodies[i] && bodies[i]->space == space) {
+            bodies[i]->space = NULL;
+        }
+    }
+    compact_bodies(space->dynamicBodies);
+    compact_bodies(space->staticBodies);
+
+    // constraints on a taken body; left in the space, the step would solve
+    // them against the freed body
+    cpArray *constraints = space->constraints;
+    int kept_constraints = 0;
+    for (int i = 0; i < constraints->num; i++) {
+        cpConstraint *constraint = (cpConstraint *)constraints->arr[i];
+        if (constraint->a->space && constraint->b->space) {
+            constraints->arr[kept_constraints++] = constraint;
+            continue;
+        }
+        cpBodyRemoveConstraint(constraint->a, constraint);
+        cpBodyRemoveConstraint(constraint->b, constraint);
+        constraint->space = NULL;
+    }
+    constraints->num = kept_constraints;
+
+    // shapes; only the bodies staying in the space (such as its static
+    // body) need theirs unlinked, the others are freed with their lists
+    for (int i = 0; i < shape_count; i++) {
+        cpShape *shape = shapes[i];
+        if (!shape || shape->space != space) {
+            continue;
+        }
+        cpBody *body = shape->body;
+        cpSpatialIndexRemove(cpBodyGetType(body) == CP_BODY_TYPE_STATIC
+                ? space->staticShapes : space->dynamicShapes,
+                shape, shape->hashid);
+        if (body->space) {
+            cpBodyRemoveShape(body, shape);
+        }
+        shape->space = NULL;
+        shape->hashid = 0;
+    }
+
+    // arbiters involving a taken shape; the set keeps its bins, and
+    // contacts between the remaining shapes persist
+    cpHashSetFilter(space->cachedArbiters, keep_arbiter, space);
+    cpArray *arbiters = space->arbiters;
+    int kept = 0;
+    for (int i = 0; i < arbiters->num; i++) {
+        cpArbiter *arb = (cpArbiter *)arbiters->arr[i];
+        if (arb->a->space && arb->b->space) {
+            arbiters->arr[kept++] = arb;
+        }
+    }
+    arbiters->num = kept;
+}
+
+void
+physics_drop_arbiters(cpSpace *space)
+{
+    assert(!space->locked && "arbiters dropped during cpSpaceStep()");
+    cpHashSetFilter(space->cachedArbiters, drop_arbiter, space);
+    space->arbiters->num = 0;
+}
+
+void
+physics_each_cached_arbiter(cpSpace *space,
+        void (*func)(void *arb, void *data),
+        void *data)
+{
+    cpHashSetEach(space->cachedArbiters, func, data);
+}
+
+void
+physics_each_active_arbiter(cpSpace *space,
+        void (*func)(void *arb, void *data),
+        void *data)
+{
+    cpArray *arbiters = space->arbiters;
+    for (int i = 0; i < arbiters->num; i++) {
+        func(arbiters->arr[i], data);
+    }
+}
+
+void
+physics_restore_arbiter(cpSpace *space,
+        const cpArbiter *saved,
+        struct cpContact *contacts,
+        cpBool active)
+{
+    cpShape *a = (cpShape *)saved->a, *b = (cpShape *)saved->b;
+    cpArbiter *arb = pooled_arbiter(space, a, b);
+    *arb = *saved;
+    arb->thread_a.next = arb->thread_a.prev = NULL;
+    arb->thread_b.next = arb->thread_b.prev = NULL;
+    arb->contacts = contacts;
+
+    // keyed as cpSpaceCollideShapes() does, by the shape pair
+    const cpShape *pair[] = { a, b };
+    cpHashSetInsert(space->cachedArbiters, CP_HASH_PAIR(a, b), pair, NULL,
+            arb);
+    if (active) {
+        cpArrayPush(space->arbiters, arb);
+        thread_arbiter(arb, arb->body_a);
+        thread_arbiter(arb, arb->body_b);
+    }
+}
+
+// the runs of cpBody physics_body_state mirrors, from p to transform and
+// from v_bias to w_bias
+#define MOTION_BYTES \
+    (offsetof(struct physics_body_state, transform) + sizeof(cpTransform))
+#define BIAS_BYTES \
+    (sizeof(struct physics_body_state) \
+     - offsetof(struct physics_body_state, v_bias))
+
+_Static_assert(offsetof(cpBody, transform) - offsetof(cpBody, p)
+        == offsetof(struct physics_body_state, transform),
+        "cpBody's p..transform no longer match physics_body_state");
+_Static_assert(offsetof(cpBody, w_bias) - offsetof(cpBody, v_bias)
+        == offsetof(struct physics_body_state, w_bias)
+        - offsetof(struct physics_body_state, v_bias),
+        "cpBody's v_bias & w_bias no longer match physics_body_state");
+
+void
+physics_save_body(const cpBody *body, struct physics_body_state *state)
+{
+    memcpy(&state->p, &body->p, MOTION_BYTES);
+    memcpy(&state->v_bias, &body->v_bias, BIAS_BYTES);
+}
+
+cpBool
+physics_restore_body(cpBody *body, const struct physics_body_state *state)
+{
+    // waking a sleeping body that didn't move would change how the pile it
+    // sleeps in is simulated from here
+    if (cpBodyIsSleeping(body)) {
+        if (memcmp(&body->p, &state->p, MOTION_BYTES) == 0
+                && memcmp(&body->v_bias, &state->v_bias, BIAS_BYTES) == 0) {
+            return cpFalse;
+        }
+        cpBodyActivate(body);
+    }
+    memcpy(&body->p, &state->p, MOTION_BYTES);
+    memcpy(&body->v_bias, &state->v_bias, BIAS_BYTES);
+    return cpTrue;
+}
+
+void
+physics_reindex_shapes(cpSpace *space, cpShape **shapes, int count)
+{
+    assert(!space->locked && "shapes reindexed during cpSpaceStep()");
+    for (int i = 0; i < count; i++) {
+        cpSpatialIndexRemove(space->dynamicShapes, shapes[i],
+                shapes[i]->hashid);
+    }
+    for (int i = 0; i < count; i++) {
+        cpShapeCacheBB(shapes[i]);
+        cpSpatialIndexInsert(space->dynamicShapes, shapes[i],
+                shapes[i]->hashid);
+    }
+}
+
+void
+physics_order_bodies(cpSpace *space, cpBody **bodies, int count)
+{
+    assert(!space->locked && "bodies ordered during cpSpaceStep()");
+    cpArray *arr = space->dynamicBodies;
+    assert(count == arr->num && "not every awake body ordered");
+
+    // chipmunk2d keeps no index into this array, so it can be freely
+    // reordered between steps
+    for (int i = 0; i < count; i++) {
+        assert(bodies[i]->space == space && !cpBodyIsSleeping(bodies[i])
+                && cpBodyGetType(bodies[i]) != CP_BODY_TYPE_STATIC
+                && "ordered body not awake in the space");
+        arr->arr[i] = bodies[i];
+    }
+}
+
+int
+physics_awake_bodies(const cpSpace *space)
+{
+    return space->dynamicBodies->num;
+}
+
+void
+physics_save_clock(const cpSpace *space, struct physics_clock *clock)
+{
+    clock->stamp = space->stamp;
+    clock->curr_dt = space->curr_dt;
+}
+
+void
+physics_restore_clock(cpSpace *space, const struct physics_clock *clock)
+{
+    assert(!space->locked && "clock restored during cpSpaceStep()");
+    space->stamp = clock->stamp;
+    space->curr_dt = clock->curr_dt;
+}
+
+void
+physics_each_handler(cpSpace *space,
+        void (*func)(void *handler, void *data),
+        void *data)
+{
+    if (space->usesWildcards) {
+        func(&space->defaultHandler, data);
+    }
+    cpHashSetEach(space->collisionHandlers, func, data);
+}
@@ -0,0 +1,129 @@
+/* the chipmunk2d internals the modules reach into, behind plain functions
+ *
+ * chipmunk2d's public API has no way to pre-grow a space, take bodies &
+ * shapes out of one in bulk, drop or restore its cached arbiters, save &
+ * restore the state its steps advance, or walk its collision handlers.
+ * Everything doing that lives in cp_private.c, which is compiled against
+ * the vendored chipmunk_private.h instead of declaring any of it here, so
+ * moving to a chipmunk2d that changed those internals fails to build there
+ * rather than corrupting a space at runtime.  Nothing else may call
+ * chipmunk2d's private functions or copy its private definitions.
+ */
+#pragma once
+
+#include <chipmunk/chipmunk.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct cpContact;
+
+/* the state of a body a step advances: position, velocity, force, angle,
+ * angular velocity & torque, the transform they give, and the bias
+ * velocities the last step left for the next to integrate.  Laid out as
+ * cpBody lays them out, so each run is saved & restored with one memcpy */
+struct physics_body_state {
+    cpVect p, v, f;
+    cpFloat a, w, t;
+    cpTransform transform;
+    cpVect v_bias;
+    cpFloat w_bias;
+};
+
+/* a space's step clock: the timestamp contacts & arbiters are aged by, and
+ * the dt of the last step, which the next warm-starts from */
+struct physics_clock {
+    cpTimestamp stamp;
+    cpFloat curr_dt;
+};
+
+/* grow everything a space's steps grow for `bodies` bodies, `shapes`
+ * shapes, `contacts` contacts a step & `arbiters` colliding pairs: the body
+ * & arbiter arrays, the arbiter pool, the cached arbiter set, the contact
+ * buffer ring, and the dynamic index.  The set & index are grown with real
+ * shape pairs, added & taken out again; see chipmunk2d::reserve() */
+void physics_reserve(cpSpace *space,
+        int bodies,
+        int shapes,
+        int contacts,
+        int arbiters);
+
+/* take bodies & shapes out of a space with one pass over its body arrays &
+ * cached arbiters, where cpSpaceRemoveBody() & cpSpaceRemoveShape() make a
+ * pass per object; see chipmunk2d::reset().  NULL entries, and ones not in
+ * `space`, are skipped.  Every sleeping body in the space is woken first,
+ * and arbiters involving a taken shape go back to the pool without calling
+ * separate.  Constraints attached to a taken body are taken out of the space
+ * too, and unlinked from both bodies; they are not freed, whoever created
+ * them still owns them. */
+void physics_take(cpSpace *space,
+        cpBody **bodies,
+        int body_count,
+        cpShape **shapes,
+        int shape_count);
+
+/* return every cached arbiter in a space to its pool, without calling
+ * separate */
+void physics_drop_arbiters(cpSpace *space);
+
+/* call `func` with each of a space's cached arbiters, as a cpArbiter * */
+void physics_each_cached_arbiter(cpSpace *space,
+        void (*func)(void *arb, void *data),
+        void *data);
+
+/* call `func` with each arbiter the last step solved, in the order it solved
+ * them, as a cpArbiter * */
+void physics_each_active_arbiter(cpSpace *space,
+        void (*func)(void *arb, void *data),
+        void *data);
+
+/* put a copy of `saved` into a space's cached arbiters with `contacts`, and
+ * onto the contact graph if it was `active` in the step it was saved after;
+ * its shape pair must not already be cached */
+void physics_restore_arbiter(cpSpace *space,
+        const cpArbiter *saved,
+        struct cpContact *contacts,
+        cpBool active);
+
+/* copy the state of a body */
+void physics_save_body(const cpBody *body, struct physics_body_state *state);
+
+/* put a body back in a saved state; an awake body is overwritten without
+ * any checks.  A sleeping one is woken first, unless it already was in that
+ * state, when cpFalse is returned and it is left alone */
+cpBool physics_restore_body(cpBody *body,
+        const struct physics_body_state *state);
+
+/* take `count` shapes out of a space's dynamic index, then put them back in
+ * the order given, so the index has the same tree & leaf order whatever it
+ * had before; each shape's bounding box is updated as it goes back in */
+void physics_reindex_shapes(cpSpace *space, cpShape **shapes, int count);
+
+/* set the order a space's awake non-static bodies are integrated & have
+ * their shapes updated in by its step; `bodies` must be exactly those
+ * bodies, each once.  Only the space's array of them is reordered, the
+ * bodies themselves stay where they are in memory; see chipmunk2d_morton */
+void physics_order_bodies(cpSpace *space, cpBody **bodies, int count);
+
+/* the number of awake non-static bodies in a space, the bodies
+ * physics_order_bodies() takes */
+int physics_awake_bodies(const cpSpace *space);
+
+/* copy a space's step clock */
+void physics_save_clock(const cpSpace *space, struct physics_clock *clock);
+
+/* set a space's step clock back to a saved one */
+void physics_restore_clock(cpSpace *space, const struct physics_clock *clock);
+
+/* call `func` with each collision handler added to a space, as a
+ * cpCollisionHandler *.  The default handler, whose types are both
+ * CP_WILDCARD_COLLISION_TYPE, comes first, if the space has switched to it
+ * with cpSpaceAddDefaultCollisionHandler() or a wildcard handler */
+void physics_each_handler(cpSpace *space,
+        void (*func)(void *handler, void *data),
+        void *data);
+
+#ifdef __cplusplus
+}
+#endif
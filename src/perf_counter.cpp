@@ -0,0 +1,60 @@
+#include "perf_counter.hpp"
+#include "common.hpp"
+
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+PerfCounter::PerfCounter()
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    // this thread, any cpu, no group
+    fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd < 0) {
+        log_warn("perf_event_open failed, cache misses will read as 0; {}",
+                std::strerror(errno));
+    }
+}
+
+PerfCounter::~PerfCounter()
+{
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+void
+PerfCounter::start()
+{
+    if (fd < 0) {
+        return;
+    }
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+uint64_t
+PerfCounter::stop()
+{
+    if (fd < 0) {
+        return 0;
+    }
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+
+    uint64_t count = 0;
+    if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+        log_errno("failed to read perf counter");
+        return 0;
+    }
+    return count;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+
+/// hardware cache miss counter for the calling thread
+///
+/// Uses perf_event_open(2).  When perf events are not available, such as in
+/// a container or with a restrictive `kernel.perf_event_paranoid`,
+/// `available()` is false and every count reads as zero, so benchmarks can
+/// still report their timings.
+struct PerfCounter {
+    PerfCounter();
+    PerfCounter(const PerfCounter&) = delete;
+    ~PerfCounter();
+
+    PerfCounter& operator=(const PerfCounter&) = delete;
+
+    /// check if the counter could be opened
+    bool available() const { return fd >= 0; }
+
+    /// reset & start counting
+    void start();
+
+    /// stop counting, and return the cache misses since `start()`
+    uint64_t stop();
+
+    int fd;
+};
@@ -11,13 +11,45 @@
  * time.
  */
 
+#ifdef ALLOC_TRACKING
+// allocate CompoundBody blocks through the hooks chipmunk2d is built with, so
+// they're counted as chipmunk2d's
+#include "alloc_hooks.h"
+#define cpcalloc physics_cpcalloc
+#endif
+
+#include <algorithm>
+#include <atomic>
 #include <chipmunk/chipmunk.h>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <cstdlib>
 #include <flecs.h>
+#include <functional>
+#include <future>
 #include <gtest/gtest.h>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
+#include "alloc_tracker.hpp"
+#include "bit_stream.hpp"
 #include "common.hpp"
+#include "cp_private.h"
 #include "flecs/addons/cpp/c_types.hpp"
+#include "perf_counter.hpp"
+#include "trace.hpp"
+#include "transform_shm.hpp"
+#include "world_scheduler.hpp"
 
 /// wrapper around cpSpace
 struct Space {
@@ -155,259 +187,8353 @@ enum CollisionType {
     CT_Sensor,
 };
 
-/// chipmunk2d module to load into flecs
-struct chipmunk2d {
-    chipmunk2d(flecs::world &ecs) {
-        // create the physics space all bodies will reside in
-        cpSpace *space = cpSpaceNew();
-        assert(space != nullptr);
+/// what a PhysicsChange adds to, or removes from, a space
+enum PhysicsKind {
+    Physics_Body,
+    Physics_Shape,
+};
 
-        // set no gravity for now
-        cpSpaceSetGravity(space, {0, 0});
+/// a cpBody or cpShape the chipmunk2d observers are adding to, or removing
+/// from, a space; see PhysicsHook
+struct PhysicsChange {
+    flecs::entity entity;   // whose component it is
+    PhysicsKind kind;
+    void *ptr;              // cpBody or cpShape
+    // removals only: frees the object once it is out of its space, or null
+    // when it lives on after the removal (a body chipmunk2d_aoi freezes)
+    void (*release)(void *ptr);
+};
 
-        // add the space to the world as a singleton component
-        ecs.set<Space>(space);
+/// callbacks a chipmunk2d module installs with chipmunk2d::hook() to change
+/// how bodies & shapes enter & leave the space, and how it is stepped
+///
+/// The core observers & step_space know nothing of the other modules; each
+/// calls the hooks, in the order they were installed, and does the usual
+/// thing unless a hook took it over.  Any callback may be null.
+struct PhysicsHook {
+    // a cpBody or cpShape is to be added to the space; return true to add
+    // it later with chipmunk2d::insert(), and keep the later hooks from
+    // seeing it
+    bool (*add)(flecs::world& ecs, const PhysicsChange& change) = nullptr;
+    // a cpBody or cpShape is to be removed from its space; every hook sees
+    // it.  Return true to remove & release it later with
+    // chipmunk2d::extract(); the component then lets go of it.
+    bool (*remove)(flecs::world& ecs, const PhysicsChange& change) = nullptr;
+    // around the body of each core observer
+    void (*observer_begin)(flecs::world& ecs, const char *name,
+            PhysicsKind kind, bool added) = nullptr;
+    void (*observer_end)(flecs::world& ecs, const char *name) = nullptr;
+    // before step_space steps the space, and after the step is done
+    void (*pre_step)(flecs::world& ecs) = nullptr;
+    void (*post_step)(flecs::world& ecs) = nullptr;
+    // return true if the space is stepped elsewhere this frame; whoever
+    // steps it then calls chipmunk2d::post_step() when the step is done
+    bool (*step)(flecs::world& ecs, cpFloat dt) = nullptr;
+    // the world's thread spent `us` stepping the space, or waiting on it
+    void (*stepped)(flecs::world& ecs, uint64_t us) = nullptr;
+    // time to advance the physics by, for a frame of `dt`
+    cpFloat (*dt)(const flecs::world& ecs, cpFloat dt) = nullptr;
+    // chipmunk2d::reset() is about to take every body & shape with an
+    // entity out of its space, then delete the entities without calling
+    // `remove`; drop anything kept of them
+    void (*reset)(flecs::world& ecs) = nullptr;
+};
 
-        // add a system to step the physics space each frame
-        ecs.system<>("step_space")
-            .kind(flecs::PreUpdate)
-            .iter([](flecs::iter &it) {
-                auto *space = it.world().get_mut<Space>();
-                cpSpaceStep(*space, it.delta_time());
-            });
+/// PhysicsHooks installed in a world, in order
+struct PhysicsHooks {
+    std::vector<PhysicsHook> hooks;
+    // while set, the core observers leave bodies & shapes alone, so
+    // chipmunk2d::reserve() & reset() can create & delete entities in bulk
+    bool suspended = false;
+};
 
-        // When a Body component is added to an entity do the following:
-        // - set the cpBody UserData to be the entity id
-        //   - this allows chipmunk2d collision handlers to map from cpBody to
-        //     a flecs entity id
-        // - add the cpBody to the singleton cpSpace
-        ecs.observer<Body, Space>("body_on_set")
-            .arg(2).src<Space>()
-            .event(flecs::OnSet)
-            .each([](flecs::entity entity, Body& body, Space& space) {
-                    log_debug("Body OnSet {}", entity);
-                    cpBodySetUserData(body, (void *)entity.id());
-                    cpSpaceAddBody(space, body);
-                });
+/// lightweight projectile that never enters the solver
+///
+/// Instead of a cpBody & cpShape, a projectile is plain data moved each frame
+/// by sweeping a circle of `radius` from its last position to its next with a
+/// segment query against the space.  When it strikes an entity, the same
+/// `(Collision, other)` pairs the collision handlers add for a body
+/// projectile are added: to both the projectile and whatever it hit.  The
+/// projectile then stops at the point of impact, and its Projectile component
+/// is removed so it is not swept again; the entity itself is left for the
+/// game to destroy.  Use `filter` to keep it from striking its shooter.
+struct Projectile {
+    cpVect position;
+    cpVect velocity;
+    cpFloat radius;
+    cpShapeFilter filter;
+};
 
-        // When a Body component is removed from an entity, remove the
-        // associated cpBody from the singleton cpSpace
-        ecs.observer<Body, Space>("body_on_remove")
-            .arg(2).src<Space>()
-            .event(flecs::OnRemove)
-            .each([](flecs::entity entity, Body& body, Space& space) {
-                    log_debug("Body OnRemove {}", entity);
-                    cpSpaceRemoveBody(space, body);
-                });
+/// tag for a Projectile that passes through whatever it strikes; only the
+/// struck entity gets `(Collision, projectile)`
+struct Piercing {};
 
-        // When a Shape component is added to an entity do the following:
-        // - add the cpBody to the singleton cpSpace
-        ecs.observer<Shape, Space>("shape_on_set")
-            .arg(2).src<Space>()
-            .event(flecs::OnSet)
-            .each([](flecs::entity entity, Shape& shape, Space& space) {
-                    log_debug("Shape OnSet {}", entity);
-                    cpSpaceAddShape(space, shape);
-                });
+/// what FastMoving does when the sweep finds a hit
+enum CcdMode {
+    // move the body back to the time of impact, just touching what it hit,
+    // and remove its velocity into the surface; the next step then sees a
+    // normal contact, and the usual collision handlers run
+    CCD_Clamp,
+    // leave the body where it is, and add `(Collision, other)` to it
+    CCD_Report,
+};
 
-        // When a Shape component is removed from an entity, remove the cpShape
-        // from the singleton cpSpace
-        ecs.observer<Shape, Space>("shape_on_remove")
-            .arg(2).src<Space>()
-            .event(flecs::OnRemove)
-            .each([](flecs::entity entity, Shape& shape, Space& space) {
-                    log_debug("Shape OnRemove {}", entity);
-                    cpSpaceRemoveShape(space, shape);
-                });
-    }
+/// opt-in continuous collision detection for a Body that moves far enough in
+/// one step to tunnel through thin geometry
+///
+/// After each step, every shape on the body is swept with a segment query
+/// from where the body was before the step to where it is now, and the
+/// first hit is handled according to `mode`.  Only these bodies pay for the
+/// sweep, so the world does not need to be substepped to protect a few fast
+/// projectiles.  Circles are swept exactly.  Other shapes are swept as the
+/// circle around their bounding box, and each shape that circle touches is
+/// then checked against the real shape, moved along the sweep in steps no
+/// longer than half its width, to find when they first touch.
+struct FastMoving {
+    CcdMode mode;
+    cpVect last_position;   // set by the module before each step
 };
 
-// scenarios:
-// - projectile collides with entity
-// - player runs into closed door
-// - player steps on trap
-// - pivot-joint based movement
-// - multiple shapes on a single body
+/// tag for a Shape whose static geometry moved; the module reindexes it in
+/// the static spatial index before the next step, then removes the tag
+///
+/// Move the static body (a door sliding open), or change the shape, then add
+/// StaticDirty to the entity of each Shape affected.
+struct StaticDirty {};
 
-/// shoot a projectile at an object, destroying both when they collide
-TEST(simple_struct, projectile_collision) {
-    // create the world and load the chipmunk2d plugin
-    flecs::world ecs;
-    ecs.import<chipmunk2d>();
+/// how many StaticDirty shapes are reindexed one at a time before the module
+/// instead rebuilds & optimizes the whole static index
+struct StaticReindex {
+    int threshold;
+};
 
-    // get the space singleton, it was created by the plugin.  We need it for
-    // creating physics bodies and shapes.
-    Space &space = *ecs.get_mut<Space>();
+/// description of one shape in a CompoundBody
+struct ShapeDef {
+    enum Kind { Circle, Box, Segment };
 
-    // add a collision handler to the space to add a collision component to any
-    // entity struct by a projectile
-    cpCollisionHandler* handler =
-        cpSpaceAddWildcardHandler(space, CT_Projectile);
-    handler->userData  = &ecs;
-    handler->beginFunc = [](cpArbiter* arb, cpSpace*,
-                             cpDataPointer data) -> cpBool {
-        auto* ecs = static_cast<flecs::world *>(data);
-        assert(ecs != nullptr && "invalid world in space userdata");
+    static ShapeDef circle(cpFloat radius, cpVect offset = cpvzero) {
+        return { Circle, radius, offset, cpvzero, 0, 0 };
+    }
+    static ShapeDef box(cpFloat width, cpFloat height, cpFloat radius = 0) {
+        return { Box, radius, cpvzero, cpvzero, width, height };
+    }
+    static ShapeDef segment(cpVect a, cpVect b, cpFloat radius = 0) {
+        return { Segment, radius, a, b, 0, 0 };
+    }
 
-        cpBody *a, *b;
-        cpArbiterGetBodies(arb, &a, &b);
-        flecs::entity proj = ecs->entity((uintptr_t)cpBodyGetUserData(a));
-        flecs::entity other = ecs->entity((uintptr_t)cpBodyGetUserData(b));
+    Kind kind;
+    cpFloat radius;
+    cpVect a;           // circle offset, or segment start
+    cpVect b;           // segment end
+    cpFloat width, height;
+};
 
-        log_debug("projectile collision: {} -> {}",
-                proj.doc_name(), other.doc_name());
+/// cpBody & its cpShapes co-allocated in a single block
+///
+/// cpBodyNew() and cpCircleShapeNew()/cpBoxShapeNew() each allocate on their
+/// own, leaving the solver & broadphase to chase pointers all over the heap.
+/// This allocates the body followed by its shapes in one contiguous block,
+/// and builds them with chipmunk2d's `*Init()` functions.  It replaces the
+/// Body & Shape pair on an entity; the module adds the body & every shape
+/// to the space when set, and removes them when removed.  Systems that
+/// require Body (CCD, LOD, AOI) do not see these entities.
+struct CompoundBody {
+    // every shape gets the same sized slot; a box fits in the inline
+    // storage of cpPolyShape, so nothing else is allocated
+    union Slot {
+        cpCircleShape circle;
+        cpSegmentShape segment;
+        cpPolyShape poly;
+    };
 
-        proj.add<Collision>(other);
-        other.add<Collision>(proj);
+    CompoundBody() : body{nullptr}, count{0} {}
+    CompoundBody(cpFloat mass,
+            cpFloat moment,
+            std::initializer_list<ShapeDef> defs) : count{(int)defs.size()} {
+        body = (cpBody *)cpcalloc(1, sizeof(cpBody) + count * sizeof(Slot));
+        assert(body != nullptr);
+        cpBodyInit(body, mass, moment);
+        log_debug("alloc compound body {} with {} shapes",
+                fmt::ptr(body), count);
 
-        return true;
-    };
+        Slot *slots = (Slot *)(body + 1);
+        for (const ShapeDef& def : defs) {
+            switch (def.kind) {
+            case ShapeDef::Circle:
+                cpCircleShapeInit(&slots->circle, body, def.radius, def.a);
+                break;
+            case ShapeDef::Box:
+                cpBoxShapeInit(&slots->poly, body, def.width, def.height,
+                        def.radius);
+                break;
+            case ShapeDef::Segment:
+                cpSegmentShapeInit(&slots->segment, body, def.a, def.b,
+                        def.radius);
+                break;
+            }
+            slots++;
+        }
+    }
+    CompoundBody(const CompoundBody&) = delete;
+    CompoundBody(CompoundBody&& other) : body{nullptr}, count{0} {
+        *this = std::move(other);
+    }
+    ~CompoundBody() {
+        release();
+    }
 
-    // create a system that removes any entity struck in a collision, both the
-    // projectile and the object
-    ecs.system<>()
-        .with<Collision>(flecs::Wildcard)
-        .each([](flecs::entity e) {
-                log_debug("{} collided; removing", e.doc_name());
-                e.destruct();
-            });
+    CompoundBody& operator=(const CompoundBody&) = delete;
+    CompoundBody& operator=(CompoundBody&& other) {
+        if (this != &other) {
+            release();
+            body        = other.body;
+            count       = other.count;
+            other.body  = nullptr;
+            other.count = 0;
+        }
+        return *this;
+    }
 
-    // create an arrow entity
-    flecs::entity arrow = ecs.entity("arrow");
+    /// get one of the shapes, in the order they were defined
+    cpShape *shape(int index) const {
+        assert(index >= 0 && index < count);
+        return (cpShape *)((Slot *)(body + 1) + index);
+    }
 
-    // assign a physics body to it moving to the right at 10 units/sec
-    cpBody *body = cpBodyNew(1, INFINITY);
-    cpBodySetPosition(body, {0, 0});
-    cpBodySetVelocity(body, {10, 0});
-    arrow.set<Body>(body);
+    /// destroy the body & shapes, and free the block
+    void release() {
+        if (!body) {
+            return;
+        }
+        log_debug("free compound body {}", fmt::ptr(body));
+        assert(cpBodyGetSpace(body) == nullptr && "not removed from space");
+        for (int i = 0; i < count; i++) {
+            destroy_shape(shape(i));
+        }
+        free_block(body);
+        body = nullptr;
+    }
 
-    // add a shape to the physics body
-    cpShape *shape = cpCircleShapeNew(body, 1, {0,0});
-    cpShapeSetCollisionType(shape, CT_Projectile);
-    arrow.set<Shape>(shape);
+    /// PhysicsChange::release for a shape; its memory is part of the block
+    static void destroy_shape(void *shape) {
+        cpShapeDestroy((cpShape *)shape);
+    }
 
-    // create an apple entity
-    flecs::entity apple = ecs.entity("apple");
+    /// PhysicsChange::release for the body, once its shapes are destroyed
+    static void free_block(void *body) {
+        cpBodyDestroy((cpBody *)body);
+        cpfree(body);
+    }
 
-    // assign a physics body for the apple
-    body = cpBodyNew(1, INFINITY);
-    cpBodySetPosition(body, {10, 0});
-    apple.set<Body>(body);
+    /// support implicit cast to cpBody*
+    inline operator cpBody*() const {
+        assert(body != nullptr && "cpBody pointer not initialized");
+        return body;
+    };
 
-    // assign a 5x5 shape to the apple physics body
-    shape = cpBoxShapeNew(body, 5, 5, 3);
-    cpShapeSetCollisionType(shape, CT_Object);
-    apple.set<Shape>(shape);
+    cpBody *body;
+    int count;
+};
 
-    // advance the world a second in 1/60 sec frames
-    log_debug("stepping space");
-    for (int i = 0; i < 60; i++) {
-        ecs.progress(1/60.0);
-        if (!arrow.is_valid() || !apple.is_valid()) {
-            break;
+/// how a Tilemap is turned into collision shapes
+enum TilemapMode {
+    // solid tiles are merged into as few boxes as possible
+    TM_Boxes,
+    // a segment along each run of edges between solid & empty tiles; solid
+    // regions are hollow, so use this for terrain things don't spawn inside
+    TM_Segments,
+};
+
+/// tile occupancy grid built into static collision shapes
+///
+/// Instead of a Shape per solid tile, the map is split into square chunks,
+/// and each chunk is greedily merged into a handful of shapes attached to a
+/// single static cpBody owned by the Tilemap.  Tile (x, y) covers
+/// `[x, x + 1] * tile_size` by `[y, y + 1] * tile_size`.  Change tiles with
+/// `set()` on the component from `get_mut<Tilemap>()`; only the chunks
+/// touched are rebuilt, at the start of the next frame.  Collisions with the
+/// map resolve to the entity holding the Tilemap.  As with CompoundBody,
+/// chipmunk2d_tilemap adds the body & shapes to the space, and takes them
+/// out, through the PhysicsHooks; the Tilemap only builds & frees them.
+struct Tilemap {
+    Tilemap() : width{0}, height{0}, chunk_size{0}, tile_size{0},
+        mode{TM_Boxes}, friction{1}, body{nullptr} {}
+    Tilemap(int width,
+            int height,
+            cpFloat tile_size,
+            TilemapMode mode = TM_Boxes,
+            int chunk_size = 32)
+        : width{width}, height{height}, chunk_size{chunk_size},
+        tile_size{tile_size}, mode{mode}, friction{1}, body{nullptr},
+        tiles((size_t)width * height, 0) {
+        chunks_x = (width + chunk_size - 1) / chunk_size;
+        chunks_y = (height + chunk_size - 1) / chunk_size;
+        shapes.resize((size_t)chunks_x * chunks_y);
+        dirty.resize((size_t)chunks_x * chunks_y, 0);
+        for (size_t chunk = 0; chunk < dirty.size(); chunk++) {
+            mark(chunk);
         }
-        auto *p = arrow.get<Body>();
-        auto *a = apple.get<Body>();
-        log_debug("arrow {}, apple {}", *p->ptr, *a->ptr);
+    }
+    Tilemap(const Tilemap&) = delete;
+    Tilemap(Tilemap&& other) : body{nullptr} {
+        *this = std::move(other);
+    }
+    ~Tilemap() {
+        release();
     }
 
-    // verify that both the apple and the arrow were destroyed
-    EXPECT_EQ(arrow.is_valid(), false) << "arrow should have been destroyed";
-    EXPECT_EQ(apple.is_valid(), false) << "apple should have been destroyed";
-}
+    Tilemap& operator=(const Tilemap&) = delete;
+    Tilemap& operator=(Tilemap&& other) {
+        if (this != &other) {
+            release();
+            width        = other.width;
+            height       = other.height;
+            chunk_size   = other.chunk_size;
+            chunks_x     = other.chunks_x;
+            chunks_y     = other.chunks_y;
+            tile_size    = other.tile_size;
+            mode         = other.mode;
+            friction     = other.friction;
+            body         = other.body;
+            tiles        = std::move(other.tiles);
+            dirty        = std::move(other.dirty);
+            dirty_chunks = std::move(other.dirty_chunks);
+            shapes       = std::move(other.shapes);
+            other.body   = nullptr;
+        }
+        return *this;
+    }
 
-/// shoot a projectile at an object, only destroying the object, and allowing
-/// the projectile to continue travelling
-TEST(simple_struct, indestructable_projectile) {
-    // create the world and load the chipmunk2d plugin
-    flecs::world ecs;
-    ecs.import<chipmunk2d>();
+    /// check if a tile is solid; everything outside the map is empty
+    bool solid(int x, int y) const {
+        if (x < 0 || y < 0 || x >= width || y >= height) {
+            return false;
+        }
+        return tiles[(size_t)y * width + x];
+    }
 
-    // get the space singleton, it was created by the plugin.  We need it for
-    // creating physics bodies and shapes.
-    Space &space = *ecs.get_mut<Space>();
+    /// set a tile, marking the chunks whose shapes depend on it as dirty
+    void set(int x, int y, bool value) {
+        assert(x >= 0 && y >= 0 && x < width && y < height);
+        if (solid(x, y) == value) {
+            return;
+        }
+        tiles[(size_t)y * width + x] = value;
 
-    // add a collision handler to the space to add a collision component to any
-    // entity struct by a projectile
-    cpCollisionHandler* handler =
-        cpSpaceAddWildcardHandler(space, CT_Projectile);
-    handler->userData  = &ecs;
-    handler->beginFunc = [](cpArbiter* arb, cpSpace*,
-                             cpDataPointer data) -> cpBool {
-        auto* ecs = static_cast<flecs::world *>(data);
-        assert(ecs != nullptr && "invalid world in space userdata");
+        // edges of a tile on a chunk border belong to the neighbour too
+        int r = mode == TM_Segments ? 1 : 0;
+        for (int dy = -r; dy <= r; dy++) {
+            for (int dx = -r; dx <= r; dx++) {
+                int cx = (x + dx) / chunk_size, cy = (y + dy) / chunk_size;
+                if (x + dx >= 0 && y + dy >= 0
+                        && cx < chunks_x && cy < chunks_y) {
+                    mark((size_t)cy * chunks_x + cx);
+                }
+            }
+        }
+    }
 
-        cpBody *a, *b;
-        cpArbiterGetBodies(arb, &a, &b);
-        flecs::entity proj = ecs->entity((uintptr_t)cpBodyGetUserData(a));
-        flecs::entity other = ecs->entity((uintptr_t)cpBodyGetUserData(b));
+    /// queue a chunk to be rebuilt, unless it already is
+    void mark(size_t chunk) {
+        if (!dirty[chunk]) {
+            dirty[chunk] = 1;
+            dirty_chunks.push_back(chunk);
+        }
+    }
 
-        log_debug("projectile collision: {} -> {}",
-                proj, other);
+    /// total number of shapes across all chunks
+    size_t shape_count() const {
+        size_t count = 0;
+        for (auto& chunk : shapes) {
+            count += chunk.size();
+        }
+        return count;
+    }
 
-        other.add<Collision>(proj);
+    /// build new shapes for a dirty chunk, whose old shapes have been taken
+    /// out of the space & freed
+    void build(size_t chunk) {
+        assert(dirty[chunk] && "chunk not dirty");
+        dirty[chunk] = 0;
+        shapes[chunk].clear();
 
-        // return false here so chipmunk2d does not reduce the velocity of the
-        // projectile based on this collision.
-        return false;
-    };
+        int cx = chunk % chunks_x, cy = chunk / chunks_x;
+        if (mode == TM_Boxes) {
+            build_boxes(chunk, cx * chunk_size, cy * chunk_size);
+        } else {
+            build_segments(chunk, cx * chunk_size, cy * chunk_size);
+        }
+        for (cpShape *shape : shapes[chunk]) {
+            cpShapeSetFriction(shape, friction);
+        }
+    }
 
-    // create a system that removes any entity struck in a collision, both the
-    // projectile and the object
-    ecs.system<>()
-        .with<Collision>(flecs::Wildcard)
-        .each([](flecs::entity e) {
-                log_debug("{} collided; removing", e);
-                e.destruct();
-            });
+    /// cover the solid tiles of a chunk with boxes; each box starts at the
+    /// first uncovered solid tile, extends right as far as it can, then up
+    /// while the whole row beneath it is solid & uncovered
+    void build_boxes(size_t chunk, int x0, int y0) {
+        int w = std::min(chunk_size, width - x0);
+        int h = std::min(chunk_size, height - y0);
+        std::vector<uint8_t> covered((size_t)w * h, 0);
+        auto open = [&](int x, int y) {
+            return solid(x0 + x, y0 + y) && !covered[(size_t)y * w + x];
+        };
 
-    // create an arrow entity
-    flecs::entity arrow = ecs.entity("arrow");
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                if (!open(x, y)) {
+                    continue;
+                }
+                int bw = 1;
+                while (x + bw < w && open(x + bw, y)) {
+                    bw++;
+                }
+                int bh = 1;
+                for (; y + bh < h; bh++) {
+                    int i = 0;
+                    while (i < bw && open(x + i, y + bh)) {
+                        i++;
+                    }
+                    if (i < bw) {
+                        break;
+                    }
+                }
+                for (int j = 0; j < bh; j++) {
+                    for (int i = 0; i < bw; i++) {
+                        covered[(size_t)(y + j) * w + x + i] = 1;
+                    }
+                }
+                cpBB bb = cpBBNew((x0 + x) * tile_size,
+                        (y0 + y) * tile_size,
+                        (x0 + x + bw) * tile_size,
+                        (y0 + y + bh) * tile_size);
+                shapes[chunk].push_back(cpBoxShapeNew2(body, bb, 0));
+            }
+        }
+    }
 
-    // assign a physics body to it moving to the right at 20 units/sec
-    cpBody *body = cpBodyNew(1, INFINITY);
-    cpBodySetPosition(body, {0, 0});
-    cpBodySetVelocity(body, {25, 0});
-    arrow.set<Body>(body);
+    /// add a segment for each run of solid tile edges facing an empty tile
+    void build_segments(size_t chunk, int x0, int y0) {
+        int w = std::min(chunk_size, width - x0);
+        int h = std::min(chunk_size, height - y0);
 
-    // add a shape to the physics body
-    cpShape *shape = cpCircleShapeNew(body, 1, {0,0});
-    cpShapeSetCollisionType(shape, CT_Projectile);
-    arrow.set<Shape>(shape);
+        // (dx, dy) is the neighbour the edge faces; edges are scanned along
+        // rows for top & bottom, and along columns for left & right
+        const int dirs[4][2] = { { 0, 1 }, { 0, -1 }, { -1, 0 }, { 1, 0 } };
+        for (auto& dir : dirs) {
+            int dx = dir[0], dy = dir[1];
+            bool rows = dx == 0;
+            int lines = rows ? h : w, length = rows ? w : h;
+            for (int line = 0; line < lines; line++) {
+                int start = -1;
+                for (int i = 0; i <= length; i++) {
+                    int x = x0 + (rows ? i : line), y = y0 + (rows ? line : i);
+                    bool edge = i < length
+                        && solid(x, y) && !solid(x + dx, y + dy);
+                    if (edge && start < 0) {
+                        start = i;
+                    } else if (!edge && start >= 0) {
+                        add_edge(chunk, rows, x0, y0, line, start, i, dx, dy);
+                        start = -1;
+                    }
+                }
+            }
+        }
+    }
 
-    // create a row of apples to destroy
-    struct Apple {};
-    for (int i = 0; i < 5; i++) {
-        cpBody *body = cpBodyNew(1, INFINITY);
-        cpBodySetPosition(body, {5.0 + (i * 5), 0});
-        cpShape *shape = cpBoxShapeNew(body, 1, 1, 0);
-        cpShapeSetCollisionType(shape, CT_Object);
-        ecs.entity()
-            .add<Apple>()
-            .set<Body>(body)
-            .set<Shape>(shape);
+    /// add the segment for edge tiles [start, end) of a row or column
+    void add_edge(size_t chunk, bool rows, int x0, int y0, int line,
+            int start, int end, int dx, int dy) {
+        cpVect a, b;
+        if (rows) {
+            cpFloat y = (y0 + line + (dy > 0 ? 1 : 0)) * tile_size;
+            a = cpv((x0 + start) * tile_size, y);
+            b = cpv((x0 + end) * tile_size, y);
+        } else {
+            cpFloat x = (x0 + line + (dx > 0 ? 1 : 0)) * tile_size;
+            a = cpv(x, (y0 + start) * tile_size);
+            b = cpv(x, (y0 + end) * tile_size);
+        }
+        shapes[chunk].push_back(cpSegmentShapeNew(body, a, b, 0));
     }
 
-    // advance the world a second in 1/60 sec frames
-    log_debug("stepping space");
-    for (int i = 0; i < 60; i++) {
-        ecs.progress(1/60.0);
-        if (!arrow.is_valid()) {
-            break;
+    /// free the body & shapes
+    void release() {
+        for (auto& chunk : shapes) {
+            for (cpShape *shape : chunk) {
+                assert(cpShapeGetSpace(shape) == nullptr
+                        && "not removed from space");
+                cpShapeFree(shape);
+            }
+            chunk.clear();
+        }
+        if (body) {
+            assert(cpBodyGetSpace(body) == nullptr && "not removed from space");
+            cpBodyFree(body);
+            body = nullptr;
         }
-        auto *p = arrow.get<Body>();
-        log_debug("arrow {}", *p->ptr);
     }
 
-    // verify all the apples have been destroyed
-    EXPECT_EQ(ecs.count<Apple>(), 0) << "not all apples were destroyed";
+    /// PhysicsChange::release for a shape
+    static void free_shape(void *shape) {
+        cpShapeFree((cpShape *)shape);
+    }
 
-    EXPECT_EQ(arrow.is_valid(), true) << "arrow was unexpectedly destroyed";
+    /// PhysicsChange::release for the body
+    static void free_body(void *body) {
+        cpBodyFree((cpBody *)body);
+    }
 
-    // get the arrow body and verify it wasn't slowed down
-    const Body *b = arrow.get<Body>();
+    int width, height;
+    int chunk_size, chunks_x, chunks_y;
+    cpFloat tile_size;
+    TilemapMode mode;
+    cpFloat friction;               // applied to every shape built
+    cpBody *body;                   // static body created by the module
+    std::vector<uint8_t> tiles;     // row-major, non-zero is solid
+    std::vector<uint8_t> dirty;     // per chunk, set while in dirty_chunks
+    std::vector<size_t> dirty_chunks;   // to rebuild, in the order marked
+    std::vector<std::vector<cpShape *>> shapes;  // per chunk
+};
+
+/// heap allocations made during the last frame, by phase & source; only
+/// maintained in the ALLOC_TRACKING build
+///
+/// Only allocations made by the thread calling `progress()` are counted, so
+/// other worlds progressed on other threads don't show up here.  Neither do
+/// this world's allocations on other threads: flecs worker threads, or the
+/// chipmunk2d_async physics thread.
+///
+/// Collision handlers installed outside the module should start with
+/// `ALLOC_PHASE(AllocPhase_Callbacks)`, or their allocations are counted as
+/// part of the step.
+struct AllocStats {
+    AllocCounts frame;      // allocations during the last frame
+    AllocCounts start;      // totals at the start of the current frame
+    uint64_t frames;        // frames counted
+};
+
+/// collision reported to Deterministic, with the entities in id order
+struct CollisionEvent {
+    flecs::entity_t a, b;
+    cpVect point;       // first contact point
+    cpVect normal;      // from a to b
+};
+
+/// deterministic lockstep mode; import chipmunk2d_deterministic, and set
+/// this singleton to enable it
+///
+/// While set:
+/// - the space is stepped by `dt` every frame, whatever delta_time() is
+/// - bodies & shapes set between steps are not added to the space right
+///   away, but queued and added just before the step, sorted by entity id,
+///   so the order components are set in doesn't matter
+/// - collision handlers should not touch the world mid-step; use
+///   `Deterministic::begin` as the beginFunc, with the world as userData, to
+///   queue the collision in `events`, which are sorted canonically after the
+///   step for systems to act on
+/// - `state_hash` is an order-independent hash of every body's state after
+///   the step, and `hash` chains it with every previous frame, so peers can
+///   compare a single value each tick to detect a desync
+/// - CompoundBody is queued & added the same way as Body, along with its
+///   shapes
+///
+/// Static bodies are hashed as they are added, and again when their shapes
+/// are marked StaticDirty; move them any other way, and the move goes
+/// unnoticed by the hash.
+struct Deterministic {
+    /// record a collision; use as a collision handler's beginFunc with the
+    /// flecs::world as its userData.  It uses the world, so can't be used
+    /// with chipmunk2d_async, whose handlers run on the physics thread.
+    static cpBool begin(cpArbiter *arb, cpSpace *, cpDataPointer data) {
+        auto *ecs = static_cast<flecs::world *>(data);
+        if (!ecs->has<Deterministic>()) {
+            return cpTrue;
+        }
+
+        cpBody *body_a, *body_b;
+        cpArbiterGetBodies(arb, &body_a, &body_b);
+        CollisionEvent event = {
+            (flecs::entity_t)(uintptr_t)cpBodyGetUserData(body_a),
+            (flecs::entity_t)(uintptr_t)cpBodyGetUserData(body_b),
+            cpArbiterGetPointA(arb, 0),
+            cpArbiterGetNormal(arb),
+        };
+        if (event.b < event.a) {
+            std::swap(event.a, event.b);
+            event.normal = cpvneg(event.normal);
+        }
+        ecs->get_mut<Deterministic>()->events.push_back(event);
+        return cpTrue;
+    }
+
+    /// mix the bits of a value into a hash
+    static uint64_t mix(uint64_t hash, uint64_t value) {
+        // splitmix64 finalizer
+        uint64_t z = hash ^ (value + 0x9e3779b97f4a7c15ull + (hash << 6));
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    static uint64_t mix(uint64_t hash, cpFloat value) {
+        uint64_t bits = 0;
+        memcpy(&bits, &value, sizeof(value));
+        return mix(hash, bits);
+    }
+
+    /// hash of a single body's state, keyed by its entity
+    static uint64_t body_hash(cpBody *body) {
+        uint64_t h = mix(0, (uint64_t)(uintptr_t)cpBodyGetUserData(body));
+        cpVect p = cpBodyGetPosition(body), v = cpBodyGetVelocity(body);
+        h = mix(mix(h, p.x), p.y);
+        h = mix(mix(h, v.x), v.y);
+        h = mix(mix(h, cpBodyGetAngle(body)), cpBodyGetAngularVelocity(body));
+        return h;
+    }
+
+    /// hash a static body, replacing its previous contribution
+    void hash_static(cpBody *body) {
+        uint64_t h = body_hash(body);
+        auto [it, added] = statics.try_emplace(body, h);
+        if (!added) {
+            static_hash -= it->second;
+            it->second = h;
+        }
+        static_hash += h;
+    }
+
+    /// drop a static body's contribution, if it has one
+    void forget_static(cpBody *body) {
+        auto it = statics.find(body);
+        if (it != statics.end()) {
+            static_hash -= it->second;
+            statics.erase(it);
+        }
+    }
+
+    /// recompute the hashes from the bodies in a space
+    ///
+    /// Summing the per-body hashes makes the result independent of the order
+    /// chipmunk2d keeps the bodies in, and lets the static bodies' sum be
+    /// kept up to date incrementally.  Every other body is rehashed each
+    /// step: any awake body may have moved, and so may a body that fell
+    /// asleep during the step; telling which did costs as much as hashing
+    /// them.
+    void update_hash(cpSpace *space) {
+        if (frame == 0) {
+            statics.clear();
+            static_hash = 0;
+            for (int i = 0; i < space->staticBodies->num; i++) {
+                hash_static((cpBody *)space->staticBodies->arr[i]);
+            }
+        }
+
+        state_hash = static_hash;
+        cpArray *bodies = space->dynamicBodies;
+        for (int i = 0; i < bodies->num; i++) {
+            state_hash += body_hash((cpBody *)bodies->arr[i]);
+        }
+        cpArray *sleeping = space->sleepingComponents;
+        for (int i = 0; i < sleeping->num; i++) {
+            for (cpBody *body = (cpBody *)sleeping->arr[i]; body;
+                    body = body->sleeping.next) {
+                state_hash += body_hash(body);
+            }
+        }
+        hash = mix(hash, state_hash);
+        frame++;
+    }
+
+    cpFloat dt;
+    uint64_t frame;         // steps taken in deterministic mode
+    uint64_t state_hash;    // bodies after the last step
+    uint64_t hash;          // state_hash of every step so far, chained
+    std::vector<PhysicsChange> pending;     // bodies & shapes to add
+    std::vector<CollisionEvent> events;  // from the last step, sorted
+    uint64_t static_hash;   // sum of `statics`
+    std::unordered_map<cpBody *, uint64_t> statics;     // static body hashes
+};
+
+/// maximum return addresses kept for the slowest observer of a frame
+#define FRAME_RECORD_BT 16
+
+/// compact physics telemetry for one frame, kept by chipmunk2d_recorder
+///
+/// Observers that run between frames, such as when spawning entities, are
+/// counted towards the next frame.
+struct FrameRecord {
+    uint64_t frame;
+    uint32_t frame_us;          // OnLoad to OnStore
+    uint32_t step_us;           // cpSpaceStep()
+    uint32_t bodies_added, bodies_removed;
+    uint32_t shapes_added, shapes_removed;
+    uint32_t contacts;          // touching shape pairs after the step
+    uint32_t first_contacts;    // pairs that began touching in the step
+    uint32_t observer_calls;
+    uint32_t slowest_observer_us;
+    const char *slowest_observer;
+    // raw return addresses within the slowest observer, when it took longer
+    // than RecorderConfig::backtrace_us; symbolized offline against the
+    // /proc/self/maps saved with the window
+    void *bt[FRAME_RECORD_BT];
+    int bt_depth;
+};
+
+/// monotonic time in microseconds, for FrameRecord
+static uint64_t
+record_now_us(void)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// chipmunk2d_recorder configuration; set before importing the module
+struct RecorderConfig {
+    // frames of telemetry kept
+    int frames;
+    // a frame taking longer than this is written to disk, along with the
+    // frames before it
+    double threshold_ms;
+    // observers slower than this have their backtrace captured
+    uint32_t backtrace_us;
+    // windows are written to `<path_prefix>-<frame>.txt`
+    std::string path_prefix;
+};
+
+/// write a window of FrameRecords, oldest first, followed by the memory map
+/// needed to symbolize the backtraces
+static bool
+write_flight_window(const char *path, const std::vector<FrameRecord>& window)
+{
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        log_errno("failed to open flight recorder file {}", path);
+        return false;
+    }
+
+    fprintf(file, "# frame frame_us step_us bodies_added bodies_removed "
+            "shapes_added shapes_removed contacts first_contacts "
+            "observer_calls slowest_observer_us slowest_observer "
+            "backtrace...\n");
+    for (const FrameRecord& r : window) {
+        fprintf(file, "%lu %u %u %u %u %u %u %u %u %u %u %s",
+                (unsigned long)r.frame, r.frame_us, r.step_us,
+                r.bodies_added, r.bodies_removed,
+                r.shapes_added, r.shapes_removed,
+                r.contacts, r.first_contacts,
+                r.observer_calls, r.slowest_observer_us,
+                r.slowest_observer ? r.slowest_observer : "-");
+        for (int j = 0; j < r.bt_depth; j++) {
+            fprintf(file, " %p", r.bt[j]);
+        }
+        fprintf(file, "\n");
+    }
+
+    // resolve the addresses later with the load address of each object
+    // here, and addr2line
+    fprintf(file, "# /proc/self/maps\n");
+    if (FILE *maps = fopen("/proc/self/maps", "r")) {
+        char buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), maps)) > 0) {
+            fwrite(buf, 1, n, file);
+        }
+        fclose(maps);
+    }
+
+    if (fclose(file) != 0) {
+        log_errno("failed to write flight recorder file {}", path);
+        return false;
+    }
+    return true;
+}
+
+/// writes flight recorder windows to disk on a thread of its own, so the
+/// slow frame that triggered a dump isn't made slower still by the I/O
+///
+/// The window is copied out of the ring by the world's thread into `window`,
+/// which has room for a whole ring from the start.  While a window is being
+/// written, `pending` is set and the world's thread leaves `window` alone;
+/// another window handed over meanwhile is refused.
+struct FlightWriter {
+    FlightWriter(size_t frames) : pending{false}, quit{false} {
+        window.reserve(frames);
+        thread = std::thread([this]() { run(); });
+    }
+    FlightWriter(const FlightWriter&) = delete;
+    ~FlightWriter() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        cv.notify_all();
+        thread.join();
+    }
+
+    FlightWriter& operator=(const FlightWriter&) = delete;
+
+    /// copy the `count` frames before `head` out of a ring, oldest first,
+    /// and write them to `to`; returns false if the last window handed over
+    /// is still being written
+    bool write(const std::string& to, const std::vector<FrameRecord>& ring,
+            uint64_t head, uint64_t count) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (pending) {
+                return false;
+            }
+            path = to;
+            window.clear();
+            for (uint64_t i = head - count; i < head; i++) {
+                window.push_back(ring[i % ring.size()]);
+            }
+            pending = true;
+        }
+        cv.notify_all();
+        return true;
+    }
+
+    /// wait for the window being written, if any
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this]() { return !pending; });
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cv.wait(lock, [this]() { return pending || quit; });
+            if (pending) {
+                lock.unlock();
+                write_flight_window(path.c_str(), window);
+                lock.lock();
+                pending = false;
+                cv.notify_all();
+            }
+            if (quit) {
+                return;
+            }
+        }
+    }
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::string path;
+    std::vector<FrameRecord> window;
+    bool pending;       // window handed over & not yet written
+    bool quit;
+};
+
+/// ring of the last RecorderConfig::frames FrameRecords
+///
+/// The ring is allocated once; recording a frame only writes into it.  The
+/// slot for the frame in progress is `ring[head % ring.size()]`, which is
+/// where `recording` points.  It's a singleton, so the observers of each
+/// world record into that world's ring, whichever thread progresses it.
+///
+/// A window is persisted at most once per ring's worth of frames, as the
+/// frames after a slow one are usually slow too and each window would mostly
+/// repeat the last; slow frames within a window of the last dump are only
+/// counted in `skipped`.
+struct FlightRecorder {
+    FlightRecorder() : recording{nullptr}, backtrace_us{0}, head{0},
+        frame_start{0}, observer_start{0}, next_dump{0}, dumps{0},
+        skipped{0} {}
+    FlightRecorder(size_t frames, uint32_t backtrace_us)
+        : ring(frames), recording{&ring[0]}, backtrace_us{backtrace_us},
+          head{0}, frame_start{0}, observer_start{0}, next_dump{0}, dumps{0},
+          skipped{0}, writer{std::make_unique<FlightWriter>(frames)} {
+        recording->frame = 1;
+    }
+    FlightRecorder(const FlightRecorder&) = delete;
+    FlightRecorder(FlightRecorder&& other) = default;
+
+    FlightRecorder& operator=(const FlightRecorder&) = delete;
+    FlightRecorder& operator=(FlightRecorder&& other) = default;
+
+    /// the record for the frame in progress
+    FrameRecord& current() {
+        return ring[head % ring.size()];
+    }
+
+    /// finish the current frame, and start the next
+    void advance() {
+        head++;
+        FrameRecord& next = current();
+        next = {};
+        next.frame = head + 1;
+        recording = &next;
+    }
+
+    /// frames finished & still in the ring
+    uint64_t finished() const {
+        return std::min<uint64_t>(head, ring.size() - 1);
+    }
+
+    /// hand the finished frames in the ring to the writer thread, to be
+    /// written to `path`; returns false, and counts the window as skipped,
+    /// if it's too soon after the last one
+    bool persist(const std::string& path) {
+        if (head < next_dump || !writer->write(path, ring, head, finished())) {
+            skipped++;
+            return false;
+        }
+        next_dump = head + ring.size() - 1;
+        dumps++;
+        return true;
+    }
+
+    /// wait until the windows persisted so far are on disk
+    void flush() const {
+        writer->flush();
+    }
+
+    std::vector<FrameRecord> ring;
+    FrameRecord *recording;     // the frame in progress
+    uint32_t backtrace_us;      // RecorderConfig::backtrace_us
+    uint64_t head;              // frames finished
+    uint64_t frame_start;       // record_now_us() at OnLoad
+    uint64_t observer_start;    // record_now_us() as the observer began
+    uint64_t next_dump;         // head before which no window is persisted
+    int dumps;                  // windows handed to the writer
+    int skipped;                // slow frames not persisted
+    std::unique_ptr<FlightWriter> writer;
+};
+
+#ifdef TRACING
+/// writes traces to disk on a thread of its own, as FlightWriter does for
+/// flight recorder windows
+///
+/// trace_dump() reads the per-thread buffers directly, so only the path is
+/// handed over; the dump may include events recorded after the frame that
+/// asked for it.  Another dump asked for while one is being written is
+/// refused.
+struct TraceWriter {
+    TraceWriter() : pending{false}, quit{false} {
+        thread = std::thread([this]() { run(); });
+    }
+    TraceWriter(const TraceWriter&) = delete;
+    ~TraceWriter() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        cv.notify_all();
+        thread.join();
+    }
+
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    /// dump the trace to `to`; returns false if the last dump handed over
+    /// is still being written
+    bool write(const std::string& to) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (pending) {
+                return false;
+            }
+            path = to;
+            pending = true;
+        }
+        cv.notify_all();
+        return true;
+    }
+
+    /// wait for the dump being written, if any
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this]() { return !pending; });
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cv.wait(lock, [this]() { return pending || quit; });
+            if (pending) {
+                lock.unlock();
+                trace_dump(path.c_str());
+                lock.lock();
+                pending = false;
+                cv.notify_all();
+            }
+            if (quit) {
+                return;
+            }
+        }
+    }
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::string path;
+    bool pending;       // dump handed over & not yet written
+    bool quit;
+};
+
+/// frame tracing state & configuration; only in the TRACING build
+///
+/// Each frame is recorded as a "frame" event around the step & module
+/// observer events inside it.  When a frame takes longer than `budget_ms`,
+/// the whole trace is handed to a TraceWriter to be written to
+/// `<dump_prefix>-<frame>.json`, so the frames leading up to a hitch can be
+/// inspected after the fact.  As with FlightRecorder, a trace is dumped at
+/// most once every `dump_interval` frames; slow frames in between are only
+/// counted in `skipped`.
+///
+/// Only the module's own systems, observers & collision callbacks are
+/// traced; user systems & collision handlers add their own events with
+/// TRACE_SCOPE().
+struct Tracer {
+    Tracer() : Tracer(0, "trace", 300) {}
+    Tracer(double budget_ms, std::string dump_prefix, uint64_t dump_interval)
+        : budget_ms{budget_ms}, dump_prefix{std::move(dump_prefix)},
+          dump_interval{dump_interval}, frame{0}, frame_start{0},
+          next_dump{0}, dumps{0}, skipped{0} {
+        if (budget_ms > 0) {
+            writer = std::make_unique<TraceWriter>();
+        }
+    }
+    Tracer(const Tracer&) = delete;
+    Tracer(Tracer&& other) = default;
+
+    Tracer& operator=(const Tracer&) = delete;
+    Tracer& operator=(Tracer&& other) = default;
+
+    /// hand the trace to the writer thread, to be written to `path`;
+    /// returns false, and counts the frame as skipped, if it's too soon
+    /// after the last dump
+    bool dump(const std::string& path) {
+        // created here only if the budget was set after construction
+        if (!writer) {
+            writer = std::make_unique<TraceWriter>();
+        }
+        if (frame < next_dump || !writer->write(path)) {
+            skipped++;
+            return false;
+        }
+        next_dump = frame + dump_interval;
+        dumps++;
+        return true;
+    }
+
+    /// wait until the traces dumped so far are on disk
+    void flush() const {
+        if (writer) {
+            writer->flush();
+        }
+    }
+
+    double budget_ms;           // 0 to never dump automatically
+    std::string dump_prefix;
+    uint64_t dump_interval;     // frames from one dump to the next
+    uint64_t frame;
+    uint64_t frame_start;       // trace_now() at the start of this frame
+    uint64_t next_dump;         // frame before which no trace is dumped
+    int dumps;                  // traces handed to the writer
+    int skipped;                // slow frames not dumped
+    std::unique_ptr<TraceWriter> writer;
+};
+#endif
+
+/// when a shape on a FastMoving body, swept back by `delta` over the last
+/// step, first touched `other`; returns false if it never did
+///
+/// The shape is moved to fractions of the sweep from `from` on, `step` apart
+/// (capped so there are no more than 64 of them), until it overlaps `other`,
+/// then the time between the last clear fraction & the first overlapping one
+/// is bisected.  The shape is put back where its body is before returning.
+static bool
+ccd_touch(cpShape *shape, cpShape *other, cpVect delta, cpFloat from,
+        cpFloat step, cpFloat *alpha, cpVect *normal)
+{
+    cpTransform end = cpShapeGetBody(shape)->transform;
+    auto overlaps = [&](cpFloat at) {
+        cpShapeUpdate(shape, cpTransformMult(
+                    cpTransformTranslate(cpvmult(delta, at - 1)), end));
+        cpContactPointSet set = cpShapesCollide(shape, other);
+        if (set.count > 0) {
+            // the normal points from the shape into `other`
+            *normal = cpvneg(set.normal);
+        }
+        return set.count > 0;
+    };
+
+    step = cpfmax(step, 1.0 / 64);
+    cpFloat clear = from, at = from;
+    bool touched = overlaps(at);
+    while (!touched && at < 1) {
+        clear = at;
+        at = cpfmin(at + step, 1);
+        touched = overlaps(at);
+    }
+    if (touched && at > clear) {
+        for (int i = 0; i < 16; i++) {
+            cpFloat mid = (clear + at) / 2;
+            if (overlaps(mid)) {
+                at = mid;
+            } else {
+                clear = mid;
+            }
+        }
+        // leave the normal as found at `at`
+        overlaps(at);
+    }
+    *alpha = at;
+
+    cpShapeUpdate(shape, end);
+    return touched;
+}
+
+/// runs the PhysicsHook observer callbacks around the body of a core
+/// observer
+struct ObserverHooks {
+    ObserverHooks(flecs::world& ecs, const char *name, PhysicsKind kind,
+            bool added) : ecs{ecs}, name{name} {
+        for (const PhysicsHook& hook : ecs.get<PhysicsHooks>()->hooks) {
+            if (hook.observer_begin) {
+                hook.observer_begin(ecs, name, kind, added);
+            }
+        }
+    }
+    ObserverHooks(const ObserverHooks&) = delete;
+    ~ObserverHooks() {
+        for (const PhysicsHook& hook : ecs.get<PhysicsHooks>()->hooks) {
+            if (hook.observer_end) {
+                hook.observer_end(ecs, name);
+            }
+        }
+    }
+
+    ObserverHooks& operator=(const ObserverHooks&) = delete;
+
+    flecs::world& ecs;
+    const char *name;
+};
+
+/// chipmunk2d module to load into flecs
+struct chipmunk2d {
+    chipmunk2d(flecs::world &ecs) {
+        // create the physics space all bodies will reside in
+        cpSpace *space = cpSpaceNew();
+        assert(space != nullptr);
+
+        // set no gravity for now
+        cpSpaceSetGravity(space, {0, 0});
+
+        // add the space to the world as a singleton component
+        ecs.set<Space>(space);
+        ecs.set<PhysicsHooks>({});
+
+        if (!ecs.has<StaticReindex>()) {
+            ecs.set<StaticReindex>({ 64 });
+        }
+
+        // before the step, reindex the static shapes marked StaticDirty; a
+        // few are reindexed individually, but past the threshold the whole
+        // static tree is rebuilt & rebalanced once instead
+        auto static_dirty = ecs.query_builder<Shape>()
+            .with<StaticDirty>()
+            .build();
+        ecs.system<>("reindex_static")
+            .kind(flecs::PostLoad)
+            .iter([static_dirty](flecs::iter &it) {
+                TRACE_SCOPE("reindex_static");
+                int count = static_dirty.count();
+                if (count == 0) {
+                    return;
+                }
+
+                auto *space = it.world().get_mut<Space>();
+                bool full = count > it.world().get<StaticReindex>()->threshold;
+                if (full) {
+                    log_debug("reindexing all static shapes; {} dirty", count);
+                    cpSpaceReindexStatic(*space);
+                    cpBBTreeOptimize(space->ptr->staticShapes);
+                }
+                static_dirty.each([full](flecs::entity entity, Shape& shape) {
+                        if (!full && cpShapeGetSpace(shape)) {
+                            cpSpaceReindexShape(cpShapeGetSpace(shape), shape);
+                        }
+                        entity.remove<StaticDirty>();
+                    });
+            });
+
+#ifdef ALLOC_TRACKING
+        // count the allocations made between the start of OnLoad and the end
+        // of OnStore; anything not within a narrower phase is a system's
+        ecs.set<AllocStats>({});
+        ecs.system<AllocStats>("alloc_frame_begin")
+            .arg(1).src<AllocStats>()
+            .kind(flecs::OnLoad)
+            .iter([](flecs::iter&, AllocStats *stats) {
+                    alloc_counts(&stats->start);
+                    alloc_phase_set(AllocPhase_Systems);
+                });
+        ecs.system<AllocStats>("alloc_frame_end")
+            .arg(1).src<AllocStats>()
+            .kind(flecs::OnStore)
+            .iter([](flecs::iter&, AllocStats *stats) {
+                    alloc_phase_set(AllocPhase_Other);
+                    alloc_counts(&stats->frame);
+                    AllocCounts &frame = stats->frame, &start = stats->start;
+                    for (int p = 0; p < AllocPhase_Count; p++) {
+                        for (int s = 0; s < AllocSource_Count; s++) {
+                            frame.count[p][s] -= start.count[p][s];
+                            frame.bytes[p][s] -= start.bytes[p][s];
+                        }
+                    }
+                    stats->frames++;
+                });
+#endif
+
+#ifdef TRACING
+        if (!ecs.has<Tracer>()) {
+            ecs.set<Tracer>(Tracer());
+        }
+        ecs.system<Tracer>("trace_frame_begin")
+            .arg(1).src<Tracer>()
+            .kind(flecs::OnLoad)
+            .iter([](flecs::iter&, Tracer *tracer) {
+                    tracer->frame++;
+                    tracer->frame_start = trace_now();
+                });
+        ecs.system<Tracer>("trace_frame_end")
+            .arg(1).src<Tracer>()
+            .kind(flecs::OnStore)
+            .iter([](flecs::iter&, Tracer *tracer) {
+                    uint64_t end = trace_now();
+                    trace_event("frame", tracer->frame_start, end);
+
+                    double ms = (end - tracer->frame_start) / 1e6;
+                    if (tracer->budget_ms > 0 && ms > tracer->budget_ms) {
+                        std::string path = fmt::format("{}-{}.json",
+                                tracer->dump_prefix, tracer->frame);
+                        if (tracer->dump(path)) {
+                            log_warn("frame {} took {:.3f} ms, over {} ms "
+                                    "budget; writing trace to {}",
+                                    tracer->frame, ms, tracer->budget_ms,
+                                    path);
+                        }
+                    }
+                });
+#endif
+
+        // add a system to step the physics space each frame; the
+        // PhysicsHooks run before & after, and may step it elsewhere
+        ecs.system<>("step_space")
+            .kind(flecs::PreUpdate)
+            .iter([](flecs::iter &it) {
+                flecs::world ecs = it.world();
+                cpFloat dt = chipmunk2d::dt(ecs, it.delta_time());
+                const auto& hooks = ecs.get<PhysicsHooks>()->hooks;
+                for (const PhysicsHook& hook : hooks) {
+                    if (hook.pre_step) {
+                        hook.pre_step(ecs);
+                    }
+                }
+                bool elsewhere = false;
+                for (const PhysicsHook& hook : hooks) {
+                    elsewhere |= hook.step && hook.step(ecs, dt);
+                }
+                if (!elsewhere) {
+                    {
+                        TRACE_SCOPE("step_space");
+                        ALLOC_PHASE(AllocPhase_Step);
+                        auto start = std::chrono::steady_clock::now();
+                        cpSpaceStep(*ecs.get<Space>(), dt);
+                        chipmunk2d::stepped(ecs, start);
+                    }
+                    chipmunk2d::post_step(ecs);
+                }
+            });
+
+        // after the step, advance every Projectile through the space
+        ecs.system<Projectile, Space>("advance_projectiles")
+            .arg(2).src<Space>()
+            .kind(flecs::PreUpdate)
+            .each([](flecs::entity entity, Projectile& proj, Space& space) {
+                cpFloat dt = chipmunk2d::dt(entity.world(),
+                        entity.world().delta_time());
+                cpVect start = proj.position;
+                proj.velocity = cpvadd(proj.velocity,
+                        cpvmult(cpSpaceGetGravity(space), dt));
+                proj.position = cpvadd(start, cpvmult(proj.velocity, dt));
+
+                if (entity.has<Piercing>()) {
+                    // mark everything along the path that we haven't already
+                    // struck, and keep going
+                    cpSpaceSegmentQuery(space, start, proj.position,
+                            proj.radius, proj.filter,
+                            [](cpShape *shape, cpVect, cpVect, cpFloat,
+                                    void *data) {
+                                if (cpShapeGetSensor(shape)) {
+                                    return;
+                                }
+                                auto *proj = static_cast<flecs::entity *>(data);
+                                auto id = (uintptr_t)cpBodyGetUserData(
+                                        cpShapeGetBody(shape));
+                                if (id == 0) {
+                                    return;
+                                }
+                                flecs::entity other = proj->world().entity(id);
+                                if (!other.has<Collision>(*proj)) {
+                                    log_debug("projectile collision: {} -> {}",
+                                            *proj, other);
+                                    other.add<Collision>(*proj);
+                                }
+                            }, &entity);
+                    return;
+                }
+
+                cpSegmentQueryInfo info;
+                cpShape *shape = cpSpaceSegmentQueryFirst(space, start,
+                        proj.position, proj.radius, proj.filter, &info);
+                if (!shape) {
+                    return;
+                }
+
+                // shapes not owned by an entity (user data 0) still stop
+                // the projectile, but there is nothing to mark
+                auto id = (uintptr_t)cpBodyGetUserData(cpShapeGetBody(shape));
+                if (id != 0) {
+                    flecs::entity other = entity.world().entity(id);
+                    log_debug("projectile collision: {} -> {}", entity, other);
+                    entity.add<Collision>(other);
+                    other.add<Collision>(entity);
+                }
+
+                // stop at the point of impact, for the last time
+                proj.position = cpvlerp(start, proj.position, info.alpha);
+                proj.velocity = cpvzero;
+                entity.remove<Projectile>();
+            });
+
+        // record where each FastMoving body is before the step
+        ecs.system<FastMoving, Body>("ccd_record")
+            .kind(flecs::PostLoad)
+            .each([](FastMoving& ccd, Body& body) {
+                    ccd.last_position = cpBodyGetPosition(body);
+                });
+
+        // shapes the bounding circle of a non-circle touched, and when;
+        // kept across bodies & frames, so sweeping doesn't allocate once it
+        // has grown
+        auto near = std::make_shared<
+            std::vector<std::pair<cpFloat, cpShape *>>>();
+
+        // after the step, sweep each FastMoving body from where it was to
+        // where it is now looking for anything it passed through
+        ecs.system<FastMoving, Body, Space>("ccd_sweep")
+            .arg(3).src<Space>()
+            .kind(flecs::PreUpdate)
+            .each([near](flecs::entity entity,
+                        FastMoving& ccd,
+                        Body& body,
+                        Space& space) {
+                cpVect delta = cpvsub(cpBodyGetPosition(body),
+                        ccd.last_position);
+                if (cpveql(delta, cpvzero)) {
+                    return;
+                }
+
+                struct Sweep {
+                    cpSpace *space;
+                    cpBody *body;
+                    cpVect delta;
+                    cpShape *hit;
+                    cpFloat alpha;
+                    cpVect normal;
+                    bool exact;     // sweeping a circle
+                    std::vector<std::pair<cpFloat, cpShape *>> *near;
+                } sweep = { space, body, delta, nullptr, 1, cpvzero, false,
+                    near.get() };
+
+                cpBodyEachShape(body, [](cpBody *body, cpShape *shape,
+                                          void *data) {
+                    auto *sweep = static_cast<Sweep *>(data);
+                    sweep->exact = shape->klass->type == CP_CIRCLE_SHAPE;
+                    cpVect end;
+                    cpFloat radius;
+                    if (sweep->exact) {
+                        end = cpBodyLocalToWorld(body,
+                                cpCircleShapeGetOffset(shape));
+                        radius = cpCircleShapeGetRadius(shape);
+                    } else {
+                        cpBB bb = cpShapeGetBB(shape);
+                        end = cpBBCenter(bb);
+                        radius = cpvdist(end, cpv(bb.r, bb.t));
+                    }
+
+                    sweep->near->clear();
+                    cpSpaceSegmentQuery(sweep->space,
+                            cpvsub(end, sweep->delta), end, radius,
+                            cpShapeGetFilter(shape),
+                            [](cpShape *other, cpVect, cpVect normal,
+                                    cpFloat alpha, void *data) {
+                                auto *sweep = static_cast<Sweep *>(data);
+                                if (cpShapeGetBody(other) == sweep->body
+                                        || cpShapeGetSensor(other)
+                                        || alpha <= 0
+                                        || alpha >= sweep->alpha) {
+                                    return;
+                                }
+                                if (!sweep->exact) {
+                                    sweep->near->emplace_back(alpha, other);
+                                    return;
+                                }
+                                sweep->hit    = other;
+                                sweep->alpha  = alpha;
+                                sweep->normal = normal;
+                            }, sweep);
+                    if (sweep->near->empty()) {
+                        return;
+                    }
+
+                    // the real shape touches no sooner than the circle
+                    // around it does, so check the closest first
+                    std::sort(sweep->near->begin(), sweep->near->end());
+                    cpBB bb = cpShapeGetBB(shape);
+                    cpFloat step = cpfmin(bb.r - bb.l, bb.t - bb.b) / 2
+                        / cpvlength(sweep->delta);
+                    for (auto& [alpha, other] : *sweep->near) {
+                        if (alpha >= sweep->alpha) {
+                            break;
+                        }
+                        cpFloat touch;
+                        cpVect normal;
+                        if (ccd_touch(shape, other, sweep->delta, alpha,
+                                    step, &touch, &normal)
+                                && touch < sweep->alpha) {
+                            sweep->alpha  = touch;
+                            sweep->hit    = other;
+                            sweep->normal = normal;
+                        }
+                    }
+                }, &sweep);
+
+                if (!sweep.hit) {
+                    return;
+                }
+
+                auto id = (uintptr_t)cpBodyGetUserData(
+                        cpShapeGetBody(sweep.hit));
+                log_debug("{} swept into {} at {:.3f}",
+                        entity, id, sweep.alpha);
+
+                if (ccd.mode == CCD_Report) {
+                    if (id != 0) {
+                        entity.add<Collision>(entity.world().entity(id));
+                    }
+                    return;
+                }
+
+                // clamp to the time of impact, pushed half the collision slop
+                // into the surface so the next step generates a contact
+                cpVect p = cpvadd(ccd.last_position,
+                        cpvmult(delta, sweep.alpha));
+                p = cpvsub(p, cpvmult(sweep.normal,
+                            cpSpaceGetCollisionSlop(space) / 2));
+                cpBodySetPosition(body, p);
+
+                cpVect v = cpBodyGetVelocity(body);
+                cpFloat vn = cpvdot(v, sweep.normal);
+                if (vn < 0) {
+                    cpBodySetVelocity(body,
+                            cpvsub(v, cpvmult(sweep.normal, vn)));
+                }
+            });
+
+        // When a Body component is added to an entity do the following:
+        // - set the cpBody UserData to be the entity id
+        //   - this allows chipmunk2d collision handlers to map from cpBody to
+        //     a flecs entity id
+        // - add the cpBody to the singleton cpSpace, unless a PhysicsHook
+        //   takes it
+        ecs.observer<Body, Space>("body_on_set")
+            .arg(2).src<Space>()
+            .event(flecs::OnSet)
+            .each([](flecs::entity entity, Body& body, Space&) {
+                    TRACE_SCOPE("body_on_set");
+                    flecs::world ecs = entity.world();
+                    if (chipmunk2d::suspended(ecs)) {
+                        return;
+                    }
+                    ObserverHooks hooks(ecs, "body_on_set", Physics_Body,
+                            true);
+                    ALLOC_PHASE(AllocPhase_Observers);
+                    log_debug("Body OnSet {}", entity);
+                    cpBodySetUserData(body, (void *)entity.id());
+                    chipmunk2d::add_body(entity, body);
+                });
+
+        // When a Body component is removed from an entity, remove the
+        // associated cpBody from whichever cpSpace it is in; it may have been
+        // moved out of the singleton (see chipmunk2d_lod).  If a PhysicsHook
+        // takes the removal over, it frees the cpBody as well.
+        ecs.observer<Body, Space>("body_on_remove")
+            .arg(2).src<Space>()
+            .event(flecs::OnRemove)
+            .each([](flecs::entity entity, Body& body, Space&) {
+                    TRACE_SCOPE("body_on_remove");
+                    flecs::world ecs = entity.world();
+                    if (chipmunk2d::suspended(ecs)) {
+                        return;
+                    }
+                    ObserverHooks hooks(ecs, "body_on_remove", Physics_Body,
+                            false);
+                    ALLOC_PHASE(AllocPhase_Observers);
+                    log_debug("Body OnRemove {}", entity);
+                    if (chipmunk2d::remove_body(entity, body,
+                                [](void *ptr) { cpBodyFree((cpBody *)ptr); })) {
+                        body.ptr = nullptr;
+                    }
+                });
+
+        // When a Shape component is added to an entity do the following:
+        // - add the cpShape to the cpSpace its body is in, or the singleton
+        //   cpSpace if the body hasn't been added yet, unless a PhysicsHook
+        //   takes it
+        ecs.observer<Shape, Space>("shape_on_set")
+            .arg(2).src<Space>()
+            .event(flecs::OnSet)
+            .each([](flecs::entity entity, Shape& shape, Space&) {
+                    TRACE_SCOPE("shape_on_set");
+                    flecs::world ecs = entity.world();
+                    if (chipmunk2d::suspended(ecs)) {
+                        return;
+                    }
+                    ObserverHooks hooks(ecs, "shape_on_set", Physics_Shape,
+                            true);
+                    ALLOC_PHASE(AllocPhase_Observers);
+                    log_debug("Shape OnSet {}", entity);
+                    chipmunk2d::add_shape(entity, shape);
+                });
+
+        // When a Shape component is removed from an entity, remove the cpShape
+        // from whichever cpSpace it is in
+        ecs.observer<Shape, Space>("shape_on_remove")
+            .arg(2).src<Space>()
+            .event(flecs::OnRemove)
+            .each([](flecs::entity entity, Shape& shape, Space&) {
+                    TRACE_SCOPE("shape_on_remove");
+                    flecs::world ecs = entity.world();
+                    if (chipmunk2d::suspended(ecs)) {
+                        return;
+                    }
+                    ObserverHooks hooks(ecs, "shape_on_remove", Physics_Shape,
+                            false);
+                    ALLOC_PHASE(AllocPhase_Observers);
+                    log_debug("Shape OnRemove {}", entity);
+                    if (chipmunk2d::remove_shape(entity, shape,
+                                [](void *ptr) {
+                                    cpShapeFree((cpShape *)ptr);
+                                })) {
+                        shape.ptr = nullptr;
+                    }
+                });
+
+        // CompoundBody does the work of both the Body & Shape observers
+        ecs.observer<CompoundBody, Space>("compound_body_on_set")
+            .arg(2).src<Space>()
+            .event(flecs::OnSet)
+            .each([](flecs::entity entity, CompoundBody& compound, Space&) {
+                    TRACE_SCOPE("compound_body_on_set");
+                    flecs::world ecs = entity.world();
+                    if (chipmunk2d::suspended(ecs)) {
+                        return;
+                    }
+                    ObserverHooks hooks(ecs, "compound_body_on_set",
+                            Physics_Body, true);
+                    ALLOC_PHASE(AllocPhase_Observers);
+                    log_debug("CompoundBody OnSet {}", entity);
+                    cpBodySetUserData(compound, (void *)entity.id());
+                    chipmunk2d::add_body(entity, compound);
+                    for (int i = 0; i < compound.count; i++) {
+                        chipmunk2d::add_shape(entity, compound.shape(i));
+                    }
+                });
+
+        // the shapes are destroyed in place, and the block is freed with the
+        // body, by whoever removes it
+        ecs.observer<CompoundBody, Space>("compound_body_on_remove")
+            .arg(2).src<Space>()
+            .event(flecs::OnRemove)
+            .each([](flecs::entity entity, CompoundBody& compound, Space&) {
+                    TRACE_SCOPE("compound_body_on_remove");
+                    flecs::world ecs = entity.world();
+                    if (chipmunk2d::suspended(ecs)) {
+                        return;
+                    }
+                    ObserverHooks hooks(ecs, "compound_body_on_remove",
+                            Physics_Body, false);
+                    ALLOC_PHASE(AllocPhase_Observers);
+                    log_debug("CompoundBody OnRemove {}", entity);
+                    bool taken = false;
+                    for (int i = 0; i < compound.count; i++) {
+                        taken |= chipmunk2d::remove_shape(entity,
+                                compound.shape(i),
+                                CompoundBody::destroy_shape);
+                    }
+                    taken |= chipmunk2d::remove_body(entity, compound,
+                            CompoundBody::free_block);
+                    if (taken) {
+                        compound.body  = nullptr;
+                        compound.count = 0;
+                    }
+                });
+    }
+
+    /// whether the core observers are leaving bodies & shapes alone; see
+    /// PhysicsHooks::suspended
+    static bool suspended(const flecs::world& ecs) {
+        return ecs.get<PhysicsHooks>()->suspended;
+    }
+
+    /// install a PhysicsHook; hooks run in the order they're installed
+    static void hook(flecs::world& ecs, const PhysicsHook& hook) {
+        ecs.get_mut<PhysicsHooks>()->hooks.push_back(hook);
+    }
+
+    /// add a cpBody to the Space singleton, unless a PhysicsHook takes it
+    static void add_body(flecs::entity entity, cpBody *body) {
+        add({ entity, Physics_Body, body, nullptr });
+    }
+
+    /// add a cpShape to the space its body is in, or the Space singleton,
+    /// unless a PhysicsHook takes it
+    static void add_shape(flecs::entity entity, cpShape *shape) {
+        add({ entity, Physics_Shape, shape, nullptr });
+    }
+
+    /// remove a cpBody from whichever space it's in, unless a PhysicsHook
+    /// takes the removal over; returns true if one did, and will call
+    /// `release` once the body is out of the space.  Otherwise the body is
+    /// out of the space on return, and still the caller's.
+    static bool remove_body(flecs::entity entity, cpBody *body,
+            void (*release)(void *)) {
+        return remove({ entity, Physics_Body, body, release });
+    }
+
+    /// remove a cpShape from whichever space it's in; see remove_body()
+    static bool remove_shape(flecs::entity entity, cpShape *shape,
+            void (*release)(void *)) {
+        return remove({ entity, Physics_Shape, shape, release });
+    }
+
+    /// add a body or shape a PhysicsHook took; a shape goes in the space its
+    /// body is in, or `space` if the body isn't in one
+    static void insert(cpSpace *space, const PhysicsChange& change) {
+        if (change.kind == Physics_Body) {
+            cpSpaceAddBody(space, (cpBody *)change.ptr);
+            return;
+        }
+        auto *shape = (cpShape *)change.ptr;
+        cpSpace *target = cpBodyGetSpace(cpShapeGetBody(shape));
+        cpSpaceAddShape(target ? target : space, shape);
+    }
+
+    /// remove a body or shape whose removal a PhysicsHook took over from
+    /// its space, if it's in one, and release it
+    static void extract(const PhysicsChange& change) {
+        take_out(change);
+        if (change.release) {
+            change.release(change.ptr);
+        }
+    }
+
+    /// time to advance the physics by, for a frame of `delta_time`
+    static cpFloat dt(const flecs::world& ecs, cpFloat delta_time) {
+        for (const PhysicsHook& hook : ecs.get<PhysicsHooks>()->hooks) {
+            if (hook.dt) {
+                delta_time = hook.dt(ecs, delta_time);
+            }
+        }
+        return delta_time;
+    }
+
+    /// report the time since `start` the world's thread spent stepping the
+    /// space, or waiting for it to be stepped, to the PhysicsHooks
+    static void stepped(flecs::world& ecs,
+            std::chrono::steady_clock::time_point start) {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        for (const PhysicsHook& hook : ecs.get<PhysicsHooks>()->hooks) {
+            if (hook.stepped) {
+                hook.stepped(ecs, us);
+            }
+        }
+    }
+
+    /// run the post_step hooks; step_space does once it has stepped the
+    /// space, and a module stepping it elsewhere once its step is done
+    static void post_step(flecs::world& ecs) {
+        for (const PhysicsHook& hook : ecs.get<PhysicsHooks>()->hooks) {
+            if (hook.post_step) {
+                hook.post_step(ecs);
+            }
+        }
+    }
+
+    /// run the add hooks, then add the change if none took it
+    static void add(const PhysicsChange& change) {
+        flecs::world ecs = change.entity.world();
+        for (const PhysicsHook& hook : ecs.get<PhysicsHooks>()->hooks) {
+            if (hook.add && hook.add(ecs, change)) {
+                return;
+            }
+        }
+        insert(*ecs.get<Space>(), change);
+    }
+
+    /// run the remove hooks, then remove the change if none took it over
+    static bool remove(const PhysicsChange& change) {
+        flecs::world ecs = change.entity.world();
+        bool taken = false;
+        for (const PhysicsHook& hook : ecs.get<PhysicsHooks>()->hooks) {
+            taken |= hook.remove && hook.remove(ecs, change);
+        }
+        if (!taken) {
+            take_out(change);
+        }
+        return taken;
+    }
+
+    /// remove a body or shape from the space it's in, if any
+    static void take_out(const PhysicsChange& change) {
+        if (change.kind == Physics_Body) {
+            auto *body = (cpBody *)change.ptr;
+            if (cpSpace *space = cpBodyGetSpace(body)) {
+                cpSpaceRemoveBody(space, body);
+            }
+        } else {
+            auto *shape = (cpShape *)change.ptr;
+            if (cpSpace *space = cpShapeGetSpace(shape)) {
+                cpSpaceRemoveShape(space, shape);
+            }
+        }
+    }
+
+    /// pre-grow the space, and the flecs tables, for an expected peak load
+    ///
+    /// chipmunk2d grows its arrays & arbiter pool lazily within
+    /// cpSpaceStep(), and flecs grows a table as entities move into it, so
+    /// the first big brawl after a quiet period stalls on allocation.  Call
+    /// this when a match starts with the most bodies, shapes, contacts per
+    /// step, and colliding shape pairs expected.  physics_reserve() grows
+    /// the space's body & arbiter arrays, arbiter pool, cached arbiter set,
+    /// contact buffer ring, and dynamic index, so the first steps up to that
+    /// load allocate nothing; keep the space across matches with reset() to
+    /// keep them.  The tables of an entity with a Body & Shape, and of one
+    /// with only a Shape, are grown along with the entity index by creating
+    /// entities in bulk, then deleting them; entities with more components
+    /// still grow their own.
+    static void reserve(flecs::world &ecs,
+            int bodies,
+            int shapes,
+            int contacts,
+            int arbiters) {
+        cpSpace *space = *ecs.get<Space>();
+        log_debug("reserve {} bodies, {} shapes, {} contacts, {} arbiters",
+                bodies, shapes, contacts, arbiters);
+        physics_reserve(space, bodies, shapes, contacts, arbiters);
+
+        // the entities have no cpBody or cpShape for the observers to add
+        // or remove
+        auto grow = [&ecs](std::initializer_list<flecs::id_t> ids,
+                int count) {
+            if (count <= 0) {
+                return;
+            }
+            ecs_bulk_desc_t desc = {};
+            desc.count = count;
+            std::copy(ids.begin(), ids.end(), desc.ids);
+            const ecs_entity_t *created = ecs_bulk_init(ecs.c_ptr(), &desc);
+            std::vector<ecs_entity_t> entities(created, created + count);
+            for (ecs_entity_t entity : entities) {
+                ecs_delete(ecs.c_ptr(), entity);
+            }
+        };
+        ecs.get_mut<PhysicsHooks>()->suspended = true;
+        grow({ ecs.component<Body>().id(), ecs.component<Shape>().id() },
+                bodies);
+        grow({ ecs.component<Shape>().id() }, shapes - bodies);
+        ecs.get_mut<PhysicsHooks>()->suspended = false;
+    }
+
+    /// delete every physics entity, keeping the space warm for the next match
+    ///
+    /// Deleting the entities of a level one at a time removes each body &
+    /// shape from the space separately, and every removal scans the cached
+    /// arbiters and the body arrays, so clearing a big level is quadratic.
+    /// This takes every Body, Shape, CompoundBody, and Tilemap out of its
+    /// space with physics_take(), a pass over each of the space's arrays,
+    /// then deletes the entities in bulk with the observers suspended; the
+    /// component destructors free the chipmunk2d objects.
+    /// PhysicsHook::reset is called first, for modules to drop what they
+    /// keep of them.
+    ///
+    /// The space, its collision handlers, and everything it has grown (see
+    /// reserve()) are kept, so the next match starts without allocating.
+    /// Contacts involving the removed shapes are dropped without calling
+    /// separate, and constraints on the removed bodies are taken out of the
+    /// space (but not freed).  Anything added to the space without an entity
+    /// is left as it is; bodies moved to another space (chipmunk2d_lod) are
+    /// taken out of that one the same way.  Call between frames, not from a
+    /// system or collision handler.
+    static void reset(flecs::world &ecs) {
+        for (const PhysicsHook& hook : ecs.get<PhysicsHooks>()->hooks) {
+            if (hook.reset) {
+                hook.reset(ecs);
+            }
+        }
+        cpSpace *space = *ecs.get<Space>();
+        log_debug("reset space {}", fmt::ptr(space));
+
+        std::vector<cpBody *> bodies;
+        std::vector<cpShape *> shapes;
+        ecs.each([&](Body& body) { bodies.push_back(body.ptr); });
+        ecs.each([&](Shape& shape) { shapes.push_back(shape.ptr); });
+        ecs.each([&](CompoundBody& compound) {
+                bodies.push_back(compound.body);
+                for (int i = 0; i < compound.count; i++) {
+                    shapes.push_back(compound.shape(i));
+                }
+            });
+        ecs.each([&](Tilemap& map) {
+                bodies.push_back(map.body);
+                for (auto& chunk : map.shapes) {
+                    shapes.insert(shapes.end(), chunk.begin(), chunk.end());
+                }
+            });
+
+        std::vector<cpSpace *> spaces = { space };
+        auto in = [&spaces](cpSpace *space) {
+            if (space && std::find(spaces.begin(), spaces.end(), space)
+                    == spaces.end()) {
+                spaces.push_back(space);
+            }
+        };
+        for (cpBody *body : bodies) {
+            in(body ? cpBodyGetSpace(body) : nullptr);
+        }
+        for (cpShape *shape : shapes) {
+            in(shape ? cpShapeGetSpace(shape) : nullptr);
+        }
+        for (cpSpace *from : spaces) {
+            physics_take(from, bodies.data(), bodies.size(), shapes.data(),
+                    shapes.size());
+        }
+
+        // nothing is in a space any more, so the observers are kept out of
+        // the deletes
+        ecs.get_mut<PhysicsHooks>()->suspended = true;
+        ecs.delete_with<Body>();
+        ecs.delete_with<Shape>();
+        ecs.delete_with<CompoundBody>();
+        ecs.delete_with<Tilemap>();
+        ecs.get_mut<PhysicsHooks>()->suspended = false;
+    }
+};
+
+/// deterministic lockstep for chipmunk2d; see Deterministic
+///
+/// While the Deterministic singleton is set, the module's PhysicsHook steps
+/// the space by its `dt`, and queues the bodies & shapes set since the last
+/// step, to add them in entity id order just before the next.  After the
+/// step, the collisions are put in canonical order and the state is hashed.
+struct chipmunk2d_deterministic {
+    chipmunk2d_deterministic(flecs::world &ecs) {
+        ecs.import<chipmunk2d>();
+
+        PhysicsHook hook;
+        hook.add = [](flecs::world& ecs, const PhysicsChange& change) {
+                if (!ecs.has<Deterministic>()) {
+                    return false;
+                }
+                ecs.get_mut<Deterministic>()->pending.push_back(change);
+                return true;
+            };
+        hook.remove = [](flecs::world& ecs, const PhysicsChange& change) {
+                if (!ecs.has<Deterministic>()) {
+                    return false;
+                }
+                // one removed before the step is never added
+                auto *det = ecs.get_mut<Deterministic>();
+                det->pending.erase(std::remove_if(det->pending.begin(),
+                            det->pending.end(),
+                            [&change](const PhysicsChange& pending) {
+                                return pending.ptr == change.ptr;
+                            }), det->pending.end());
+                if (change.kind == Physics_Body) {
+                    det->forget_static((cpBody *)change.ptr);
+                }
+                return false;
+            };
+        hook.pre_step = insert;
+        hook.post_step = [](flecs::world& ecs) {
+                if (!ecs.has<Deterministic>()) {
+                    return;
+                }
+                auto *det = ecs.get_mut<Deterministic>();
+                std::sort(det->events.begin(), det->events.end(),
+                        [](const CollisionEvent& l, const CollisionEvent& r) {
+                            return l.a != r.a ? l.a < r.a : l.b < r.b;
+                        });
+                det->update_hash(*ecs.get<Space>());
+            };
+        hook.dt = [](const flecs::world& ecs, cpFloat dt) {
+                const Deterministic *det = ecs.get<Deterministic>();
+                return det ? det->dt : dt;
+            };
+        hook.reset = [](flecs::world& ecs) {
+                if (!ecs.has<Deterministic>()) {
+                    return;
+                }
+                // the bodies about to go are never added, or unhashed
+                auto *det = ecs.get_mut<Deterministic>();
+                det->pending.clear();
+                ecs.each([det](Body& body) {
+                        det->forget_static(body.ptr);
+                    });
+                ecs.each([det](CompoundBody& compound) {
+                        det->forget_static(compound.body);
+                    });
+                ecs.each([det](Tilemap& map) {
+                        det->forget_static(map.body);
+                    });
+            };
+        chipmunk2d::hook(ecs, hook);
+
+        // rehash a static body moved with StaticDirty; it has already moved,
+        // so this needn't wait for the reindex
+        ecs.system<const Shape>("deterministic_rehash")
+            .with<StaticDirty>()
+            .kind(flecs::OnLoad)
+            .each([](flecs::entity entity, const Shape& shape) {
+                    flecs::world ecs = entity.world();
+                    if (ecs.has<Deterministic>() && cpShapeGetSpace(shape)) {
+                        ecs.get_mut<Deterministic>()
+                            ->hash_static(cpShapeGetBody(shape));
+                    }
+                });
+    }
+
+    /// add the queued bodies, then the queued shapes, in entity id order
+    static void insert(flecs::world& ecs) {
+        if (!ecs.has<Deterministic>()) {
+            return;
+        }
+        auto *det = ecs.get_mut<Deterministic>();
+        cpSpace *space = *ecs.get<Space>();
+        det->events.clear();
+
+        std::stable_sort(det->pending.begin(), det->pending.end(),
+                [](const PhysicsChange& l, const PhysicsChange& r) {
+                    return l.kind != r.kind ? l.kind < r.kind
+                        : l.entity.id() < r.entity.id();
+                });
+        for (const PhysicsChange& change : det->pending) {
+            // set more than once before the step
+            if (change.kind == Physics_Body
+                    ? cpBodyGetSpace((cpBody *)change.ptr) != nullptr
+                    : cpShapeGetSpace((cpShape *)change.ptr) != nullptr) {
+                continue;
+            }
+            chipmunk2d::insert(space, change);
+            if (change.kind == Physics_Body && cpBodyGetType(
+                        (cpBody *)change.ptr) == CP_BODY_TYPE_STATIC) {
+                det->hash_static((cpBody *)change.ptr);
+            }
+        }
+        det->pending.clear();
+    }
+};
+
+/// whether two shapes are the same type with the same geometry, relative to
+/// their bodies
+static bool
+same_geometry(const cpShape *a, const cpShape *b)
+{
+    if (a->klass->type != b->klass->type) {
+        return false;
+    }
+
+    switch (a->klass->type) {
+    case CP_CIRCLE_SHAPE:
+        return cpCircleShapeGetRadius(a) == cpCircleShapeGetRadius(b)
+            && cpveql(cpCircleShapeGetOffset(a), cpCircleShapeGetOffset(b));
+    case CP_SEGMENT_SHAPE:
+        return cpSegmentShapeGetRadius(a) == cpSegmentShapeGetRadius(b)
+            && cpveql(cpSegmentShapeGetA(a), cpSegmentShapeGetA(b))
+            && cpveql(cpSegmentShapeGetB(a), cpSegmentShapeGetB(b));
+    case CP_POLY_SHAPE: {
+        int count = cpPolyShapeGetCount(a);
+        if (count != cpPolyShapeGetCount(b)
+                || cpPolyShapeGetRadius(a) != cpPolyShapeGetRadius(b)) {
+            return false;
+        }
+        for (int i = 0; i < count; i++) {
+            if (!cpveql(cpPolyShapeGetVert(a, i), cpPolyShapeGetVert(b, i))) {
+                return false;
+            }
+        }
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+/// copy the material, filtering & user data of one shape onto another,
+/// setting only what differs; every setter wakes the body
+static void
+copy_material(const cpShape *src, cpShape *dst)
+{
+    if (cpShapeGetSensor(dst) != cpShapeGetSensor(src)) {
+        cpShapeSetSensor(dst, cpShapeGetSensor(src));
+    }
+    if (cpShapeGetElasticity(dst) != cpShapeGetElasticity(src)) {
+        cpShapeSetElasticity(dst, cpShapeGetElasticity(src));
+    }
+    if (cpShapeGetFriction(dst) != cpShapeGetFriction(src)) {
+        cpShapeSetFriction(dst, cpShapeGetFriction(src));
+    }
+    if (!cpveql(cpShapeGetSurfaceVelocity(dst),
+                cpShapeGetSurfaceVelocity(src))) {
+        cpShapeSetSurfaceVelocity(dst, cpShapeGetSurfaceVelocity(src));
+    }
+    if (cpShapeGetCollisionType(dst) != cpShapeGetCollisionType(src)) {
+        cpShapeSetCollisionType(dst, cpShapeGetCollisionType(src));
+    }
+    cpShapeFilter filter = cpShapeGetFilter(src), old = cpShapeGetFilter(dst);
+    if (filter.group != old.group
+            || filter.categories != old.categories
+            || filter.mask != old.mask) {
+        cpShapeSetFilter(dst, filter);
+    }
+    cpShapeSetUserData(dst, cpShapeGetUserData(src));
+}
+
+/// create a copy of a shape, attached to a different body
+///
+/// Geometry, material and filtering are copied, mass is not; the caller is
+/// expected to copy the body mass directly.
+static cpShape *
+clone_shape(const cpShape *src, cpBody *body)
+{
+    cpShape *dst = nullptr;
+
+    switch (src->klass->type) {
+    case CP_CIRCLE_SHAPE:
+        dst = cpCircleShapeNew(body,
+                cpCircleShapeGetRadius(src),
+                cpCircleShapeGetOffset(src));
+        break;
+    case CP_SEGMENT_SHAPE:
+        dst = cpSegmentShapeNew(body,
+                cpSegmentShapeGetA(src),
+                cpSegmentShapeGetB(src),
+                cpSegmentShapeGetRadius(src));
+        break;
+    case CP_POLY_SHAPE: {
+        int count = cpPolyShapeGetCount(src);
+        std::vector<cpVect> verts(count);
+        for (int i = 0; i < count; i++) {
+            verts[i] = cpPolyShapeGetVert(src, i);
+        }
+        dst = cpPolyShapeNewRaw(body, count, verts.data(),
+                cpPolyShapeGetRadius(src));
+        break;
+    }
+    default:
+        assert(false && "unsupported shape type");
+        return nullptr;
+    }
+
+    copy_material(src, dst);
+    return dst;
+}
+
+/// a collision reported by SpaceFork::run()
+struct ForkHit {
+    flecs::entity_t a, b;   // entity ids from the cpBody user data
+    int step;               // step of the run the collision began in
+};
+
+/// scratch copy of a Space for running the simulation ahead ("what-if")
+/// without disturbing the live Space.
+///
+/// The fork owns its own cpSpace, and a mirror of every body and shape it
+/// has seen in the live space.  After the first fork(), forking again only
+/// copies body state onto the existing mirrors, so the cost is a copy per
+/// body instead of cpSpaceNew() and re-adding everything.
+///
+/// fork() reads the live space, so it must be called from the thread that
+/// steps it.  Everything else only touches the fork, so run() and reset()
+/// can be called from a worker thread while the live simulation continues.
+///
+/// Collision handlers are not copied from the live space; they usually
+/// mutate the live world.  Instead every collision that begins in the fork
+/// is recorded as a ForkHit.
+struct SpaceFork {
+    SpaceFork()
+        : space{cpSpaceNew()}, stamp{0}, step{0}, pass_through{false} {
+        cpCollisionHandler *handler = cpSpaceAddDefaultCollisionHandler(space);
+        handler->userData  = this;
+        handler->beginFunc = [](cpArbiter *arb, cpSpace *,
+                                 cpDataPointer data) -> cpBool {
+            TRACE_SCOPE("space_fork_begin");
+            ALLOC_PHASE(AllocPhase_Callbacks);
+            auto *fork = static_cast<SpaceFork *>(data);
+            cpBody *a, *b;
+            cpArbiterGetBodies(arb, &a, &b);
+            fork->hits.push_back({
+                    (uintptr_t)cpBodyGetUserData(a),
+                    (uintptr_t)cpBodyGetUserData(b),
+                    fork->step });
+            return !fork->pass_through;
+        };
+    }
+    SpaceFork(const SpaceFork&) = delete;
+    ~SpaceFork() {
+        clear_probes();
+        for (auto& [live, mirror] : shapes) {
+            cpSpaceRemoveShape(space, mirror.ptr);
+            cpShapeFree(mirror.ptr);
+        }
+        for (auto& [live, mirror] : bodies) {
+            if (mirror.ptr != cpSpaceGetStaticBody(space)) {
+                cpSpaceRemoveBody(space, mirror.ptr);
+                cpBodyFree(mirror.ptr);
+            }
+        }
+        cpSpaceFree(space);
+    }
+
+    SpaceFork& operator=(const SpaceFork&) = delete;
+
+    /// copy the current state of the live space into the fork
+    ///
+    /// Any probes from the previous question are removed.
+    void fork(cpSpace *live) {
+        clear_probes();
+        stamp++;
+
+        cpSpaceSetGravity(space, cpSpaceGetGravity(live));
+        cpSpaceSetDamping(space, cpSpaceGetDamping(live));
+        cpSpaceSetIterations(space, cpSpaceGetIterations(live));
+        cpSpaceSetCollisionSlop(space, cpSpaceGetCollisionSlop(live));
+        cpSpaceSetCollisionBias(space, cpSpaceGetCollisionBias(live));
+
+        // shapes on the live space's static body go on ours
+        bodies[cpSpaceGetStaticBody(live)] = { cpSpaceGetStaticBody(space),
+                                               stamp };
+
+        cpSpaceEachBody(live, [](cpBody *body, void *data) {
+                static_cast<SpaceFork *>(data)->mirror_body(body);
+            }, this);
+        cpSpaceEachShape(live, [](cpShape *shape, void *data) {
+                static_cast<SpaceFork *>(data)->mirror_shape(shape);
+            }, this);
+
+        // drop the mirrors of anything no longer in the live space
+        for (auto it = shapes.begin(); it != shapes.end();) {
+            if (it->second.stamp == stamp) {
+                ++it;
+                continue;
+            }
+            cpSpaceRemoveShape(space, it->second.ptr);
+            cpShapeFree(it->second.ptr);
+            it = shapes.erase(it);
+        }
+        for (auto it = bodies.begin(); it != bodies.end();) {
+            if (it->second.stamp == stamp) {
+                ++it;
+                continue;
+            }
+            if (it->second.ptr != cpSpaceGetStaticBody(space)) {
+                cpSpaceRemoveBody(space, it->second.ptr);
+                cpBodyFree(it->second.ptr);
+            }
+            it = bodies.erase(it);
+        }
+
+        // static bodies are not reindexed by the step, so do it here in
+        // case they moved, then save the state reset() returns to.
+        saved.clear();
+        for (auto& [live, mirror] : bodies) {
+            if (cpBodyGetType(mirror.ptr) == CP_BODY_TYPE_STATIC) {
+                cpSpaceReindexShapesForBody(space, mirror.ptr);
+            } else {
+                saved.push_back(save_state(mirror.ptr));
+            }
+        }
+
+        reset();
+    }
+
+    /// add a body & shape that exist only in the fork, such as the projectile
+    /// the question is about; the fork takes ownership of both.  Probes are
+    /// kept across reset() and removed by the next fork().
+    cpBody *add_probe(cpBody *body, cpShape *shape) {
+        cpSpaceAddBody(space, body);
+        cpSpaceAddShape(space, shape);
+        probes.push_back({ body, shape });
+        saved.push_back(save_state(body));
+        return body;
+    }
+
+    /// remove & free all the probes
+    void clear_probes() {
+        if (probes.empty()) {
+            return;
+        }
+
+        // probes are always saved after the mirrored bodies
+        saved.resize(saved.size() - probes.size());
+
+        for (auto& probe : probes) {
+            cpSpaceRemoveShape(space, probe.shape);
+            cpSpaceRemoveBody(space, probe.body);
+            cpShapeFree(probe.shape);
+            cpBodyFree(probe.body);
+        }
+        probes.clear();
+    }
+
+    /// step the fork, returning the collisions that began during the run
+    const std::vector<ForkHit>& run(int steps, cpFloat dt) {
+        for (step = 0; step < steps; step++) {
+            cpSpaceStep(space, dt);
+        }
+        return hits;
+    }
+
+    /// return the fork to the state it had after fork() and add_probe(),
+    /// ready to answer another question
+    void reset() {
+        for (auto& s : saved) {
+            cpBodySetPosition(s.body, s.p);
+            cpBodySetAngle(s.body, s.a);
+            cpBodySetVelocity(s.body, s.v);
+            cpBodySetAngularVelocity(s.body, s.w);
+            cpBodySetForce(s.body, s.f);
+            cpBodySetTorque(s.body, s.t);
+        }
+        physics_drop_arbiters(space);
+        hits.clear();
+    }
+
+    /// get the mirror of a live body, nullptr if it has none
+    cpBody *mirror(cpBody *live) const {
+        auto it = bodies.find(live);
+        return it == bodies.end() ? nullptr : it->second.ptr;
+    }
+
+    /// support implicit cast to cpSpace*, for the fork space
+    inline operator cpSpace*() const {
+        return space;
+    }
+
+    struct BodyState {
+        cpBody *body;
+        cpVect p, v, f;
+        cpFloat a, w, t;
+    };
+
+    struct BodyMirror {
+        cpBody *ptr;
+        unsigned stamp;     // fork() the live body was last seen in
+    };
+
+    struct ShapeMirror {
+        cpShape *ptr;
+        unsigned stamp;     // fork() the live shape was last seen in
+    };
+
+    struct Probe {
+        cpBody *body;
+        cpShape *shape;
+    };
+
+    cpSpace *space;
+    std::unordered_map<cpBody *, BodyMirror> bodies;
+    std::unordered_map<cpShape *, ShapeMirror> shapes;
+    std::vector<BodyState> saved;
+    std::vector<Probe> probes;
+    std::vector<ForkHit> hits;
+    unsigned stamp;
+    int step;
+
+    /// when set, collisions are recorded but not solved in the fork
+    bool pass_through;
+
+    static BodyState save_state(cpBody *body) {
+        return { body,
+                 cpBodyGetPosition(body),
+                 cpBodyGetVelocity(body),
+                 cpBodyGetForce(body),
+                 cpBodyGetAngle(body),
+                 cpBodyGetAngularVelocity(body),
+                 cpBodyGetTorque(body) };
+    }
+
+    void mirror_body(cpBody *live) {
+        cpBodyType type = cpBodyGetType(live);
+        auto it = bodies.find(live);
+
+        // the live body may have been freed & another allocated in its
+        // place; drop the old mirror and any shapes still attached to it
+        if (it != bodies.end() && cpBodyGetType(it->second.ptr) != type) {
+            cpBody *old = it->second.ptr;
+            for (auto s = shapes.begin(); s != shapes.end();) {
+                if (cpShapeGetBody(s->second.ptr) != old) {
+                    ++s;
+                    continue;
+                }
+                cpSpaceRemoveShape(space, s->second.ptr);
+                cpShapeFree(s->second.ptr);
+                s = shapes.erase(s);
+            }
+            cpSpaceRemoveBody(space, old);
+            cpBodyFree(old);
+            bodies.erase(it);
+            it = bodies.end();
+        }
+
+        cpBody *body;
+        if (it == bodies.end()) {
+            switch (type) {
+            case CP_BODY_TYPE_DYNAMIC:
+                body = cpBodyNew(cpBodyGetMass(live), cpBodyGetMoment(live));
+                break;
+            case CP_BODY_TYPE_KINEMATIC:
+                body = cpBodyNewKinematic();
+                break;
+            default:
+                body = cpBodyNewStatic();
+                break;
+            }
+            cpSpaceAddBody(space, body);
+            bodies[live] = { body, stamp };
+        } else {
+            body = it->second.ptr;
+            it->second.stamp = stamp;
+        }
+
+        if (type == CP_BODY_TYPE_DYNAMIC) {
+            cpBodySetMass(body, cpBodyGetMass(live));
+            cpBodySetMoment(body, cpBodyGetMoment(live));
+            cpBodySetCenterOfGravity(body, cpBodyGetCenterOfGravity(live));
+        }
+        cpBodySetUserData(body, cpBodyGetUserData(live));
+        cpBodySetPosition(body, cpBodyGetPosition(live));
+        cpBodySetAngle(body, cpBodyGetAngle(live));
+        if (type != CP_BODY_TYPE_STATIC) {
+            cpBodySetVelocity(body, cpBodyGetVelocity(live));
+            cpBodySetAngularVelocity(body, cpBodyGetAngularVelocity(live));
+            cpBodySetForce(body, cpBodyGetForce(live));
+            cpBodySetTorque(body, cpBodyGetTorque(live));
+        }
+    }
+
+    void mirror_shape(cpShape *live) {
+        cpBody *body = mirror(cpShapeGetBody(live));
+        assert(body != nullptr && "shape body not mirrored");
+
+        // the live shape may have been changed, or freed & another
+        // allocated in its place; keep the mirror if the geometry still
+        // matches, and bring the material up to date
+        auto it = shapes.find(live);
+        if (it != shapes.end()
+                && cpShapeGetBody(it->second.ptr) == body
+                && same_geometry(live, it->second.ptr)) {
+            copy_material(live, it->second.ptr);
+            it->second.stamp = stamp;
+            return;
+        }
+        if (it != shapes.end()) {
+            cpSpaceRemoveShape(space, it->second.ptr);
+            cpShapeFree(it->second.ptr);
+        }
+
+        cpShape *shape = clone_shape(live, body);
+        cpSpaceAddShape(space, shape);
+        shapes[live] = { shape, stamp };
+    }
+};
+
+/// first impact found by predict_trajectory()
+struct TrajectoryHit {
+    flecs::entity_t entity; // entity struck, from the cpBody user data
+    cpFloat time;           // seconds from launch until impact
+    cpVect point;           // center of the projectile at impact
+    cpVect normal;          // surface normal of what was struck
+};
+
+/// predict where a projectile will land without stepping the space
+///
+/// Sweeps a circle of `radius` along the ballistic path of a projectile
+/// launched from `position` at `velocity` under the space gravity, for up to
+/// `max_time` seconds.  The arc is split into `segments` chords, each of which
+/// is a single segment query against the spatial index, so a prediction costs
+/// a handful of index queries instead of a step.  Damping is ignored.
+///
+/// Use `filter` to keep the projectile from hitting its shooter (same group).
+/// Sensors are never hit.  Returns true and fills in `hit` if something is
+/// struck before `max_time`.
+static bool
+predict_trajectory(cpSpace *space,
+        cpVect position,
+        cpVect velocity,
+        cpFloat radius,
+        cpShapeFilter filter,
+        cpFloat max_time,
+        int segments,
+        TrajectoryHit *hit)
+{
+    assert(segments > 0 && "need at least one segment");
+
+    cpVect gravity = cpSpaceGetGravity(space);
+    cpFloat dt = max_time / segments;
+    cpVect a = position;
+
+    for (int i = 1; i <= segments; i++) {
+        cpFloat t = dt * i;
+        cpVect b = cpvadd(position,
+                cpvadd(cpvmult(velocity, t), cpvmult(gravity, 0.5 * t * t)));
+
+        cpSegmentQueryInfo info;
+        cpShape *shape =
+            cpSpaceSegmentQueryFirst(space, a, b, radius, filter, &info);
+        if (shape) {
+            hit->entity =
+                (uintptr_t)cpBodyGetUserData(cpShapeGetBody(shape));
+            hit->time   = t - dt + dt * info.alpha;
+            hit->point  = cpvlerp(a, b, info.alpha);
+            hit->normal = info.normal;
+            return true;
+        }
+        a = b;
+    }
+
+    return false;
+}
+
+/// number of physics level-of-detail bands; band `n` is stepped every `2^n`
+/// frames
+#define LOD_BANDS 4
+
+/// marks an entity, such as a player, whose surroundings should be simulated
+/// at the full rate; the entity needs a Body for its position
+struct Interest {};
+
+/// physics level-of-detail band a Body is in, set by chipmunk2d_lod
+struct LodBand {
+    int band;
+};
+
+/// chipmunk2d_lod configuration; set before importing the module
+struct LodConfig {
+    // bodies within radius[n] of an Interest are put in band n, bodies
+    // further than all of them in the last band
+    cpFloat radius[LOD_BANDS - 1];
+    // frames between passes that move bodies between bands
+    int interval;
+    // a body only changes band once it is this far past a radius, so one
+    // moving back & forth across it isn't moved between spaces every pass
+    cpFloat hysteresis;
+};
+
+/// spaces the far bands are simulated in; band 0 is the Space singleton
+///
+/// Each far band has its own cpSpace so it can be stepped on its own
+/// schedule, and bodies are moved between spaces without being recreated.
+/// Static shapes in the Space singleton are mirrored into every band so
+/// distant bodies still have ground to land on, whether they came from a
+/// Shape, a static CompoundBody, a Tilemap, or were added directly; the
+/// mirrors follow the statics when they move or change, and go when they
+/// leave the space.  The Space singleton's collision
+/// handlers are copied into each band before it is stepped, replacing any
+/// set on the band directly.
+///
+/// Bodies in different bands are in different spaces, so they never
+/// collide: two bodies on either side of a radius pass through each other.
+/// Choose radii so nothing that must interact straddles one.  Queries
+/// against the Space singleton (projectiles, CCD, predictions) do not see
+/// bodies in the far bands.
+struct LodSpaces {
+    LodSpaces() : frame{0} {
+        for (int i = 0; i < LOD_BANDS; i++) {
+            elapsed[i] = 0;
+        }
+    }
+    LodSpaces(const LodSpaces&) = delete;
+    LodSpaces(LodSpaces&& other) : frame{0} {
+        *this = std::move(other);
+    }
+    ~LodSpaces() {
+        for (auto& [shape, mirror] : statics) {
+            unmirror(mirror);
+        }
+
+        // anything still in a band space goes back to having no space, so
+        // the Body/Shape destructors are happy whenever they run
+        for (int i = 1; i < LOD_BANDS; i++) {
+            if (!bands[i].ptr) {
+                continue;
+            }
+            std::vector<cpShape *> shapes;
+            std::vector<cpBody *> bodies;
+            cpSpaceEachShape(bands[i], [](cpShape *shape, void *data) {
+                    static_cast<std::vector<cpShape *> *>(data)
+                        ->push_back(shape);
+                }, &shapes);
+            cpSpaceEachBody(bands[i], [](cpBody *body, void *data) {
+                    static_cast<std::vector<cpBody *> *>(data)
+                        ->push_back(body);
+                }, &bodies);
+            for (cpShape *shape : shapes) {
+                cpSpaceRemoveShape(bands[i], shape);
+            }
+            for (cpBody *body : bodies) {
+                cpSpaceRemoveBody(bands[i], body);
+            }
+        }
+    }
+
+    LodSpaces& operator=(const LodSpaces&) = delete;
+    LodSpaces& operator=(LodSpaces&& other) {
+        if (this != &other) {
+            for (int i = 0; i < LOD_BANDS; i++) {
+                bands[i]   = std::move(other.bands[i]);
+                elapsed[i] = other.elapsed[i];
+            }
+            statics   = std::move(other.statics);
+            interests = std::move(other.interests);
+            frame     = other.frame;
+        }
+        return *this;
+    }
+
+    /// copies of a static shape (and its body) in each far band
+    struct StaticMirror {
+        cpBody *body[LOD_BANDS];
+        cpShape *shape[LOD_BANDS];
+        uint64_t seen;      // frame the shape was last found in the space
+    };
+
+    /// mirror a static shape into every far band, or mark its mirror as
+    /// still wanted
+    void mirror(cpShape *shape) {
+        auto it = statics.find(shape);
+        if (it != statics.end()) {
+            it->second.seen = frame;
+            return;
+        }
+        cpBody *src = cpShapeGetBody(shape);
+        StaticMirror mirror = {};
+        mirror.seen = frame;
+        for (int i = 1; i < LOD_BANDS; i++) {
+            mirror.body[i] = cpBodyNewStatic();
+            cpBodySetPosition(mirror.body[i], cpBodyGetPosition(src));
+            cpBodySetAngle(mirror.body[i], cpBodyGetAngle(src));
+            cpBodySetUserData(mirror.body[i], cpBodyGetUserData(src));
+            cpSpaceAddBody(bands[i], mirror.body[i]);
+            mirror.shape[i] = clone_shape(shape, mirror.body[i]);
+            cpSpaceAddShape(bands[i], mirror.shape[i]);
+        }
+        statics[shape] = mirror;
+    }
+
+    /// remove & free the far band mirrors of a static shape
+    void unmirror(StaticMirror& mirror) {
+        for (int i = 1; i < LOD_BANDS; i++) {
+            cpSpaceRemoveShape(bands[i], mirror.shape[i]);
+            cpSpaceRemoveBody(bands[i], mirror.body[i]);
+            cpShapeFree(mirror.shape[i]);
+            cpBodyFree(mirror.body[i]);
+        }
+    }
+
+    /// mirror every static shape in a space, and drop the mirrors of those
+    /// no longer in it
+    ///
+    /// Static shapes get into the space through a Shape, a CompoundBody, a
+    /// Tilemap, or directly, so rather than watch for each, the space's
+    /// static index is taken as the list of them.  It also holds the shapes
+    /// of sleeping bodies, which are not mirrored.
+    void find_statics(cpSpace *space) {
+        cpSpatialIndexEach(space->staticShapes, [](void *obj, void *data) {
+                auto *shape = static_cast<cpShape *>(obj);
+                if (cpBodyGetType(cpShapeGetBody(shape))
+                        == CP_BODY_TYPE_STATIC) {
+                    static_cast<LodSpaces *>(data)->mirror(shape);
+                }
+            }, this);
+        for (auto it = statics.begin(); it != statics.end();) {
+            if (it->second.seen == frame) {
+                ++it;
+                continue;
+            }
+            unmirror(it->second);
+            it = statics.erase(it);
+        }
+    }
+
+    /// bring the mirrors in a far band up to date with the static shapes
+    /// they copy, which may have moved or changed since the last step
+    void sync_statics(int band) {
+        for (auto& [shape, mirror] : statics) {
+            cpBody *src = cpShapeGetBody(shape);
+            cpBody *body = mirror.body[band];
+            if (same_geometry(shape, mirror.shape[band])) {
+                copy_material(shape, mirror.shape[band]);
+            } else {
+                cpSpaceRemoveShape(bands[band], mirror.shape[band]);
+                cpShapeFree(mirror.shape[band]);
+                mirror.shape[band] = clone_shape(shape, body);
+                cpSpaceAddShape(bands[band], mirror.shape[band]);
+            }
+            cpBodySetUserData(body, cpBodyGetUserData(src));
+            if (!cpveql(cpBodyGetPosition(body), cpBodyGetPosition(src))
+                    || cpBodyGetAngle(body) != cpBodyGetAngle(src)) {
+                cpBodySetPosition(body, cpBodyGetPosition(src));
+                cpBodySetAngle(body, cpBodyGetAngle(src));
+                cpSpaceReindexShapesForBody(bands[band], body);
+            }
+        }
+    }
+
+    /// copy the collision handlers of a space onto a far band
+    void copy_handlers(cpSpace *from, int band) {
+        cpSpace *to = bands[band];
+        physics_each_handler(from, [](void *elt, void *data) {
+                auto *src = static_cast<cpCollisionHandler *>(elt);
+                auto *to = static_cast<cpSpace *>(data);
+                cpCollisionHandler *dst;
+                if (src->typeA == CP_WILDCARD_COLLISION_TYPE) {
+                    dst = cpSpaceAddDefaultCollisionHandler(to);
+                } else if (src->typeB == CP_WILDCARD_COLLISION_TYPE) {
+                    dst = cpSpaceAddWildcardHandler(to, src->typeA);
+                } else {
+                    dst = cpSpaceAddCollisionHandler(to, src->typeA,
+                            src->typeB);
+                }
+                copy_handler(src, dst);
+            }, to);
+    }
+
+    static void copy_handler(const cpCollisionHandler *src,
+            cpCollisionHandler *dst) {
+        dst->beginFunc     = src->beginFunc;
+        dst->preSolveFunc  = src->preSolveFunc;
+        dst->postSolveFunc = src->postSolveFunc;
+        dst->separateFunc  = src->separateFunc;
+        dst->userData      = src->userData;
+    }
+
+    /// band a body is currently simulated in
+    int band_of(cpBody *body) const {
+        cpSpace *space = cpBodyGetSpace(body);
+        for (int i = 1; i < LOD_BANDS; i++) {
+            if (space == bands[i].ptr) {
+                return i;
+            }
+        }
+        return 0;
+    }
+
+    /// move a body, and all of its shapes, from its current space to another
+    static void move_body(cpBody *body, cpSpace *to) {
+        cpSpace *from = cpBodyGetSpace(body);
+        if (from == to) {
+            return;
+        }
+
+        std::vector<cpShape *> shapes;
+        cpBodyEachShape(body, [](cpBody *, cpShape *shape, void *data) {
+                static_cast<std::vector<cpShape *> *>(data)->push_back(shape);
+            }, &shapes);
+
+        for (cpShape *shape : shapes) {
+            cpSpaceRemoveShape(from, shape);
+        }
+        cpSpaceRemoveBody(from, body);
+        cpSpaceAddBody(to, body);
+        for (cpShape *shape : shapes) {
+            cpSpaceAddShape(to, shape);
+        }
+    }
+
+    Space bands[LOD_BANDS];
+    cpFloat elapsed[LOD_BANDS];     // time since each band was last stepped
+    std::unordered_map<cpShape *, StaticMirror> statics;
+    std::vector<cpVect> interests;  // Interest positions for this pass
+    uint64_t frame;
+};
+
+/// physics level-of-detail for chipmunk2d
+///
+/// Bodies are sorted into bands by distance to the nearest Interest.  Band 0
+/// stays in the Space singleton and is stepped every frame; band n lives in
+/// its own space and is stepped every 2^n frames with the time elapsed since
+/// its last step.  Bodies are moved between bands in place, keeping their
+/// entity, cpBody and cpShapes.
+struct chipmunk2d_lod {
+    chipmunk2d_lod(flecs::world &ecs) {
+        ecs.import<chipmunk2d>();
+
+        if (!ecs.has<LodConfig>()) {
+            ecs.set<LodConfig>({ { 25, 50, 100 }, 8, 5 });
+        }
+        const LodConfig *config = ecs.get<LodConfig>();
+
+        // create the far band spaces; the static shapes are mirrored into
+        // them as they're stepped
+        cpSpace *space = *ecs.get<Space>();
+        LodSpaces lod;
+        for (int i = 1; i < LOD_BANDS; i++) {
+            lod.bands[i] = Space(cpSpaceNew());
+            cpSpaceSetIterations(lod.bands[i], cpSpaceGetIterations(space));
+        }
+        ecs.set<LodSpaces>(std::move(lod));
+
+        // every `interval` frames, collect the interest positions, then
+        // move each body into the band for its distance from them
+        ecs.system<const Body, LodSpaces>("lod_interests")
+            .arg(2).src<LodSpaces>()
+            .with<Interest>()
+            .kind(flecs::PostLoad)
+            .rate(config->interval)
+            .each([](const Body& body, LodSpaces& lod) {
+                    lod.interests.push_back(cpBodyGetPosition(body));
+                });
+
+        ecs.system<Body, LodSpaces, Space, const LodConfig>("lod_assign")
+            .arg(2).src<LodSpaces>()
+            .arg(3).src<Space>()
+            .arg(4).src<LodConfig>()
+            .kind(flecs::PostLoad)
+            .rate(config->interval)
+            .each([](flecs::entity entity,
+                        Body& body,
+                        LodSpaces& lod,
+                        Space& space,
+                        const LodConfig& config) {
+                if (!cpBodyGetSpace(body)
+                        || cpBodyGetType(body) == CP_BODY_TYPE_STATIC) {
+                    return;
+                }
+
+                cpVect p = cpBodyGetPosition(body);
+                cpFloat dist = INFINITY;
+                for (cpVect interest : lod.interests) {
+                    dist = cpfmin(dist, cpvdist(p, interest));
+                }
+
+                // the band the body would be in were it `hysteresis`
+                // closer, and further; it stays put anywhere in between
+                auto band_at = [&config](cpFloat dist) {
+                    int band = 0;
+                    while (band < LOD_BANDS - 1
+                            && dist >= config.radius[band]) {
+                        band++;
+                    }
+                    return band;
+                };
+                int current = lod.band_of(body);
+                int band = std::clamp(current,
+                        band_at(dist - config.hysteresis),
+                        band_at(dist + config.hysteresis));
+                if (band == current) {
+                    return;
+                }
+
+                log_debug("{} moving to lod band {}", entity, band);
+                LodSpaces::move_body(body,
+                        band == 0 ? space.ptr : lod.bands[band].ptr);
+                entity.set<LodBand>({ band });
+            });
+
+        // after the Space singleton is stepped, step each far band that is
+        // due, with all the time that passed since it was last stepped
+        ecs.system<>("lod_step")
+            .kind(flecs::PreUpdate)
+            .iter([](flecs::iter& it) {
+                auto *lod = it.world().get_mut<LodSpaces>();
+                auto *space = it.world().get_mut<Space>();
+                lod->interests.clear();
+                lod->frame++;
+
+                // band 1 is due every other frame, and the others with it
+                if (lod->frame % 2 == 0) {
+                    lod->find_statics(*space);
+                }
+                for (int i = 1; i < LOD_BANDS; i++) {
+                    lod->elapsed[i] += chipmunk2d::dt(it.world(),
+                            it.delta_time());
+                    if (lod->frame % (1 << i) != 0) {
+                        continue;
+                    }
+                    cpSpace *band = lod->bands[i];
+                    cpSpaceSetGravity(band, cpSpaceGetGravity(*space));
+                    cpSpaceSetDamping(band, cpSpaceGetDamping(*space));
+                    lod->copy_handlers(*space, i);
+                    lod->sync_statics(i);
+                    cpSpaceStep(band, lod->elapsed[i]);
+                    lod->elapsed[i] = 0;
+                }
+            });
+    }
+};
+
+/// call `func` with every body simulated for a world: those in the Space
+/// singleton, then with chipmunk2d_lod those in each far band, which holds
+/// its static mirrors too
+static void
+each_world_body(const flecs::world& ecs,
+        cpSpaceBodyIteratorFunc func,
+        void *data)
+{
+    cpSpaceEachBody(*ecs.get<Space>(), func, data);
+    if (const LodSpaces *lod = ecs.get<LodSpaces>()) {
+        for (int i = 1; i < LOD_BANDS; i++) {
+            cpSpaceEachBody(lod->bands[i], func, data);
+        }
+    }
+}
+
+/// chipmunk2d_aoi configuration; set before importing the module
+struct AoiConfig {
+    // width & height of each square region
+    cpFloat region_size;
+    // an inactive region is activated when an Interest comes within
+    // activate_radius of it, and deactivated once every Interest is further
+    // than deactivate_radius; the gap keeps an Interest on a region border
+    // from freezing & thawing it every pass
+    cpFloat activate_radius;
+    cpFloat deactivate_radius;
+    // frames between activation passes
+    int interval;
+};
+
+/// Body removed from the space because its region has no Interest nearby
+///
+/// The cpBody keeps its position & velocity while frozen, but not its sleep
+/// state: removing a body from its space wakes it, so one frozen asleep is
+/// thawed awake, and falls asleep again once it has been idle for the
+/// space's sleep time threshold.  `shapes` holds its cpShapes, which
+/// chipmunk2d detaches from the body when they are removed from the space.
+/// `space` is the space it is thawed back into, which is not the Space
+/// singleton for a far band (chipmunk2d_lod).
+struct Frozen {
+    uint64_t region;
+    cpSpace *space;
+    std::vector<cpShape *> shapes;
+};
+
+/// regions of the world known to chipmunk2d_aoi; only active regions, and
+/// those with frozen bodies, are kept
+struct AoiRegions {
+    struct Region {
+        bool active;
+        std::vector<flecs::entity_t> frozen;   // entities to thaw together
+    };
+
+    /// key of the region containing a point
+    static uint64_t key(cpVect p, cpFloat size) {
+        auto x = (int32_t)std::floor(p.x / size);
+        auto y = (int32_t)std::floor(p.y / size);
+        return ((uint64_t)(uint32_t)x << 32) | (uint32_t)y;
+    }
+
+    /// distance from the closest Interest to a region
+    cpFloat distance(uint64_t key, cpFloat size) const {
+        cpBB bb = cpBBNew((int32_t)(key >> 32) * size,
+                (int32_t)(uint32_t)key * size,
+                ((int32_t)(key >> 32) + 1) * size,
+                ((int32_t)(uint32_t)key + 1) * size);
+        cpFloat dist = INFINITY;
+        for (cpVect interest : interests) {
+            dist = cpfmin(dist, cpvdist(interest, cpBBClampVect(bb, interest)));
+        }
+        return dist;
+    }
+
+    /// update whether a region is active, creating it if needed
+    Region& update(uint64_t key, const AoiConfig& config) {
+        auto [it, created] = regions.try_emplace(key, Region{ false, {} });
+        Region& region = it->second;
+        cpFloat dist = distance(key, config.region_size);
+        region.active = region.active
+            ? dist <= config.deactivate_radius
+            : dist < config.activate_radius;
+        return region;
+    }
+
+    std::unordered_map<uint64_t, Region> regions;
+    std::vector<cpVect> interests;  // Interest positions for this pass
+};
+
+/// area-of-interest activation for chipmunk2d
+///
+/// The world is divided into square regions.  Every `interval` frames, each
+/// region is checked against the Interest entities; bodies in regions with
+/// no Interest nearby are removed from their space entirely and marked
+/// Frozen, and once an Interest approaches, every frozen body in the region
+/// is added back together.  Static bodies are never frozen.  Frozen bodies
+/// are invisible to queries & collisions, and their shapes will not wake
+/// when something touches them, as there is nothing to touch them.
+struct chipmunk2d_aoi {
+    chipmunk2d_aoi(flecs::world &ecs) {
+        ecs.import<chipmunk2d>();
+
+        if (!ecs.has<AoiConfig>()) {
+            ecs.set<AoiConfig>({ 64, 128, 192, 8 });
+        }
+        const AoiConfig *config = ecs.get<AoiConfig>();
+        ecs.set<AoiRegions>({});
+
+        ecs.system<const Body, AoiRegions>("aoi_interests")
+            .arg(2).src<AoiRegions>()
+            .with<Interest>()
+            .kind(flecs::PostLoad)
+            .rate(config->interval)
+            .each([](const Body& body, AoiRegions& aoi) {
+                    aoi.interests.push_back(cpBodyGetPosition(body));
+                });
+
+        // re-evaluate every known region, adding back all the bodies of the
+        // regions that became active
+        ecs.system<>("aoi_thaw")
+            .kind(flecs::PostLoad)
+            .rate(config->interval)
+            .iter([](flecs::iter& it) {
+                flecs::world ecs = it.world();
+                auto *aoi = ecs.get_mut<AoiRegions>();
+                auto *config = ecs.get<AoiConfig>();
+
+                for (auto it = aoi->regions.begin();
+                        it != aoi->regions.end();) {
+                    auto& [key, region] = *it;
+                    aoi->update(key, *config);
+
+                    // an inactive region with nothing in it is the same as
+                    // one never seen
+                    if (!region.active && region.frozen.empty()) {
+                        it = aoi->regions.erase(it);
+                        continue;
+                    }
+                    ++it;
+                    if (!region.active || region.frozen.empty()) {
+                        continue;
+                    }
+
+                    log_debug("thawing {} bodies in region {:#x}",
+                            region.frozen.size(), key);
+                    for (flecs::entity_t id : region.frozen) {
+                        flecs::entity entity(ecs, id);
+                        if (!entity.is_alive() || !entity.has<Body>()) {
+                            continue;
+                        }
+                        const Frozen *frozen = entity.get<Frozen>();
+                        if (!frozen || frozen->region != key) {
+                            continue;
+                        }
+                        // the PhysicsHooks only look after the Space
+                        // singleton; a far band is stepped by chipmunk2d_lod
+                        cpBody *body = *entity.get<Body>();
+                        if (frozen->space == ecs.get<Space>()->ptr) {
+                            chipmunk2d::add_body(entity, body);
+                        } else {
+                            cpSpaceAddBody(frozen->space, body);
+                        }
+                        for (cpShape *shape : frozen->shapes) {
+                            chipmunk2d::add_shape(entity, shape);
+                        }
+                        entity.remove<Frozen>();
+                    }
+                    region.frozen.clear();
+                }
+            });
+
+        // freeze each body in an inactive region
+        ecs.system<Body, AoiRegions, const AoiConfig>("aoi_freeze")
+            .arg(2).src<AoiRegions>()
+            .arg(3).src<AoiConfig>()
+            .without<Frozen>()
+            .kind(flecs::PostLoad)
+            .rate(config->interval)
+            .each([](flecs::entity entity,
+                        Body& body,
+                        AoiRegions& aoi,
+                        const AoiConfig& config) {
+                cpSpace *space = cpBodyGetSpace(body);
+                if (!space || cpBodyGetType(body) == CP_BODY_TYPE_STATIC) {
+                    return;
+                }
+
+                uint64_t key = AoiRegions::key(cpBodyGetPosition(body),
+                        config.region_size);
+                auto it = aoi.regions.find(key);
+                AoiRegions::Region& region = it != aoi.regions.end()
+                    ? it->second : aoi.update(key, config);
+                if (region.active) {
+                    return;
+                }
+
+                // nothing is released; the body & shapes are kept in Frozen
+                Frozen frozen = { key, space, {} };
+                cpBodyEachShape(body, [](cpBody *, cpShape *shape, void *data) {
+                        static_cast<std::vector<cpShape *> *>(data)
+                            ->push_back(shape);
+                    }, &frozen.shapes);
+                for (cpShape *shape : frozen.shapes) {
+                    chipmunk2d::remove_shape(entity, shape, nullptr);
+                }
+                chipmunk2d::remove_body(entity, body, nullptr);
+
+                log_debug("{} frozen in region {:#x}", entity, key);
+                region.frozen.push_back(entity.id());
+                entity.set<Frozen>(std::move(frozen));
+            });
+
+        ecs.system<AoiRegions>("aoi_done")
+            .arg(1).src<AoiRegions>()
+            .kind(flecs::PostLoad)
+            .rate(config->interval)
+            .iter([](flecs::iter&, AoiRegions *aoi) {
+                    aoi->interests.clear();
+                });
+
+        // forget a frozen shape whose Shape component goes away, so it is
+        // not added back to the space after being freed
+        PhysicsHook hook;
+        hook.remove = [](flecs::world& ecs, const PhysicsChange& change) {
+                if (change.kind != Physics_Shape || !change.release) {
+                    return false;
+                }
+                auto *shape = (cpShape *)change.ptr;
+                auto id = (flecs::entity_t)(uintptr_t)
+                    cpBodyGetUserData(cpShapeGetBody(shape));
+                if (!id || !ecs.is_alive(id)) {
+                    return false;
+                }
+                flecs::entity owner(ecs, id);
+                if (!owner.has<Frozen>()) {
+                    return false;
+                }
+                auto& shapes = owner.get_mut<Frozen>()->shapes;
+                shapes.erase(std::remove(shapes.begin(), shapes.end(), shape),
+                        shapes.end());
+                return false;
+            };
+        chipmunk2d::hook(ecs, hook);
+
+        // drop an entity that is no longer frozen, such as one deleted while
+        // frozen, from its region
+        ecs.observer<Frozen, AoiRegions>("aoi_frozen_on_remove")
+            .arg(2).src<AoiRegions>()
+            .event(flecs::OnRemove)
+            .each([](flecs::entity entity, Frozen& frozen, AoiRegions& aoi) {
+                    auto it = aoi.regions.find(frozen.region);
+                    if (it == aoi.regions.end()) {
+                        return;
+                    }
+                    auto& ids = it->second.frozen;
+                    ids.erase(std::remove(ids.begin(), ids.end(),
+                                entity.id()), ids.end());
+                });
+    }
+};
+
+/// chipmunk2d support for Tilemap
+struct chipmunk2d_tilemap {
+    chipmunk2d_tilemap(flecs::world &ecs) {
+        ecs.import<chipmunk2d>();
+
+        // create the static body, and build every chunk; the body & shapes
+        // are added as a Body & Shape would be, so a PhysicsHook may queue
+        // them
+        ecs.observer<Tilemap, Space>("tilemap_on_set")
+            .arg(2).src<Space>()
+            .event(flecs::OnSet)
+            .each([](flecs::entity entity, Tilemap& map, Space&) {
+                    if (chipmunk2d::suspended(entity.world())) {
+                        return;
+                    }
+                    log_debug("Tilemap OnSet {}", entity);
+                    if (!map.body) {
+                        map.body = cpBodyNewStatic();
+                        cpBodySetUserData(map.body, (void *)entity.id());
+                        chipmunk2d::add_body(entity, map.body);
+                    }
+                    rebuild(entity, map);
+                });
+
+        // take the body & shapes out of the space; the Tilemap frees what
+        // no PhysicsHook took over
+        ecs.observer<Tilemap, Space>("tilemap_on_remove")
+            .arg(2).src<Space>()
+            .event(flecs::OnRemove)
+            .each([](flecs::entity entity, Tilemap& map, Space&) {
+                    if (chipmunk2d::suspended(entity.world())) {
+                        return;
+                    }
+                    log_debug("Tilemap OnRemove {}", entity);
+                    for (auto& chunk : map.shapes) {
+                        chunk.erase(std::remove_if(chunk.begin(), chunk.end(),
+                                    [entity](cpShape *shape) {
+                                        return chipmunk2d::remove_shape(entity,
+                                                shape, Tilemap::free_shape);
+                                    }), chunk.end());
+                    }
+                    if (map.body && chipmunk2d::remove_body(entity, map.body,
+                                Tilemap::free_body)) {
+                        map.body = nullptr;
+                    }
+                });
+
+        // rebuild chunks changed during the last frame
+        ecs.system<Tilemap>("tilemap_rebuild")
+            .kind(flecs::PostLoad)
+            .each([](flecs::entity entity, Tilemap& map) {
+                    if (!map.dirty_chunks.empty()) {
+                        rebuild(entity, map);
+                    }
+                });
+    }
+
+    /// rebuild the dirty chunks of a map, in chunk order; the old shapes are
+    /// removed, and the new ones added, through the PhysicsHooks
+    static void rebuild(flecs::entity entity, Tilemap& map) {
+        std::sort(map.dirty_chunks.begin(), map.dirty_chunks.end());
+        for (size_t chunk : map.dirty_chunks) {
+            for (cpShape *shape : map.shapes[chunk]) {
+                if (!chipmunk2d::remove_shape(entity, shape,
+                            Tilemap::free_shape)) {
+                    cpShapeFree(shape);
+                }
+            }
+            map.build(chunk);
+            for (cpShape *shape : map.shapes[chunk]) {
+                chipmunk2d::add_shape(entity, shape);
+            }
+        }
+        map.dirty_chunks.clear();
+    }
+};
+
+/// Morton (Z-order) code of a Body's position, maintained by
+/// chipmunk2d_morton; tables of physics entities are kept sorted by it
+struct MortonKey {
+    /// interleave the bits of the position, quantized to `cell` sized cells,
+    /// so points close together in space get close codes
+    static uint32_t encode(cpVect p, cpFloat cell) {
+        auto spread = [](uint32_t v) {
+            v &= 0xffff;
+            v = (v | (v << 8)) & 0x00ff00ff;
+            v = (v | (v << 4)) & 0x0f0f0f0f;
+            v = (v | (v << 2)) & 0x33333333;
+            v = (v | (v << 1)) & 0x55555555;
+            return v;
+        };
+        auto quantize = [cell](cpFloat v) {
+            cpFloat q = std::floor(v / cell) + 0x8000;
+            return (uint32_t)cpfclamp(q, 0, 0xffff);
+        };
+        return spread(quantize(p.x)) | (spread(quantize(p.y)) << 1);
+    }
+
+    uint32_t key;
+};
+
+/// chipmunk2d_morton configuration; set before importing the module
+struct MortonConfig {
+    // frames between reorders
+    int interval;
+    // size of the grid cells positions are quantized to; around the size of
+    // a typical body
+    cpFloat cell;
+};
+
+/// scratch for morton_sort, kept so reordering doesn't allocate once the
+/// body count is steady
+struct MortonOrder {
+    std::vector<cpBody *> order;    // the space's awake bodies, by key
+    std::vector<cpBody *> keyed;    // those with a key, sorted by address
+};
+
+/// periodic spatial reordering for chipmunk2d
+///
+/// Bodies end up in the space's dynamic body array, and in flecs tables, in
+/// the order they were spawned, so neighbours in the world are far apart in
+/// memory.  Every `interval` frames this recomputes each body's MortonKey,
+/// and iterates a query ordered by MortonKey, then entity id, which makes
+/// flecs sort the tables themselves; the space's dynamic body array is put
+/// in the order the query returned them.  Bodies keep their entity, cpBody,
+/// and cpShapes.
+///
+/// Only the order the step iterates the bodies in, and the order of the
+/// Body components in their tables, changes: each cpBody is its own
+/// allocation and isn't moved, so the bodies themselves end up no closer
+/// together in memory than they were.
+struct chipmunk2d_morton {
+    chipmunk2d_morton(flecs::world &ecs) {
+        ecs.import<chipmunk2d>();
+
+        if (!ecs.has<MortonConfig>()) {
+            ecs.set<MortonConfig>({ 60, 1 });
+        }
+        const MortonConfig *config = ecs.get<MortonConfig>();
+
+        // give every non-static Body a key
+        ecs.observer<Body>("morton_on_set")
+            .event(flecs::OnSet)
+            .each([](flecs::entity entity, Body& body) {
+                    if (cpBodyGetType(body) != CP_BODY_TYPE_STATIC) {
+                        entity.set<MortonKey>({ 0 });
+                    }
+                });
+
+        ecs.system<const Body, MortonKey, const MortonConfig>("morton_keys")
+            .arg(3).src<MortonConfig>()
+            .kind(flecs::PostLoad)
+            .rate(config->interval)
+            .each([](const Body& body,
+                        MortonKey& key,
+                        const MortonConfig& config) {
+                key.key = MortonKey::encode(cpBodyGetPosition(body),
+                        config.cell);
+            });
+
+        // equal keys are ordered by entity id, so the order doesn't depend
+        // on where the bodies happen to be allocated
+        auto sorted = ecs.query_builder<const Body, const MortonKey>()
+            .order_by<MortonKey>([](flecs::entity_t e1,
+                        const MortonKey *a,
+                        flecs::entity_t e2,
+                        const MortonKey *b) -> int {
+                    if (a->key != b->key) {
+                        return (a->key > b->key) - (a->key < b->key);
+                    }
+                    return (e1 > e2) - (e1 < e2);
+                })
+            .build();
+
+        ecs.set<MortonOrder>({});
+        ecs.system<MortonOrder, Space>("morton_sort")
+            .arg(1).src<MortonOrder>()
+            .arg(2).src<Space>()
+            .kind(flecs::PostLoad)
+            .rate(config->interval)
+            .iter([sorted](flecs::iter&, MortonOrder *morton, Space *space) {
+                // iterating the ordered query is what makes flecs sort the
+                // tables in place; it returns the bodies in key order, with
+                // the keys morton_keys just stored.  Bodies in another
+                // space, such as a chipmunk2d_lod band, are left out.
+                std::vector<cpBody *>& order = morton->order;
+                order.clear();
+                cpSpace *to = *space;
+                sorted.each([&order, to](const Body& body, const MortonKey&) {
+                        if (cpBodyGetSpace(body) == to
+                                && !cpBodyIsSleeping(body)
+                                && cpBodyGetType(body) != CP_BODY_TYPE_STATIC) {
+                            order.push_back(body);
+                        }
+                    });
+
+                // awake bodies without a key, such as ones added to the
+                // space without an entity, follow in the order they're in
+                if ((int)order.size() != physics_awake_bodies(to)) {
+                    morton->keyed.assign(order.begin(), order.end());
+                    std::sort(morton->keyed.begin(), morton->keyed.end());
+                    cpSpaceEachBody(to, [](cpBody *body, void *data) {
+                            auto *morton = static_cast<MortonOrder *>(data);
+                            if (cpBodyGetType(body) == CP_BODY_TYPE_STATIC
+                                    || cpBodyIsSleeping(body)
+                                    || std::binary_search(
+                                        morton->keyed.begin(),
+                                        morton->keyed.end(), body)) {
+                                return;
+                            }
+                            morton->order.push_back(body);
+                        }, morton);
+                }
+                physics_order_bodies(to, order.data(), (int)order.size());
+            });
+    }
+};
+
+/// flight recorder for slow frames
+///
+/// Keeps compact telemetry for the last few frames; see FrameRecord.  When a
+/// frame runs over the threshold, the window of frames leading up to &
+/// including it is written to disk.  Backtraces are raw return addresses,
+/// not symbolized in the frame; symbolize them offline from the memory map
+/// written with them.
+struct chipmunk2d_recorder {
+    chipmunk2d_recorder(flecs::world &ecs) {
+        ecs.import<chipmunk2d>();
+
+        if (!ecs.has<RecorderConfig>()) {
+            ecs.set<RecorderConfig>({ 300, 50, 1000, "flight" });
+        }
+        const RecorderConfig *config = ecs.get<RecorderConfig>();
+
+        // backtrace() loads libgcc on first use; get that out of the way now
+        void *bt[1];
+        backtrace(bt, 1);
+
+        // one more slot than frames kept, for the frame in progress
+        ecs.set<FlightRecorder>(FlightRecorder(config->frames + 1,
+                    config->backtrace_us));
+
+        // count & time the core observers, keeping the backtrace of the
+        // slowest of each frame, and time the step
+        PhysicsHook hook;
+        hook.observer_begin = [](flecs::world& ecs, const char *,
+                PhysicsKind kind, bool added) {
+                auto *recorder = ecs.get_mut<FlightRecorder>();
+                FrameRecord *record = recorder->recording;
+                if (kind == Physics_Body) {
+                    (added ? record->bodies_added : record->bodies_removed)++;
+                } else {
+                    (added ? record->shapes_added : record->shapes_removed)++;
+                }
+                record->observer_calls++;
+                recorder->observer_start = record_now_us();
+            };
+        hook.observer_end = [](flecs::world& ecs, const char *name) {
+                auto *recorder = ecs.get_mut<FlightRecorder>();
+                FrameRecord *record = recorder->recording;
+                auto us = (uint32_t)(record_now_us()
+                        - recorder->observer_start);
+                if (record->slowest_observer
+                        && us <= record->slowest_observer_us) {
+                    return;
+                }
+                record->slowest_observer_us = us;
+                record->slowest_observer = name;
+                record->bt_depth = us >= recorder->backtrace_us
+                    ? backtrace(record->bt, FRAME_RECORD_BT) : 0;
+            };
+        hook.stepped = [](flecs::world& ecs, uint64_t us) {
+                ecs.get_mut<FlightRecorder>()->recording->step_us = us;
+            };
+        chipmunk2d::hook(ecs, hook);
+
+        ecs.system<FlightRecorder>("recorder_frame_begin")
+            .arg(1).src<FlightRecorder>()
+            .kind(flecs::OnLoad)
+            .iter([](flecs::iter&, FlightRecorder *recorder) {
+                    recorder->frame_start = record_now_us();
+                });
+
+        ecs.system<FlightRecorder, const RecorderConfig, Space>(
+                "recorder_frame_end")
+            .arg(1).src<FlightRecorder>()
+            .arg(2).src<RecorderConfig>()
+            .arg(3).src<Space>()
+            .kind(flecs::OnStore)
+            .iter([](flecs::iter&,
+                        FlightRecorder *recorder,
+                        const RecorderConfig *config,
+                        Space *space) {
+                FrameRecord& record = recorder->current();
+                record.frame_us = record_now_us() - recorder->frame_start;
+
+                cpArray *arbiters = space->ptr->arbiters;
+                record.contacts = arbiters->num;
+                for (int i = 0; i < arbiters->num; i++) {
+                    if (cpArbiterIsFirstContact(
+                                (cpArbiter *)arbiters->arr[i])) {
+                        record.first_contacts++;
+                    }
+                }
+
+                bool slow = record.frame_us > config->threshold_ms * 1000;
+                uint64_t frame = record.frame;
+                uint32_t frame_us = record.frame_us;
+                recorder->advance();
+                if (slow) {
+                    std::string path = fmt::format("{}-{}.txt",
+                            config->path_prefix, frame);
+                    if (recorder->persist(path)) {
+                        log_warn("frame {} took {} us; writing last {} "
+                                "frames to {}", frame, frame_us,
+                                recorder->finished(), path);
+                    }
+                }
+            });
+    }
+};
+
+/// chipmunk2d_rollback configuration; set before importing the module
+struct RollbackConfig {
+    // frames of history kept
+    int frames;
+    // bodies & projectiles saved per frame; any beyond these are not saved,
+    // and are left where they are by a rewind.  Each frame's storage grows
+    // as it is used, up to these.
+    int max_bodies;
+    int max_projectiles;
+    // cached arbiters saved per frame; any beyond these are dropped by a
+    // rewind, and the pairs start over without warm-starting
+    int max_arbiters;
+};
+
+/// ring of physics state for the last RollbackConfig::frames frames
+///
+/// The state at the start of each frame, before the step, is saved into the
+/// frame's slot of the ring: the position, velocity, force, angle, angular
+/// velocity, torque & bias velocities of every non-static body, every
+/// Projectile, the Deterministic hashes if set, and the space's cached
+/// arbiters with their contacts & accumulated impulses, along with its step
+/// clock.  A slot grows the first times it's saved into, to what the frame
+/// needs, and is reused as is once the ring wraps.  The body state & clock
+/// are copied to & from chipmunk2d's private fields by cp_private.c.
+///
+/// Call rewind() & resimulate() between frames, never from a system.  Only
+/// state is rolled back, not structure: entities, bodies & shapes created
+/// since the frame rewound to are left as they are, and bodies & shapes
+/// removed since then are skipped, along with their arbiters.
+///
+/// Resimulating the same inputs reproduces the original steps exactly when
+/// sleeping is disabled, nothing was added or removed since the frame
+/// rewound to, and the spatial index still pairs the shapes in the same
+/// order; the index isn't rolled back, but keeps its order while shapes stay
+/// within the padded bounds they were last inserted with.
+struct Rollback {
+    Rollback() : frame{0}, resimulating{false}, dropped{0} {}
+    Rollback(const RollbackConfig& config)
+        : bodies(config.frames),
+          projectiles(config.frames),
+          arbiters(config.frames),
+          frames(config.frames),
+          max_bodies{config.max_bodies},
+          max_projectiles{config.max_projectiles},
+          max_arbiters{config.max_arbiters},
+          frame{0}, resimulating{false}, dropped{0} {}
+    Rollback(const Rollback&) = delete;
+    Rollback(Rollback&& other) = default;
+
+    Rollback& operator=(const Rollback&) = delete;
+    Rollback& operator=(Rollback&& other) = default;
+
+    /// a non-static body, and the state it was saved in
+    struct BodyState {
+        cpBody *body;
+        physics_body_state state;
+
+        /// copy a body's state
+        void save(cpBody *from) {
+            body = from;
+            physics_save_body(body, &state);
+        }
+
+        /// put the body back in this state; returns false if it was asleep
+        /// in it already, and left alone
+        bool restore() const {
+            return physics_restore_body(body, &state);
+        }
+    };
+
+    struct ProjectileState {
+        flecs::entity_t entity;
+        Projectile projectile;
+    };
+
+    /// a cached arbiter, copied whole along with its contacts
+    struct ArbiterState {
+        cpArbiter arbiter;
+        cpContact contacts[CP_MAX_CONTACTS_PER_ARBITER];
+        bool active;        // was in space->arbiters, from the last step
+    };
+
+    struct Frame {
+        uint64_t frame;
+        cpFloat dt;
+        int bodies, projectiles, arbiters;
+        physics_clock clock;
+        bool deterministic;
+        uint64_t det_frame, det_hash;
+    };
+
+    /// the entry after the `used` ones of a frame's slot, growing the slot
+    /// by half again when it is full; only the first frames in each slot
+    /// grow it
+    template <typename T>
+    static T& append(std::vector<T>& slot, int used) {
+        if ((size_t)used == slot.size()) {
+            slot.resize(std::max<size_t>(64, used + used / 2));
+        }
+        return slot[used];
+    }
+
+    struct SaveArbiters {
+        Rollback *rollback;
+        Frame *frame;
+        std::vector<ArbiterState> *out;
+        cpTimestamp stamp;      // the space's, as the frame was saved
+        bool active;            // saving the arbiters the last step solved
+    };
+
+    /// save one arbiter of the pass SaveArbiters::active selects; those the
+    /// last step solved were stamped by it, and kept their contacts
+    static void save_arbiter(void *elt, void *data) {
+        auto *arb = (cpArbiter *)elt;
+        auto *save = static_cast<SaveArbiters *>(data);
+        bool active = arb->stamp == save->stamp && arb->count > 0;
+        if (active != save->active) {
+            return;
+        }
+        if (save->frame->arbiters == save->rollback->max_arbiters) {
+            save->rollback->dropped++;
+            return;
+        }
+        ArbiterState& state = append(*save->out, save->frame->arbiters++);
+        state.arbiter = *arb;
+        if (arb->count > 0) {
+            memcpy(state.contacts, arb->contacts,
+                    arb->count * sizeof(cpContact));
+        }
+        state.active = active;
+    }
+
+    /// frames that can be rewound
+    uint64_t available() const {
+        return std::min<uint64_t>(frame, frames.size());
+    }
+
+    /// save the state at the start of this frame, before it is stepped by dt
+    void save(const flecs::world& ecs, cpSpace *space, cpFloat dt) {
+        size_t slot = frame % frames.size();
+        Frame& f = frames[slot];
+        f = { frame, dt, 0, 0, 0, {}, false, 0, 0 };
+        physics_save_clock(space, &f.clock);
+
+        // bodies removed before the oldest frame kept can't be restored
+        // over anymore
+        uint64_t oldest = frame >= frames.size() ? frame - frames.size() : 0;
+        for (auto it = removed.begin(); it != removed.end();) {
+            it = it->second <= oldest ? removed.erase(it) : std::next(it);
+        }
+
+        struct Save {
+            Rollback *rollback;
+            Frame *frame;
+            std::vector<BodyState> *out;
+        } save = { this, &f, &bodies[slot] };
+        cpSpaceEachBody(space, [](cpBody *body, void *data) {
+                auto *save = static_cast<Save *>(data);
+                if (cpBodyGetType(body) == CP_BODY_TYPE_STATIC) {
+                    return;
+                }
+                if (save->frame->bodies == save->rollback->max_bodies) {
+                    save->rollback->dropped++;
+                    return;
+                }
+                append(*save->out, save->frame->bodies++).save(body);
+            }, &save);
+
+        // the arbiters the last step solved, in the order it solved them,
+        // then the rest of the cached ones
+        SaveArbiters arbs = { this, &f, &arbiters[slot], f.clock.stamp,
+            true };
+        physics_each_active_arbiter(space, save_arbiter, &arbs);
+        arbs.active = false;
+        physics_each_cached_arbiter(space, save_arbiter, &arbs);
+
+        std::vector<ProjectileState>& out = projectiles[slot];
+        ecs.each([&](flecs::entity e, const Projectile& projectile) {
+                if (f.projectiles == max_projectiles) {
+                    dropped++;
+                    return;
+                }
+                append(out, f.projectiles++) = { e.id(), projectile };
+            });
+
+        if (const Deterministic *det = ecs.get<Deterministic>()) {
+            f.deterministic = true;
+            f.det_frame = det->frame;
+            f.det_hash = det->hash;
+        }
+        frame++;
+    }
+
+    /// drop the history, as chipmunk2d::reset() frees every body & shape it
+    /// could restore
+    void forget() {
+        frame = 0;
+        removed.clear();
+    }
+
+    /// whether a body or shape was removed after a frame
+    bool removed_after(const void *ptr, uint64_t target) const {
+        auto it = removed.find(ptr);
+        return it != removed.end() && it->second > target;
+    }
+
+    /// put back the cached arbiters saved in a frame, in place of the
+    /// space's current ones
+    void restore_arbiters(cpSpace *space, size_t slot, uint64_t target) {
+        physics_drop_arbiters(space);
+        const Frame& f = frames[slot];
+        physics_restore_clock(space, &f.clock);
+
+        // restored contacts live in `restored` until the next rewind, as
+        // chipmunk2d's contact buffers after the stamp went back are reused;
+        // the arbiters the last rewind restored into it were just dropped
+        size_t needed = (size_t)f.arbiters * CP_MAX_CONTACTS_PER_ARBITER;
+        if (restored.size() < needed) {
+            restored.resize(needed);
+        }
+        cpContact *contacts = restored.data();
+        const ArbiterState *in = arbiters[slot].data();
+        for (int i = 0; i < f.arbiters; i++) {
+            const cpArbiter& saved = in[i].arbiter;
+            if (!removed.empty() && (removed_after(saved.body_a, target)
+                        || removed_after(saved.body_b, target)
+                        || removed_after(saved.a, target)
+                        || removed_after(saved.b, target))) {
+                continue;
+            }
+            // a sleeping body keeps its arbiters to itself until it wakes
+            if (cpBodyIsSleeping(saved.body_a)
+                    || cpBodyIsSleeping(saved.body_b)) {
+                continue;
+            }
+
+            memcpy(contacts, in[i].contacts, saved.count * sizeof(cpContact));
+            physics_restore_arbiter(space, &saved, contacts, in[i].active);
+            contacts += saved.count;
+        }
+    }
+
+    /// restore the state from `count` frames ago, undoing the last `count`
+    /// steps; returns false if that frame is no longer kept
+    bool rewind(const flecs::world& ecs, int count) {
+        if (count < 1 || (uint64_t)count > available()) {
+            return false;
+        }
+        uint64_t target = frame - count;
+        size_t slot = target % frames.size();
+        const Frame& f = frames[slot];
+        assert(f.frame == target && "rollback ring out of sync");
+
+        const BodyState *in = bodies[slot].data();
+        for (int i = 0; i < f.bodies; i++) {
+            const BodyState& state = in[i];
+            if (!removed.empty() && removed_after(state.body, target)) {
+                continue;
+            }
+            // leaves sleeping & untouched bodies alone
+            state.restore();
+        }
+        restore_arbiters(*ecs.get<Space>(), slot, target);
+
+        const ProjectileState *saved = projectiles[slot].data();
+        for (int i = 0; i < f.projectiles; i++) {
+            // a projectile that struck something since has no Projectile
+            // left to write to, so set it again
+            flecs::entity e(ecs, saved[i].entity);
+            if (e.is_alive()) {
+                e.set<Projectile>(saved[i].projectile);
+            }
+        }
+
+        if (f.deterministic && ecs.has<Deterministic>()) {
+            Deterministic *det = ecs.get_mut<Deterministic>();
+            det->frame = f.det_frame;
+            det->hash = f.det_hash;
+        }
+
+        frame = target;
+        return true;
+    }
+
+    /// run the `count` frames after a rewind() again, each with the delta
+    /// time it had the first time; `hook` is called with the frame number
+    /// before each, to apply the corrected input for that frame
+    void resimulate(flecs::world& ecs, int count,
+            const std::function<void(uint64_t)>& hook) {
+        resimulating = true;
+        for (int i = 0; i < count; i++) {
+            const Frame& f = frames[frame % frames.size()];
+            assert(f.frame == frame && "frame was never simulated");
+            cpFloat dt = f.dt;
+            if (hook) {
+                hook(frame);
+            }
+            ecs.progress(dt);
+        }
+        resimulating = false;
+    }
+
+    // a slot per frame kept, grown to what the frames saved in it needed
+    std::vector<std::vector<BodyState>> bodies;
+    std::vector<std::vector<ProjectileState>> projectiles;
+    std::vector<std::vector<ArbiterState>> arbiters;
+    std::vector<cpContact> restored;    // contacts of the restored arbiters
+    std::vector<Frame> frames;
+    int max_bodies, max_projectiles, max_arbiters;
+    uint64_t frame;         // frames saved; the next frame to be saved
+    bool resimulating;      // set during resimulate()
+    uint64_t dropped;       // state not saved for lack of room
+    // bodies & shapes removed from the world, and the frame they were
+    // removed in
+    std::unordered_map<const void *, uint64_t> removed;
+};
+
+/// rollback of physics state, for netcode that corrects a prediction by
+/// rewinding to the frame of a late input and simulating forward again
+///
+/// ```
+/// if (rollback->rewind(ecs, frames)) {
+///     rollback->resimulate(ecs, frames, [&](uint64_t frame) {
+///             apply_inputs(frame);
+///         });
+/// }
+/// ```
+///
+/// Systems that shouldn't run again during a resimulation, such as sound or
+/// rendering, can check Rollback::resimulating.
+struct chipmunk2d_rollback {
+    chipmunk2d_rollback(flecs::world &ecs) {
+        ecs.import<chipmunk2d>();
+
+        if (!ecs.has<RollbackConfig>()) {
+            ecs.set<RollbackConfig>({ 10, 8192, 1024, 16384 });
+        }
+        ecs.set<Rollback>(Rollback(*ecs.get<RollbackConfig>()));
+
+        // the frame a body or shape is freed in keeps a later rewind from
+        // writing to the freed cpBody, or restoring an arbiter with the
+        // freed cpShape, or another since allocated in its place
+        PhysicsHook hook;
+        hook.remove = [](flecs::world& ecs, const PhysicsChange& change) {
+                if (change.release) {
+                    auto *rollback = ecs.get_mut<Rollback>();
+                    rollback->removed[change.ptr] = rollback->frame;
+                }
+                return false;
+            };
+        hook.reset = [](flecs::world& ecs) {
+                ecs.get_mut<Rollback>()->forget();
+            };
+        chipmunk2d::hook(ecs, hook);
+
+        // save the state the step is about to start from
+        ecs.system<Rollback, Space>("rollback_save")
+            .arg(1).src<Rollback>()
+            .arg(2).src<Space>()
+            .kind(flecs::PostLoad)
+            .iter([](flecs::iter& it, Rollback *rollback, Space *space) {
+                uint64_t dropped = rollback->dropped;
+                rollback->save(it.world(), *space,
+                        chipmunk2d::dt(it.world(), it.delta_time()));
+                if (dropped == 0 && rollback->dropped > 0) {
+                    log_warn("rollback: more than {} bodies, {} projectiles "
+                            "or {} arbiters; increase RollbackConfig",
+                            rollback->max_bodies, rollback->max_projectiles,
+                            rollback->max_arbiters);
+                }
+            });
+    }
+};
+
+/// chipmunk2d_replication configuration; set before importing the module, and
+/// give the ReplicationReceiver on the client the same one
+struct ReplicationConfig {
+    // quantization steps; a position is sent as a multiple of
+    // position_precision, and so on
+    cpFloat position_precision;
+    cpFloat velocity_precision;
+    // the angle is sent as a fraction of a turn, in this many bits
+    int angle_bits;
+    // snapshots kept to be used as baselines; a client that hasn't
+    // acknowledged one of these is sent everything
+    int history;
+};
+
+/// quantized state of a replicated body
+struct NetBody {
+    flecs::entity_t id;
+    int32_t px, py, vx, vy, a, w;
+};
+
+/// quantized state of every replicated body after a step, sorted by id
+struct NetSnapshot {
+    uint32_t sequence;      // 0 for an unused slot
+    std::vector<NetBody> bodies;
+};
+
+/// difference between two quantized values, wrapping rather than overflowing
+static inline int32_t
+net_delta(int32_t to, int32_t from)
+{
+    return (int32_t)((uint32_t)to - (uint32_t)from);
+}
+
+static inline int32_t
+net_undelta(int32_t from, int32_t delta)
+{
+    return (int32_t)((uint32_t)from + (uint32_t)delta);
+}
+
+static void
+net_write_id(BitWriter& writer, flecs::entity_t id, flecs::entity_t& last)
+{
+    // ids are sorted, so only the gap from the last one is written; the
+    // generation in the high bits rarely differs
+    uint64_t gap = id - last;
+    writer.write_varbits((uint32_t)gap);
+    writer.write(gap >> 32 ? 1 : 0, 1);
+    if (gap >> 32) {
+        writer.write_varbits(gap >> 32);
+    }
+    last = id;
+}
+
+static flecs::entity_t
+net_read_id(BitReader& reader, flecs::entity_t& last)
+{
+    uint64_t gap = reader.read_varbits();
+    if (reader.read(1)) {
+        gap |= (uint64_t)reader.read_varbits() << 32;
+    }
+    last += gap;
+    return last;
+}
+
+/// write `current` as a delta from `baseline`, or in full when there is no
+/// baseline
+///
+/// Bodies whose quantized state matches the baseline are left out entirely,
+/// which includes every sleeping body.  A changed body writes its id gap,
+/// a bit each for whether its position, velocity & rotation changed, then
+/// the changed values as zigzag deltas in as few bits as they fit in.
+/// Bodies in the baseline but no longer replicated are listed at the end.
+static void
+net_encode(const NetSnapshot& current, const NetSnapshot *baseline,
+        std::vector<uint8_t>& out)
+{
+    static const NetBody zero = {};
+    BitWriter writer(out);
+    writer.write(current.sequence, 32);
+    writer.write(baseline ? baseline->sequence : 0, 32);
+
+    const NetBody *base = baseline ? baseline->bodies.data() : nullptr;
+    const NetBody *base_end = baseline ? base + baseline->bodies.size() : base;
+    flecs::entity_t last = 0;
+    for (const NetBody& body : current.bodies) {
+        while (base != base_end && base->id < body.id) {
+            base++;
+        }
+        bool known = base != base_end && base->id == body.id;
+        const NetBody& from = known ? *base : zero;
+        bool moved = body.px != from.px || body.py != from.py;
+        bool sped = body.vx != from.vx || body.vy != from.vy;
+        bool turned = body.a != from.a || body.w != from.w;
+        if (known && !moved && !sped && !turned) {
+            continue;
+        }
+
+        writer.write(1, 1);
+        net_write_id(writer, body.id, last);
+        writer.write(moved | sped << 1 | turned << 2, 3);
+        if (moved) {
+            writer.write_signed(net_delta(body.px, from.px));
+            writer.write_signed(net_delta(body.py, from.py));
+        }
+        if (sped) {
+            writer.write_signed(net_delta(body.vx, from.vx));
+            writer.write_signed(net_delta(body.vy, from.vy));
+        }
+        if (turned) {
+            writer.write_signed(net_delta(body.a, from.a));
+            writer.write_signed(net_delta(body.w, from.w));
+        }
+    }
+    writer.write(0, 1);
+
+    if (baseline) {
+        const NetBody *cur = current.bodies.data();
+        const NetBody *cur_end = cur + current.bodies.size();
+        last = 0;
+        for (const NetBody& body : baseline->bodies) {
+            while (cur != cur_end && cur->id < body.id) {
+                cur++;
+            }
+            if (cur == cur_end || cur->id != body.id) {
+                writer.write(1, 1);
+                net_write_id(writer, body.id, last);
+            }
+        }
+    }
+    writer.write(0, 1);
+    writer.flush();
+}
+
+/// server side of chipmunk2d_replication: the snapshots of the last few
+/// steps, kept as baselines for the clients' deltas
+///
+/// The ring is allocated once, and each slot keeps its capacity, so
+/// capturing a snapshot does not allocate once the body count is steady.
+struct Replication {
+    Replication() : sequence{0} {}
+    Replication(const ReplicationConfig& config)
+        : config(config), history(config.history), sequence{0} {}
+
+    /// get a snapshot still in the history, nullptr if it isn't
+    const NetSnapshot *snapshot(uint32_t seq) const {
+        if (seq == 0) {
+            return nullptr;
+        }
+        const NetSnapshot& snap = history[seq % history.size()];
+        return snap.sequence == seq ? &snap : nullptr;
+    }
+
+    /// quantize the state of every non-static body owned by an entity into
+    /// the next snapshot, whichever of the world's spaces it is in
+    void capture(const flecs::world& ecs) {
+        sequence++;
+        NetSnapshot& snap = history[sequence % history.size()];
+        snap.sequence = sequence;
+        snap.bodies.clear();
+
+        struct Capture {
+            const Replication *replication;
+            NetSnapshot *snap;
+        } capture = { this, &snap };
+        each_world_body(ecs, [](cpBody *body, void *data) {
+                auto *capture = static_cast<Capture *>(data);
+                auto id = (flecs::entity_t)(uintptr_t)cpBodyGetUserData(body);
+                if (id == 0 || cpBodyGetType(body) == CP_BODY_TYPE_STATIC) {
+                    return;
+                }
+                capture->snap->bodies.push_back(
+                        capture->replication->quantize(id, body));
+            }, &capture);
+
+        std::sort(snap.bodies.begin(), snap.bodies.end(),
+                [](const NetBody& l, const NetBody& r) {
+                    return l.id < r.id;
+                });
+    }
+
+    /// the last snapshot captured
+    NetSnapshot& latest() {
+        return history[sequence % history.size()];
+    }
+
+    /// encode the last snapshot for a client that has acknowledged `acked`
+    void encode(uint32_t acked, std::vector<uint8_t>& out) const {
+        net_encode(history[sequence % history.size()], snapshot(acked), out);
+    }
+
+    NetBody quantize(flecs::entity_t id, cpBody *body) const {
+        cpVect p = cpBodyGetPosition(body), v = cpBodyGetVelocity(body);
+        cpFloat turn = cpBodyGetAngle(body) / (2 * CP_PI);
+        turn -= cpffloor(turn);
+        int32_t turns = 1 << config.angle_bits;
+        return { id,
+                 (int32_t)lround(p.x / config.position_precision),
+                 (int32_t)lround(p.y / config.position_precision),
+                 (int32_t)lround(v.x / config.velocity_precision),
+                 (int32_t)lround(v.y / config.velocity_precision),
+                 (int32_t)lround(turn * turns) & (turns - 1),
+                 (int32_t)lround(cpBodyGetAngularVelocity(body)
+                         / config.velocity_precision) };
+    }
+
+    ReplicationConfig config;
+    std::vector<NetSnapshot> history;
+    uint32_t sequence;      // of the last snapshot captured
+};
+
+/// a client of chipmunk2d_replication; add one to an entity per client
+///
+/// After each step `packet` holds the delta for this client, to send however
+/// the game likes.  When the client acknowledges a sequence, set `acked`, and
+/// later packets will be deltas from it.
+struct ReplicationClient {
+    uint32_t acked;
+    std::vector<uint8_t> packet;
+};
+
+/// client side of chipmunk2d_replication; decodes packets and applies them
+/// to the client's bodies
+///
+/// Bodies are found by the server's entity id in `bodies`.  Bodies the
+/// server sends that aren't there yet are put in `unbound` for the game to
+/// create, add to `bodies`, and `set_body()`; ids the server stopped sending
+/// are put in `removed`.  Acknowledge `latest` to the server.
+struct ReplicationReceiver {
+    ReplicationReceiver() : latest{0} {}
+    ReplicationReceiver(const ReplicationConfig& config)
+        : config(config), history(config.history), latest{0} {}
+
+    /// decode a packet & apply it; returns false if it is stale or cannot be
+    /// decoded, such as when its baseline is no longer held
+    bool receive(const uint8_t *data, size_t size) {
+        static const NetBody zero = {};
+        BitReader reader(data, size);
+        uint32_t sequence = reader.read(32);
+        uint32_t base_seq = reader.read(32);
+        if (reader.overflow || sequence <= latest) {
+            return false;
+        }
+        const NetSnapshot *baseline = nullptr;
+        if (base_seq != 0) {
+            baseline = &history[base_seq % history.size()];
+            if (baseline->sequence != base_seq) {
+                log_warn("replication: baseline {} for {} not held",
+                        base_seq, sequence);
+                return false;
+            }
+        }
+
+        // the changed bodies, as absolute values
+        changed.clear();
+        const NetBody *base = baseline ? baseline->bodies.data() : nullptr;
+        const NetBody *base_end =
+            baseline ? base + baseline->bodies.size() : base;
+        flecs::entity_t last = 0;
+        while (reader.read(1) && !reader.overflow) {
+            NetBody body;
+            body.id = net_read_id(reader, last);
+            while (base != base_end && base->id < body.id) {
+                base++;
+            }
+            const NetBody& from =
+                base != base_end && base->id == body.id ? *base : zero;
+            uint32_t mask = reader.read(3);
+            body.px = from.px, body.py = from.py;
+            body.vx = from.vx, body.vy = from.vy;
+            body.a = from.a, body.w = from.w;
+            if (mask & 1) {
+                body.px = net_undelta(from.px, reader.read_signed());
+                body.py = net_undelta(from.py, reader.read_signed());
+            }
+            if (mask & 2) {
+                body.vx = net_undelta(from.vx, reader.read_signed());
+                body.vy = net_undelta(from.vy, reader.read_signed());
+            }
+            if (mask & 4) {
+                body.a = net_undelta(from.a, reader.read_signed());
+                body.w = net_undelta(from.w, reader.read_signed());
+            }
+            changed.push_back(body);
+        }
+
+        removed.clear();
+        last = 0;
+        while (reader.read(1) && !reader.overflow) {
+            removed.push_back(net_read_id(reader, last));
+        }
+        if (reader.overflow) {
+            log_warn("replication: packet {} truncated", sequence);
+            return false;
+        }
+
+        // the new snapshot is the baseline, less the removed bodies, with
+        // the changed bodies merged in
+        NetSnapshot& snap = history[sequence % history.size()];
+        scratch.clear();
+        const NetBody *chg = changed.data(), *chg_end = chg + changed.size();
+        const flecs::entity_t *rem = removed.data();
+        const flecs::entity_t *rem_end = rem + removed.size();
+        if (baseline) {
+            for (const NetBody& body : baseline->bodies) {
+                while (chg != chg_end && chg->id < body.id) {
+                    scratch.push_back(*chg++);
+                }
+                while (rem != rem_end && *rem < body.id) {
+                    rem++;
+                }
+                if (chg != chg_end && chg->id == body.id) {
+                    scratch.push_back(*chg++);
+                } else if (rem == rem_end || *rem != body.id) {
+                    scratch.push_back(body);
+                }
+            }
+        }
+        scratch.insert(scratch.end(), chg, chg_end);
+        std::swap(snap.bodies, scratch);
+        snap.sequence = sequence;
+        latest = sequence;
+
+        unbound.clear();
+        for (const NetBody& body : changed) {
+            auto it = bodies.find(body.id);
+            if (it == bodies.end()) {
+                unbound.push_back(body);
+            } else {
+                set_body(body, it->second);
+            }
+        }
+        for (flecs::entity_t id : removed) {
+            bodies.erase(id);
+        }
+        return true;
+    }
+
+    /// set a body to the state received for it
+    void set_body(const NetBody& net, cpBody *body) const {
+        cpFloat p = config.position_precision, v = config.velocity_precision;
+        cpBodySetPosition(body, cpv(net.px * p, net.py * p));
+        cpBodySetVelocity(body, cpv(net.vx * v, net.vy * v));
+        cpBodySetAngle(body, net.a * (2 * CP_PI) / (1 << config.angle_bits));
+        cpBodySetAngularVelocity(body, net.w * v);
+    }
+
+    ReplicationConfig config;
+    std::vector<NetSnapshot> history;
+    uint32_t latest;        // sequence of the newest snapshot received
+    std::unordered_map<flecs::entity_t, cpBody *> bodies;
+    std::vector<NetBody> unbound;
+    std::vector<flecs::entity_t> removed;
+    std::vector<NetBody> changed;
+    std::vector<NetBody> scratch;
+};
+
+/// replication of body state from a server world to clients
+///
+/// After each step, the state of every body, including those chipmunk2d_lod
+/// moved to a far band, is quantized into a snapshot, and each
+/// ReplicationClient gets a packet with the bodies that changed since the
+/// snapshot it last acknowledged.  A lost packet costs nothing but the next
+/// packet being a little larger, as it is still a delta from the last
+/// snapshot the client has.
+struct chipmunk2d_replication {
+    chipmunk2d_replication(flecs::world &ecs) {
+        ecs.import<chipmunk2d>();
+
+        if (!ecs.has<ReplicationConfig>()) {
+            ecs.set<ReplicationConfig>({ 1/512.0, 1/256.0, 12, 32 });
+        }
+        ecs.set<Replication>(Replication(*ecs.get<ReplicationConfig>()));
+
+        ecs.system<Replication>("replication_capture")
+            .arg(1).src<Replication>()
+            .kind(flecs::OnStore)
+            .iter([](flecs::iter& it, Replication *replication) {
+                    replication->capture(it.world());
+                });
+
+        ecs.system<ReplicationClient, const Replication>(
+                "replication_encode")
+            .arg(2).src<Replication>()
+            .kind(flecs::OnStore)
+            .each([](ReplicationClient& client,
+                        const Replication& replication) {
+                    replication.encode(client.acked, client.packet);
+                });
+    }
+};
+
+/// chipmunk2d_shm configuration; set before importing the module
+struct ShmConfig {
+    // shm_open() name of the region, such as "/game-transforms"; left
+    // empty, a name unique to the world is chosen, and set here for the
+    // readers
+    std::string name;
+    // bodies published per frame; any beyond this are left out
+    uint32_t capacity;
+};
+
+/// publication of body transforms to shared memory after each step, for
+/// renderers, analytics, and replay recorders in other processes
+///
+/// Readers open the region with a TransformReader, by the name in
+/// ShmConfig; see transform_shm.hpp.  Every non-static body owned by an
+/// entity is published, including those chipmunk2d_lod moved to a far
+/// band.  The region is unlinked when the world is destroyed.
+struct chipmunk2d_shm {
+    chipmunk2d_shm(flecs::world &ecs) {
+        ecs.import<chipmunk2d>();
+
+        if (!ecs.has<ShmConfig>()) {
+            ecs.set<ShmConfig>({ "", 16384 });
+        }
+        // the process & a count of the worlds in it, so neither a second
+        // world nor a second process opens the same region
+        ShmConfig *config = ecs.get_mut<ShmConfig>();
+        if (config->name.empty()) {
+            static std::atomic<int> worlds{0};
+            config->name = fmt::format("/chipmunk2d-transforms-{}-{}",
+                    getpid(), worlds++);
+        }
+        ecs.set<TransformPublisher>(TransformPublisher(config->name.c_str(),
+                    config->capacity));
+
+        ecs.system<TransformPublisher>("shm_publish")
+            .arg(1).src<TransformPublisher>()
+            .kind(flecs::OnStore)
+            .iter([](flecs::iter& it, TransformPublisher *publisher) {
+                if (!publisher->ok()) {
+                    return;
+                }
+
+                struct Publish {
+                    ShmTransform *out;
+                    uint32_t count, capacity, dropped;
+                } publish = { publisher->begin(), 0,
+                    publisher->header->capacity, 0 };
+                each_world_body(it.world(), [](cpBody *body, void *data) {
+                        auto *publish = static_cast<Publish *>(data);
+                        auto id = (uint64_t)(uintptr_t)cpBodyGetUserData(body);
+                        if (id == 0
+                                || cpBodyGetType(body) == CP_BODY_TYPE_STATIC) {
+                            return;
+                        }
+                        if (publish->count == publish->capacity) {
+                            publish->dropped++;
+                            return;
+                        }
+                        cpVect p = cpBodyGetPosition(body);
+                        publish->out[publish->count++] =
+                            { id, p.x, p.y, cpBodyGetAngle(body) };
+                    }, &publish);
+                publisher->publish(publish.count);
+
+                // warn on frames 1, 2, 4, 8, ... rather than every frame
+                uint64_t frame = publisher->frame;
+                if (publish.dropped && (frame & (frame - 1)) == 0) {
+                    log_warn("shm: {} bodies over capacity {} not published",
+                            publish.dropped, publish.capacity);
+                }
+            });
+    }
+};
+
+/// chipmunk2d_render configuration; set before importing the module
+struct RenderConfig {
+    // transforms each buffer is allocated room for up front; more will grow
+    // the buffers, allocating in the sync
+    uint32_t capacity;
+};
+
+struct RenderTransform {
+    flecs::entity_t entity;
+    cpVect p;
+    cpFloat a;
+};
+
+/// transforms of the bodies after one step
+struct RenderFrame {
+    uint64_t frame;     // frames synced, including this one
+    std::vector<RenderTransform> transforms;
+};
+
+/// lock-free triple buffer of RenderFrames, between the simulation thread
+/// and a render thread
+///
+/// Of the three frames, the simulation writes the back one, the render
+/// thread reads the front one, and the middle one is handed between them by
+/// an atomic exchange.  The simulation never waits on the render thread; if
+/// it syncs twice before the render thread reads, the older frame is simply
+/// replaced.  The render thread always reads a whole frame, and keeps
+/// reading the same one until a newer one is handed over.
+struct RenderBuffer {
+    static constexpr uint32_t INDEX = 3;
+    static constexpr uint32_t FRESH = 4;    // middle has a frame not yet read
+
+    RenderBuffer(uint32_t capacity)
+        : middle{1}, back{0}, front{2}, synced{0} {
+        for (auto& frame : frames) {
+            frame.frame = 0;
+            frame.transforms.reserve(capacity);
+        }
+    }
+    RenderBuffer(const RenderBuffer&) = delete;
+
+    RenderBuffer& operator=(const RenderBuffer&) = delete;
+
+    /// the frame for the simulation to fill in
+    RenderFrame& back_frame() {
+        return frames[back];
+    }
+
+    /// hand the back frame over to the render thread; simulation thread only
+    void publish() {
+        back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    /// the newest complete frame; render thread only
+    ///
+    /// The frame stays valid, and unchanged, until the next call.
+    const RenderFrame& read() {
+        if (middle.load(std::memory_order_relaxed) & FRESH) {
+            front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+        }
+        return frames[front];
+    }
+
+    RenderFrame frames[3];
+    std::atomic<uint32_t> middle;
+    uint32_t back;      // owned by the simulation thread
+    uint32_t front;     // owned by the render thread
+    uint64_t synced;    // frames published; owned by the simulation thread
+};
+
+/// singleton wrapper around RenderBuffer
+///
+/// The buffer is allocated apart from the component, as flecs moves
+/// singletons whenever another one is added; take the RenderBuffer pointer
+/// for the render thread, not the component's address.
+struct RenderTransforms {
+    RenderTransforms() : ptr{nullptr} {}
+    RenderTransforms(RenderBuffer *p) : ptr{p} {}
+    RenderTransforms(const RenderTransforms&) = delete;
+    RenderTransforms(RenderTransforms&& other) : ptr{nullptr} {
+        *this = std::move(other);
+    }
+    ~RenderTransforms() {
+        delete ptr;
+    }
+
+    RenderTransforms& operator=(const RenderTransforms&) = delete;
+    RenderTransforms& operator=(RenderTransforms&& other) {
+        if (this != &other) {
+            delete ptr;
+            ptr       = other.ptr;
+            other.ptr = nullptr;
+        }
+        return *this;
+    }
+
+    /// support implicit cast to RenderBuffer*
+    inline operator RenderBuffer*() const {
+        assert(ptr != nullptr && "RenderBuffer pointer not initialized");
+        return ptr;
+    };
+
+    RenderBuffer* ptr;
+};
+
+/// hands the transforms of every body, including those chipmunk2d_lod moved
+/// to a far band, to a render thread after each step
+///
+/// ```
+/// RenderBuffer *buffer = *ecs.get<RenderTransforms>();
+/// std::thread render([buffer]() {
+///         while (running) {
+///             const RenderFrame& frame = buffer->read();
+///             draw(frame.transforms);
+///         }
+///     });
+/// ```
+///
+/// The render thread must be stopped before the world is destroyed.
+struct chipmunk2d_render {
+    chipmunk2d_render(flecs::world &ecs) {
+        ecs.import<chipmunk2d>();
+
+        if (!ecs.has<RenderConfig>()) {
+            ecs.set<RenderConfig>({ 16384 });
+        }
+        ecs.set<RenderTransforms>(
+                new RenderBuffer(ecs.get<RenderConfig>()->capacity));
+
+        ecs.system<RenderTransforms>("render_sync")
+            .arg(1).src<RenderTransforms>()
+            .kind(flecs::OnStore)
+            .iter([](flecs::iter& it, RenderTransforms *render) {
+                RenderBuffer *buffer = *render;
+                RenderFrame& frame = buffer->back_frame();
+                frame.frame = ++buffer->synced;
+                frame.transforms.clear();
+                each_world_body(it.world(), [](cpBody *body, void *data) {
+                        auto id = (flecs::entity_t)(uintptr_t)
+                            cpBodyGetUserData(body);
+                        if (id == 0
+                                || cpBodyGetType(body) == CP_BODY_TYPE_STATIC) {
+                            return;
+                        }
+                        static_cast<std::vector<RenderTransform> *>(data)
+                            ->push_back({ id, cpBodyGetPosition(body),
+                                    cpBodyGetAngle(body) });
+                    }, &frame.transforms);
+                buffer->publish();
+            });
+    }
+};
+
+/// body or shape added or removed while a step is in flight on the physics
+/// thread, queued by the chipmunk2d_async hooks
+struct PhysicsCommand {
+    bool add;               // or remove & release
+    PhysicsChange change;
+};
+
+/// dedicated thread stepping the Space singleton for chipmunk2d_async
+///
+/// `kick()` starts a step and `join()` waits for it; both, and everything
+/// else here, are called from the thread running the world.  Between the
+/// two the space belongs to the physics thread: nothing may touch it or its
+/// bodies, so changes are queued and applied at the join.
+struct PhysicsThread {
+    PhysicsThread(cpSpace *space)
+        : space{space}, dt{0}, pending{false}, quit{false}, in_flight{false},
+          steps{0} {
+        thread = std::thread([this]() { run(); });
+    }
+    PhysicsThread(const PhysicsThread&) = delete;
+    ~PhysicsThread() {
+        join();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        cv.notify_all();
+        thread.join();
+        apply();
+    }
+
+    PhysicsThread& operator=(const PhysicsThread&) = delete;
+
+    /// start stepping the space by `step` on the physics thread
+    void kick(cpFloat step) {
+        assert(!in_flight && "step already in flight");
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            dt = step;
+            pending = true;
+        }
+        cv.notify_all();
+        in_flight = true;
+    }
+
+    /// wait for the step in flight, if any, to finish
+    void join() {
+        if (!in_flight) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this]() { return !pending; });
+        in_flight = false;
+    }
+
+    /// join, and apply everything queued during the step
+    void sync() {
+        join();
+        apply();
+    }
+
+    /// queue a change to the space or its bodies, such as an impulse; runs
+    /// now if no step is in flight
+    void queue(std::function<void(cpSpace *)> call) {
+        if (in_flight) {
+            calls.push_back(std::move(call));
+        } else {
+            call(space);
+        }
+    }
+
+    /// apply the queued changes, in the order they were made; shapes are
+    /// released before the bodies they may be attached to
+    void apply() {
+        assert(!in_flight && "apply() during a step");
+        for (auto& command : commands) {
+            if (command.add) {
+                chipmunk2d::insert(space, command.change);
+            }
+        }
+        for (auto& command : commands) {
+            if (!command.add && command.change.kind == Physics_Shape) {
+                chipmunk2d::extract(command.change);
+            }
+        }
+        for (auto& command : commands) {
+            if (!command.add && command.change.kind == Physics_Body) {
+                chipmunk2d::extract(command.change);
+            }
+        }
+        commands.clear();
+
+        for (auto& call : calls) {
+            call(space);
+        }
+        calls.clear();
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cv.wait(lock, [this]() { return pending || quit; });
+            if (quit) {
+                return;
+            }
+            lock.unlock();
+            {
+                TRACE_SCOPE("physics_thread_step");
+                ALLOC_PHASE(AllocPhase_Step);
+                cpSpaceStep(space, dt);
+            }
+            steps++;
+            lock.lock();
+            pending = false;
+            cv.notify_all();
+        }
+    }
+
+    cpSpace *space;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    cpFloat dt;
+    bool pending;       // a step was kicked, and hasn't finished
+    bool quit;
+    bool in_flight;     // kicked & not joined; world thread only
+    uint64_t steps;     // taken by the physics thread
+    std::vector<PhysicsCommand> commands;
+    std::vector<std::function<void(cpSpace *)>> calls;
+};
+
+/// singleton wrapper around PhysicsThread, set by chipmunk2d_async
+struct AsyncPhysics {
+    AsyncPhysics() : ptr{nullptr} {}
+    AsyncPhysics(PhysicsThread *p) : ptr{p} {}
+    AsyncPhysics(const AsyncPhysics&) = delete;
+    AsyncPhysics(AsyncPhysics&& other) : ptr{nullptr} {
+        *this = std::move(other);
+    }
+    ~AsyncPhysics() {
+        delete ptr;
+    }
+
+    AsyncPhysics& operator=(const AsyncPhysics&) = delete;
+    AsyncPhysics& operator=(AsyncPhysics&& other) {
+        if (this != &other) {
+            delete ptr;
+            ptr       = other.ptr;
+            other.ptr = nullptr;
+        }
+        return *this;
+    }
+
+    /// support implicit cast to PhysicsThread*
+    inline operator PhysicsThread*() const {
+        assert(ptr != nullptr && "PhysicsThread pointer not initialized");
+        return ptr;
+    };
+
+    PhysicsThread* ptr;
+};
+
+/// copy of a Body's state, made by chipmunk2d_async each time a step is
+/// joined
+///
+/// From the kick at the end of PreUpdate to the join at PreStore the physics
+/// thread is stepping the cpBody; read `front` rather than the cpBody there,
+/// such as in OnUpdate gameplay.  Each join writes the state the step left
+/// behind into `back` and swaps the two, so `front` is always the latest
+/// whole step and `back` the one before it.
+struct BodyTransform {
+    struct State {
+        cpVect p, v;
+        cpFloat a;
+    };
+
+    State front, back;
+};
+
+/// step the physics on a dedicated thread, overlapped with the rest of the
+/// frame
+///
+/// The step is kicked off at the end of PreUpdate, after the core systems
+/// that use the space, and joined at PreStore, where the step's post_step
+/// hooks run.  OnUpdate, OnValidate & PostUpdate overlap the step: gameplay
+/// there should read BodyTransform rather than the cpBody, bodies & shapes
+/// set or removed then are queued by the module's PhysicsHook and applied
+/// at the join, removed ones stay allocated until then, and any other
+/// change to a body or the space goes through PhysicsThread::queue().  From
+/// PreStore to the end of PreUpdate, and between frames, the physics thread
+/// is idle and the space can be used as usual.
+///
+/// Collision handlers run on the physics thread, so must not touch the
+/// world, which rules out Deterministic::begin; push changes to the
+/// WorldCommandQueue of chipmunk2d_commands instead, which is drained after
+/// the join.
+///
+/// chipmunk2d_lod steps its bands in PreUpdate, possibly after the kick,
+/// chipmunk2d_rollback rewinds & replays the space whenever it is asked,
+/// and FastMoving sweeps in PreUpdate, before this step has moved anything,
+/// so none of them is supported in this mode, nor is Deterministic; using
+/// any of them with it, imported or set before or after, aborts.
+struct chipmunk2d_async {
+    chipmunk2d_async(flecs::world &ecs) {
+        ecs.import<chipmunk2d>();
+        ecs.set<AsyncPhysics>(new PhysicsThread(*ecs.get<Space>()));
+
+        refuse<LodSpaces>(ecs, "chipmunk2d_lod");
+        refuse<Rollback>(ecs, "chipmunk2d_rollback");
+        refuse<Deterministic>(ecs, "Deterministic");
+        refuse<FastMoving>(ecs, "FastMoving");
+
+        // step_space leaves the step to async_kick, and changes made while
+        // it's in flight wait for the join
+        PhysicsHook hook;
+        hook.add = [](flecs::world& ecs, const PhysicsChange& change) {
+                return defer(ecs, true, change);
+            };
+        hook.remove = [](flecs::world& ecs, const PhysicsChange& change) {
+                return defer(ecs, false, change);
+            };
+        hook.step = [](flecs::world&, cpFloat) {
+                return true;
+            };
+        hook.reset = [](flecs::world& ecs) {
+                PhysicsThread *thread = *ecs.get<AsyncPhysics>();
+                thread->sync();
+            };
+        chipmunk2d::hook(ecs, hook);
+
+        // a step may be in flight when the world is deleted; finish it, and
+        // apply what was queued meanwhile, before the space is freed
+        ecs.observer<Space>("async_space_on_remove")
+            .event(flecs::OnRemove)
+            .each([](flecs::entity entity, Space&) {
+                    const AsyncPhysics *async =
+                        entity.world().get<AsyncPhysics>();
+                    if (async && async->ptr) {
+                        async->ptr->sync();
+                    }
+                });
+
+        // the core PreUpdate systems were declared with chipmunk2d, so have
+        // run by now; the rest of the frame until PreStore overlaps the step
+        ecs.system<AsyncPhysics>("async_kick")
+            .arg(1).src<AsyncPhysics>()
+            .kind(flecs::PreUpdate)
+            .iter([](flecs::iter& it, AsyncPhysics *async) {
+                    PhysicsThread *thread = *async;
+                    thread->kick(chipmunk2d::dt(it.world(), it.delta_time()));
+                });
+
+        ecs.system<AsyncPhysics>("async_join")
+            .arg(1).src<AsyncPhysics>()
+            .kind(flecs::PreStore)
+            .iter([](flecs::iter& it, AsyncPhysics *async) {
+                    TRACE_SCOPE("async_join");
+                    flecs::world ecs = it.world();
+                    PhysicsThread *thread = *async;
+                    // only the part of the step the frame didn't hide is
+                    // reported
+                    auto start = std::chrono::steady_clock::now();
+                    thread->sync();
+                    chipmunk2d::stepped(ecs, start);
+                    chipmunk2d::post_step(ecs);
+                });
+
+        // copy out the state the joined step left behind
+        ecs.system<const Body, BodyTransform>("async_sync")
+            .kind(flecs::PreStore)
+            .each([](const Body& body, BodyTransform& transform) {
+                    transform.back = { cpBodyGetPosition(body),
+                        cpBodyGetVelocity(body), cpBodyGetAngle(body) };
+                    std::swap(transform.front, transform.back);
+                });
+
+        // bodies without a BodyTransform get one; the world is deferred, so
+        // it is there from the next frame
+        ecs.system<const Body>("async_sync_new")
+            .without<BodyTransform>()
+            .kind(flecs::PreStore)
+            .each([](flecs::entity entity, const Body& body) {
+                    BodyTransform::State state = { cpBodyGetPosition(body),
+                        cpBodyGetVelocity(body), cpBodyGetAngle(body) };
+                    entity.set<BodyTransform>({ state, state });
+                });
+    }
+
+    /// abort if `T`, which uses the space while the step is in flight, is in
+    /// the world now or is set later; `what` names it in the log
+    template <typename T>
+    static void refuse(flecs::world& ecs, const char *what) {
+        if (ecs.count<T>() > 0) {
+            log_fatal("{} is not supported with chipmunk2d_async", what);
+            abort();
+        }
+        ecs.observer<T>()
+            .event(flecs::OnSet)
+            .each([what](flecs::entity, T&) {
+                    log_fatal("{} is not supported with chipmunk2d_async",
+                            what);
+                    abort();
+                });
+    }
+
+    /// queue a change made while a step is in flight, to apply at the join
+    static bool defer(flecs::world& ecs, bool add,
+            const PhysicsChange& change) {
+        PhysicsThread *thread = *ecs.get<AsyncPhysics>();
+        if (!thread->in_flight) {
+            return false;
+        }
+        thread->commands.push_back({ add, change });
+        return true;
+    }
+};
+
+/// a change to the world, queued from a chipmunk2d callback
+enum WorldCommandType {
+    WorldCommand_Add,       // add `id` to `entity`, or the pair (id, target)
+    WorldCommand_Emit,      // emit event `id` on `entity`, for component
+                            // `target`
+    WorldCommand_Destroy,
+    WorldCommand_Impulse,   // apply `impulse` at `point` to entity's Body
+};
+
+struct WorldCommand {
+    WorldCommandType type;
+    flecs::entity_t entity;
+    flecs::entity_t id;
+    flecs::entity_t target;
+    cpVect impulse, point;
+};
+
+/// the commands pushed by one thread; aligned so threads pushing at the
+/// same time don't share a cache line
+struct alignas(64) WorldCommandStaging {
+    std::thread::id thread;
+    std::vector<WorldCommand> commands;
+    WorldCommandStaging *next;
+};
+
+/// queue of world changes from chipmunk2d callbacks, which may run on any
+/// thread, such as the workers of a cpHastySpace
+///
+/// Each thread pushes into its own staging buffer, found through a
+/// thread-local cache, so pushes never contend or lock.  A thread's first
+/// push registers its buffer with a compare-and-swap onto a list.
+/// drain() applies every staged command to the world in one deferred batch,
+/// and must only be called when no callbacks are running, such as after the
+/// step.  Commands from one thread are applied in the order pushed; the
+/// order between threads is not defined.
+///
+/// Adds & destroys are deferred.  Drained outside a frame they take effect
+/// at the end of the drain; drained from a system, such as by step_space's
+/// post_step hook, the world is already deferred, so they take effect when
+/// flecs merges it after the system.  Either way every command in a drain
+/// sees the world as it was before it.  Impulses are applied at the end of
+/// the drain.  Events are the exception; flecs doesn't defer them, so
+/// observers of an emitted event run during the drain, before the adds.
+/// Once an entity's destroy is drained, later commands for it in the same
+/// drain are skipped, and so are its impulses, pushed before or after.
+///
+/// Entity & component ids are plain values, so look them up before the step,
+/// e.g. `ecs.component<Collision>()`.
+struct WorldCommandQueue {
+    WorldCommandQueue(size_t reserve)
+        : head{nullptr}, reserve{reserve}, id{next_id++} {}
+    WorldCommandQueue(const WorldCommandQueue&) = delete;
+    ~WorldCommandQueue() {
+        WorldCommandStaging *staging = head.load();
+        while (staging) {
+            WorldCommandStaging *next = staging->next;
+            delete staging;
+            staging = next;
+        }
+    }
+
+    WorldCommandQueue& operator=(const WorldCommandQueue&) = delete;
+
+    /// the calling thread's staging buffer
+    WorldCommandStaging *staging() {
+        // keyed by id rather than address, as another queue may be
+        // allocated where a destroyed one was
+        struct Cache {
+            uint64_t queue;
+            WorldCommandStaging *staging;
+        };
+        static thread_local Cache cache = { 0, nullptr };
+        if (cache.queue == id) {
+            return cache.staging;
+        }
+
+        std::thread::id self = std::this_thread::get_id();
+        WorldCommandStaging *staging = head.load(std::memory_order_acquire);
+        while (staging && staging->thread != self) {
+            staging = staging->next;
+        }
+        if (!staging) {
+            staging = new WorldCommandStaging;
+            staging->thread = self;
+            staging->commands.reserve(reserve);
+            staging->next = head.load(std::memory_order_relaxed);
+            while (!head.compare_exchange_weak(staging->next, staging,
+                        std::memory_order_release,
+                        std::memory_order_relaxed)) {
+            }
+        }
+        cache = { id, staging };
+        return staging;
+    }
+
+    void add(flecs::entity_t entity, flecs::entity_t tag,
+            flecs::entity_t target = 0) {
+        staging()->commands.push_back(
+                { WorldCommand_Add, entity, tag, target, cpvzero, cpvzero });
+    }
+
+    void emit(flecs::entity_t entity, flecs::entity_t event,
+            flecs::entity_t component) {
+        staging()->commands.push_back(
+                { WorldCommand_Emit, entity, event, component,
+                  cpvzero, cpvzero });
+    }
+
+    void destroy(flecs::entity_t entity) {
+        staging()->commands.push_back(
+                { WorldCommand_Destroy, entity, 0, 0, cpvzero, cpvzero });
+    }
+
+    void impulse(flecs::entity_t entity, cpVect impulse, cpVect point) {
+        staging()->commands.push_back(
+                { WorldCommand_Impulse, entity, 0, 0, impulse, point });
+    }
+
+    /// apply & clear every staged command; returns the number applied, which
+    /// leaves out those for entities no longer alive or destroyed earlier in
+    /// the drain, and impulses on entities without a Body
+    size_t drain(const flecs::world& ecs) {
+        size_t count = 0;
+        destroyed.clear();
+        impulses.clear();
+        ecs.defer_begin();
+        for (WorldCommandStaging *staging = head.load(
+                    std::memory_order_acquire);
+                staging; staging = staging->next) {
+            for (const WorldCommand& command : staging->commands) {
+                // a destroy drained earlier hasn't been merged yet, so the
+                // entity is still alive
+                if (!ecs.is_alive(command.entity)
+                        || was_destroyed(command.entity)) {
+                    continue;
+                }
+                flecs::entity entity(ecs, command.entity);
+                switch (command.type) {
+                case WorldCommand_Add:
+                    if (command.target) {
+                        entity.add(command.id, command.target);
+                    } else {
+                        entity.add(command.id);
+                    }
+                    count++;
+                    break;
+                case WorldCommand_Emit:
+                    ecs.event(command.id)
+                        .id(command.target)
+                        .entity(command.entity)
+                        .emit();
+                    count++;
+                    break;
+                case WorldCommand_Destroy:
+                    entity.destruct();
+                    // usually destroyed in the order they were created, so
+                    // this appends
+                    destroyed.insert(std::lower_bound(destroyed.begin(),
+                                destroyed.end(), command.entity),
+                            command.entity);
+                    count++;
+                    break;
+                case WorldCommand_Impulse:
+                    impulses.push_back(command);
+                    break;
+                }
+            }
+            staging->commands.clear();
+        }
+        ecs.defer_end();
+
+        // after the batch, so a Body it removed or replaced isn't pushed;
+        // from a system the batch isn't merged yet, and an entity destroyed
+        // in it is still alive
+        for (const WorldCommand& command : impulses) {
+            if (!ecs.is_alive(command.entity)
+                    || was_destroyed(command.entity)) {
+                continue;
+            }
+            flecs::entity entity(ecs, command.entity);
+            if (const Body *body = entity.get<Body>()) {
+                cpBodyApplyImpulseAtWorldPoint(*body,
+                        command.impulse, command.point);
+                count++;
+            }
+        }
+        return count;
+    }
+
+    /// whether a destroy for `entity` was drained earlier in this drain
+    bool was_destroyed(flecs::entity_t entity) const {
+        return !destroyed.empty() && std::binary_search(destroyed.begin(),
+                destroyed.end(), entity);
+    }
+
+    std::atomic<WorldCommandStaging *> head;
+    size_t reserve;     // commands each staging buffer starts with room for
+    uint64_t id;
+    // scratch for drain(); kept to reuse their storage.  `destroyed` is
+    // sorted
+    std::vector<flecs::entity_t> destroyed;
+    std::vector<WorldCommand> impulses;
+
+    static inline std::atomic<uint64_t> next_id{1};
+};
+
+/// singleton wrapper around WorldCommandQueue, set by chipmunk2d_commands;
+/// pass the queue itself, not the component, to callbacks
+struct WorldCommands {
+    WorldCommands() : ptr{nullptr} {}
+    WorldCommands(WorldCommandQueue *p) : ptr{p} {}
+    WorldCommands(const WorldCommands&) = delete;
+    WorldCommands(WorldCommands&& other) : ptr{nullptr} {
+        *this = std::move(other);
+    }
+    ~WorldCommands() {
+        delete ptr;
+    }
+
+    WorldCommands& operator=(const WorldCommands&) = delete;
+    WorldCommands& operator=(WorldCommands&& other) {
+        if (this != &other) {
+            delete ptr;
+            ptr       = other.ptr;
+            other.ptr = nullptr;
+        }
+        return *this;
+    }
+
+    /// support implicit cast to WorldCommandQueue*
+    inline operator WorldCommandQueue*() const {
+        assert(ptr != nullptr && "WorldCommandQueue pointer not initialized");
+        return ptr;
+    };
+
+    WorldCommandQueue* ptr;
+};
+
+/// drains a WorldCommandQueue into the world after each step
+///
+/// ```
+/// WorldCommandQueue *queue = *ecs.get<WorldCommands>();
+/// handler->userData = queue;
+/// handler->beginFunc = [](cpArbiter *arb, cpSpace *, void *data) {
+///         ...
+///         static_cast<WorldCommandQueue *>(data)->add(a, collision, b);
+///         return cpTrue;
+///     };
+/// ```
+///
+/// The queue is drained by step_space right after the step, or with
+/// chipmunk2d_async right after the join, through a PhysicsHook.
+struct chipmunk2d_commands {
+    chipmunk2d_commands(flecs::world &ecs) {
+        ecs.import<chipmunk2d>();
+        ecs.set<WorldCommands>(new WorldCommandQueue(256));
+
+        PhysicsHook hook;
+        hook.post_step = [](flecs::world& ecs) {
+                TRACE_SCOPE("commands_drain");
+                WorldCommandQueue *queue = *ecs.get<WorldCommands>();
+                queue->drain(ecs);
+            };
+        chipmunk2d::hook(ecs, hook);
+    }
+};
+
+/// observation values per agent: position, velocity, angle, angular velocity
+#define ROLLOUT_OBS 6
+/// action values per agent: the force applied to it during the step
+#define ROLLOUT_ACT 2
+
+/// one environment of a Rollout
+struct RolloutEnv {
+    std::unique_ptr<flecs::world> world;
+    std::vector<cpBody *> agents;
+    // the state reset() returns to
+    std::vector<Rollback::BodyState> initial;
+    physics_clock clock;
+    // the shapes of the `initial` bodies, in the order they're reindexed
+    std::vector<cpShape *> shapes;
+    uint64_t steps;     // since the last reset
+};
+
+/// ties a Rollout environment's world back to its slot in the rollout
+struct RolloutSlot {
+    struct Rollout *rollout;
+    int env;
+};
+
+/// K environments stepped in lockstep across threads, for training agents
+/// faster than realtime
+///
+/// Each environment is a world with chipmunk2d imported once, populated by
+/// `build`, which returns the agents' entities; every environment must have
+/// the same number of agents.  The state after `build` is saved, and
+/// `reset()` copies it back into the bodies in place: the world, space,
+/// bodies & shapes are all kept, and cached contacts are dropped so the
+/// episode starts cold.  The dynamic shapes' spatial index is rebuilt the
+/// same way at the start of every episode, as the order it finds contacts
+/// in changes the solution; so an episode given the same actions plays out
+/// the same.  Entities created or destroyed during an episode are not
+/// undone by a reset.
+///
+/// Actions & observations are packed arrays of floats, indexed
+/// `[env][agent][value]`: fill `actions`, call `step()`, and read
+/// `observations`.
+struct Rollout {
+    typedef std::function<std::vector<flecs::entity>(flecs::world&, int env)>
+        BuildFunc;
+
+    Rollout(int envs, int agents, int threads, BuildFunc build)
+        : agents{agents},
+          actions(envs * agents * ROLLOUT_ACT),
+          observations(envs * agents * ROLLOUT_OBS),
+          scheduler(threads, INFINITY) {
+        for (int i = 0; i < envs; i++) {
+            RolloutEnv env;
+            env.world = std::make_unique<flecs::world>();
+            flecs::world& ecs = *env.world;
+            ecs.import<chipmunk2d>();
+            ecs.set<RolloutSlot>({ this, i });
+            for (flecs::entity agent : build(ecs, i)) {
+                env.agents.push_back(*agent.get<Body>());
+            }
+            assert((int)env.agents.size() == agents
+                    && "build returned the wrong number of agents");
+
+            cpSpace *space = *ecs.get<Space>();
+            cpSpaceEachBody(space, [](cpBody *body, void *data) {
+                    if (cpBodyGetType(body) == CP_BODY_TYPE_STATIC) {
+                        return;
+                    }
+                    Rollback::BodyState state;
+                    state.save(body);
+                    static_cast<std::vector<Rollback::BodyState> *>(data)
+                        ->push_back(state);
+                }, &env.initial);
+            for (const Rollback::BodyState& state : env.initial) {
+                cpBodyEachShape(state.body, [](cpBody *, cpShape *shape,
+                            void *data) {
+                        static_cast<std::vector<cpShape *> *>(data)
+                            ->push_back(shape);
+                    }, &env.shapes);
+            }
+            physics_save_clock(space, &env.clock);
+            env.steps = 0;
+            reindex(space, env);
+
+            // apply the actions before the step, & observe after it
+            ecs.system<RolloutSlot>("rollout_act")
+                .arg(1).src<RolloutSlot>()
+                .kind(flecs::OnLoad)
+                .iter([](flecs::iter& it, RolloutSlot *slot) {
+                    slot->rollout->act(slot->env, it.delta_time());
+                });
+            ecs.system<RolloutSlot>("rollout_observe")
+                .arg(1).src<RolloutSlot>()
+                .kind(flecs::OnStore)
+                .iter([](flecs::iter&, RolloutSlot *slot) {
+                    slot->rollout->observe(slot->env);
+                });
+
+            scheduler.add(env.world.get());
+            this->envs.push_back(std::move(env));
+            observe(i);
+        }
+    }
+    Rollout(const Rollout&) = delete;
+
+    Rollout& operator=(const Rollout&) = delete;
+
+    /// step every environment once
+    void step(cpFloat dt) {
+        scheduler.step(dt);
+        for (auto& env : envs) {
+            env.steps++;
+        }
+    }
+
+    /// return an environment to its initial state, and observe it
+    void reset(int index) {
+        RolloutEnv& env = envs[index];
+        cpSpace *space = *env.world->get<Space>();
+        for (const Rollback::BodyState& state : env.initial) {
+            state.restore();
+            // also puts the shapes of a sleeping body back in the index
+            cpBodyActivate(state.body);
+        }
+        physics_drop_arbiters(space);
+        reindex(space, env);
+        // the step warm-starts from the last dt; start as the first did
+        physics_restore_clock(space, &env.clock);
+        env.steps = 0;
+        observe(index);
+    }
+
+    /// empty the dynamic index, then insert the shapes of an environment's
+    /// bodies in the order they were saved, so it has the same tree & leaf
+    /// order after every reset
+    static void reindex(cpSpace *space, RolloutEnv& env) {
+        physics_reindex_shapes(space, env.shapes.data(),
+                (int)env.shapes.size());
+    }
+
+    /// apply an environment's actions as impulses over the coming step
+    void act(int index, cpFloat dt) {
+        const float *in = &actions[index * agents * ROLLOUT_ACT];
+        for (cpBody *body : envs[index].agents) {
+            cpBodyApplyImpulseAtWorldPoint(body,
+                    cpv(in[0] * dt, in[1] * dt),
+                    cpBodyLocalToWorld(body, cpBodyGetCenterOfGravity(body)));
+            in += ROLLOUT_ACT;
+        }
+    }
+
+    void observe(int index) {
+        float *out = &observations[index * agents * ROLLOUT_OBS];
+        for (cpBody *body : envs[index].agents) {
+            cpVect p = cpBodyGetPosition(body), v = cpBodyGetVelocity(body);
+            out[0] = p.x;
+            out[1] = p.y;
+            out[2] = v.x;
+            out[3] = v.y;
+            out[4] = cpBodyGetAngle(body);
+            out[5] = cpBodyGetAngularVelocity(body);
+            out += ROLLOUT_OBS;
+        }
+    }
+
+    int agents;         // per environment
+    std::vector<float> actions;
+    std::vector<float> observations;
+    std::vector<RolloutEnv> envs;
+    WorldScheduler scheduler;
+};
+
+// scenarios:
+// - projectile collides with entity
+// - player runs into closed door
+// - player steps on trap
+// - pivot-joint based movement
+// - multiple shapes on a single body
+
+/// shoot a projectile at an object, destroying both when they collide
+TEST(simple_struct, projectile_collision) {
+    // create the world and load the chipmunk2d plugin
+    flecs::world ecs;
+    ecs.import<chipmunk2d>();
+
+    // get the space singleton, it was created by the plugin.  We need it for
+    // creating physics bodies and shapes.
+    Space &space = *ecs.get_mut<Space>();
+
+    // add a collision handler to the space to add a collision component to any
+    // entity struct by a projectile
+    cpCollisionHandler* handler =
+        cpSpaceAddWildcardHandler(space, CT_Projectile);
+    handler->userData  = &ecs;
+    handler->beginFunc = [](cpArbiter* arb, cpSpace*,
+                             cpDataPointer data) -> cpBool {
+        auto* ecs = static_cast<flecs::world *>(data);
+        assert(ecs != nullptr && "invalid world in space userdata");
+
+        cpBody *a, *b;
+        cpArbiterGetBodies(arb, &a, &b);
+        flecs::entity proj = ecs->entity((uintptr_t)cpBodyGetUserData(a));
+        flecs::entity other = ecs->entity((uintptr_t)cpBodyGetUserData(b));
+
+        log_debug("projectile collision: {} -> {}",
+                proj.doc_name(), other.doc_name());
+
+        proj.add<Collision>(other);
+        other.add<Collision>(proj);
+
+        return true;
+    };
+
+    // create a system that removes any entity struck in a collision, both the
+    // projectile and the object
+    ecs.system<>()
+        .with<Collision>(flecs::Wildcard)
+        .each([](flecs::entity e) {
+                log_debug("{} collided; removing", e.doc_name());
+                e.destruct();
+            });
+
+    // create an arrow entity
+    flecs::entity arrow = ecs.entity("arrow");
+
+    // assign a physics body to it moving to the right at 10 units/sec
+    cpBody *body = cpBodyNew(1, INFINITY);
+    cpBodySetPosition(body, {0, 0});
+    cpBodySetVelocity(body, {10, 0});
+    arrow.set<Body>(body);
+
+    // add a shape to the physics body
+    cpShape *shape = cpCircleShapeNew(body, 1, {0,0});
+    cpShapeSetCollisionType(shape, CT_Projectile);
+    arrow.set<Shape>(shape);
+
+    // create an apple entity
+    flecs::entity apple = ecs.entity("apple");
+
+    // assign a physics body for the apple
+    body = cpBodyNew(1, INFINITY);
+    cpBodySetPosition(body, {10, 0});
+    apple.set<Body>(body);
+
+    // assign a 5x5 shape to the apple physics body
+    shape = cpBoxShapeNew(body, 5, 5, 3);
+    cpShapeSetCollisionType(shape, CT_Object);
+    apple.set<Shape>(shape);
+
+    // advance the world a second in 1/60 sec frames
+    log_debug("stepping space");
+    for (int i = 0; i < 60; i++) {
+        ecs.progress(1/60.0);
+        if (!arrow.is_valid() || !apple.is_valid()) {
+            break;
+        }
+        auto *p = arrow.get<Body>();
+        auto *a = apple.get<Body>();
+        log_debug("arrow {}, apple {}", *p->ptr, *a->ptr);
+    }
+
+    // verify that both the apple and the arrow were destroyed
+    EXPECT_EQ(arrow.is_valid(), false) << "arrow should have been destroyed";
+    EXPECT_EQ(apple.is_valid(), false) << "apple should have been destroyed";
+}
+
+/// shoot a projectile at an object, only destroying the object, and allowing
+/// the projectile to continue travelling
+TEST(simple_struct, indestructable_projectile) {
+    // create the world and load the chipmunk2d plugin
+    flecs::world ecs;
+    ecs.import<chipmunk2d>();
+
+    // get the space singleton, it was created by the plugin.  We need it for
+    // creating physics bodies and shapes.
+    Space &space = *ecs.get_mut<Space>();
+
+    // add a collision handler to the space to add a collision component to any
+    // entity struct by a projectile
+    cpCollisionHandler* handler =
+        cpSpaceAddWildcardHandler(space, CT_Projectile);
+    handler->userData  = &ecs;
+    handler->beginFunc = [](cpArbiter* arb, cpSpace*,
+                             cpDataPointer data) -> cpBool {
+        auto* ecs = static_cast<flecs::world *>(data);
+        assert(ecs != nullptr && "invalid world in space userdata");
+
+        cpBody *a, *b;
+        cpArbiterGetBodies(arb, &a, &b);
+        flecs::entity proj = ecs->entity((uintptr_t)cpBodyGetUserData(a));
+        flecs::entity other = ecs->entity((uintptr_t)cpBodyGetUserData(b));
+
+        log_debug("projectile collision: {} -> {}",
+                proj, other);
+
+        other.add<Collision>(proj);
+
+        // return false here so chipmunk2d does not reduce the velocity of the
+        // projectile based on this collision.
+        return false;
+    };
+
+    // create a system that removes any entity struck in a collision, both the
+    // projectile and the object
+    ecs.system<>()
+        .with<Collision>(flecs::Wildcard)
+        .each([](flecs::entity e) {
+                log_debug("{} collided; removing", e);
+                e.destruct();
+            });
+
+    // create an arrow entity
+    flecs::entity arrow = ecs.entity("arrow");
+
+    // assign a physics body to it moving to the right at 20 units/sec
+    cpBody *body = cpBodyNew(1, INFINITY);
+    cpBodySetPosition(body, {0, 0});
+    cpBodySetVelocity(body, {25, 0});
+    arrow.set<Body>(body);
+
+    // add a shape to the physics body
+    cpShape *shape = cpCircleShapeNew(body, 1, {0,0});
+    cpShapeSetCollisionType(shape, CT_Projectile);
+    arrow.set<Shape>(shape);
+
+    // create a row of apples to destroy
+    struct Apple {};
+    for (int i = 0; i < 5; i++) {
+        cpBody *body = cpBodyNew(1, INFINITY);
+        cpBodySetPosition(body, cpv(5.0 + (i * 5), 0));
+        cpShape *shape = cpBoxShapeNew(body, 1, 1, 0);
+        cpShapeSetCollisionType(shape, CT_Object);
+        ecs.entity()
+            .add<Apple>()
+            .set<Body>(body)
+            .set<Shape>(shape);
+    }
+
+    // advance the world a second in 1/60 sec frames
+    log_debug("stepping space");
+    for (int i = 0; i < 60; i++) {
+        ecs.progress(1/60.0);
+        if (!arrow.is_valid()) {
+            break;
+        }
+        auto *p = arrow.get<Body>();
+        log_debug("arrow {}", *p->ptr);
+    }
+
+    // verify all the apples have been destroyed
+    EXPECT_EQ(ecs.count<Apple>(), 0) << "not all apples were destroyed";
+
+    EXPECT_EQ(arrow.is_valid(), true) << "arrow was unexpectedly destroyed";
+
+    // get the arrow body and verify it wasn't slowed down
+    const Body *b = arrow.get<Body>();
     ASSERT_NE(b, nullptr) << "arrow missing Body component";
     cpVect v = cpBodyGetVelocity(*b);
     EXPECT_EQ(v, cpv(25, 0))
         << fmt::format("arrow did not maintain velocity: {}", v);
 }
+
+/// report the memory used per body and the step throughput for whichever
+/// cpFloat chipmunk2d was built with.  Build once with
+/// `-DCHIPMUNK_USE_DOUBLES=OFF` and once without, then compare the output of
+/// `make bench` from each.
+TEST(simple_struct, DISABLED_bench_float_precision) {
+    flecs::world ecs;
+    ecs.import<chipmunk2d>();
+
+    Space &space = *ecs.get_mut<Space>();
+    cpSpaceSetGravity(space, cpv(0, -10));
+
+    // static ground for everything to pile up on
+    cpBody *body = cpBodyNewStatic();
+    cpShape *shape = cpSegmentShapeNew(body, cpv(-100, 0), cpv(100, 0), 0);
+    ecs.entity("ground")
+        .set<Body>(body)
+        .set<Shape>(shape);
+
+    // columns of 1x1 boxes so every step has contacts to solve
+    const int columns = 40, rows = 50;
+    for (int x = 0; x < columns; x++) {
+        for (int y = 0; y < rows; y++) {
+            body = cpBodyNew(1, cpMomentForBox(1, 1, 1));
+            cpBodySetPosition(body, cpv(-60 + x * 3, 0.5 + y * 1.01));
+            shape = cpBoxShapeNew(body, 1, 1, 0);
+            cpShapeSetFriction(shape, 0.7);
+            ecs.entity()
+                .set<Body>(body)
+                .set<Shape>(shape);
+        }
+    }
+
+    const int steps = 300;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < steps; i++) {
+        ecs.progress(1/60.0);
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    int bodies = columns * rows;
+    log_info("cpFloat: {} ({} bytes)",
+            CP_USE_DOUBLES ? "double" : "float", sizeof(cpFloat));
+    log_info("memory per body: cpBody {} + cpPolyShape {} = {} bytes",
+            sizeof(cpBody), sizeof(cpPolyShape),
+            sizeof(cpBody) + sizeof(cpPolyShape));
+    log_info("memory per contact: cpContact {}, cpArbiter {} bytes",
+            sizeof(struct cpContact), sizeof(cpArbiter));
+    log_info("{} bodies, {} steps in {:.3f}s: {:.1f} steps/s, "
+            "{:.0f} body-steps/s",
+            bodies, steps, elapsed.count(), steps / elapsed.count(),
+            bodies * steps / elapsed.count());
+}
+
+/// fork the space, fire a hypothetical arrow in the fork, and verify the fork
+/// reports the hit without disturbing the live world
+TEST(simple_struct, space_fork) {
+    flecs::world ecs;
+    ecs.import<chipmunk2d>();
+
+    // create an apple entity in the live world
+    flecs::entity apple = ecs.entity("apple");
+    cpBody *body = cpBodyNew(1, INFINITY);
+    cpBodySetPosition(body, {10, 0});
+    apple.set<Body>(body);
+    cpShape *shape = cpBoxShapeNew(body, 5, 5, 3);
+    cpShapeSetCollisionType(shape, CT_Object);
+    apple.set<Shape>(shape);
+
+    // fork the live space, and add an arrow that only exists in the fork
+    SpaceFork fork;
+    fork.fork(*ecs.get<Space>());
+    body = cpBodyNew(1, INFINITY);
+    cpBodySetVelocity(body, {10, 0});
+    fork.add_probe(body, cpCircleShapeNew(body, 1, {0, 0}));
+
+    // "if I fire now, what gets hit in the next two seconds?"
+    std::vector<ForkHit> hits = fork.run(120, 1/60.0);
+    ASSERT_FALSE(hits.empty()) << "arrow should hit the apple";
+    EXPECT_TRUE(hits[0].a == apple.id() || hits[0].b == apple.id())
+        << "arrow did not hit the apple";
+    EXPECT_NEAR(hits[0].step, 21, 1) << "hit at the wrong time";
+
+    // the live apple is untouched, but the mirrored one was struck
+    EXPECT_EQ(cpBodyGetPosition(*apple.get<Body>()), cpv(10, 0))
+        << "live world was modified by the fork";
+    EXPECT_FALSE(cpveql(cpBodyGetPosition(fork.mirror(*apple.get<Body>())),
+                cpv(10, 0)))
+        << "apple in the fork was not moved by the arrow";
+
+    // reset the fork and ask the same question again
+    fork.reset();
+    EXPECT_EQ(fork.run(120, 1/60.0).size(), hits.size())
+        << "reset fork gave a different answer";
+}
+
+/// mirrors follow changes to the live shapes between forks
+TEST(simple_struct, space_fork_resync) {
+    flecs::world ecs;
+    ecs.import<chipmunk2d>();
+
+    flecs::entity crate = ecs.entity("crate");
+    cpBody *body = cpBodyNew(1, cpMomentForBox(1, 2, 2));
+    crate.set<Body>(body);
+    cpShape *shape = cpBoxShapeNew(body, 2, 2, 0);
+    crate.set<Shape>(shape);
+
+    SpaceFork fork;
+    fork.fork(*ecs.get<Space>());
+    cpShape *mirror = fork.shapes.at(shape).ptr;
+    EXPECT_EQ(cpShapeGetFriction(mirror), cpShapeGetFriction(shape));
+
+    // material changes are copied onto the existing mirror
+    cpShapeSetFriction(shape, 0.25);
+    cpShapeSetFilter(shape, cpShapeFilterNew(7, 1, 1));
+    fork.fork(*ecs.get<Space>());
+    ASSERT_EQ(fork.shapes.at(shape).ptr, mirror);
+    EXPECT_EQ(cpShapeGetFriction(mirror), 0.25);
+    EXPECT_EQ(cpShapeGetFilter(mirror).group, 7u);
+
+    // replace the shape; the allocator usually hands back the same address,
+    // and the mirror must not be the old box either way
+    crate.remove<Shape>();
+    cpShape *circle = cpCircleShapeNew(body, 3, cpvzero);
+    crate.set<Shape>(circle);
+    fork.fork(*ecs.get<Space>());
+    cpShape *remirror = fork.shapes.at(circle).ptr;
+    EXPECT_EQ(remirror->klass->type, CP_CIRCLE_SHAPE);
+    EXPECT_EQ(cpCircleShapeGetRadius(remirror), 3);
+}
+
+/// run forks on worker threads while the live world keeps stepping
+TEST(simple_struct, space_fork_threads) {
+    flecs::world ecs;
+    ecs.import<chipmunk2d>();
+
+    // a row of apples in the live world
+    struct Apple {};
+    for (int i = 0; i < 5; i++) {
+        cpBody *body = cpBodyNew(1, INFINITY);
+        cpBodySetPosition(body, cpv(5.0 + (i * 5), 0));
+        cpShape *shape = cpBoxShapeNew(body, 1, 1, 0);
+        ecs.entity()
+            .add<Apple>()
+            .set<Body>(body)
+            .set<Shape>(shape);
+    }
+
+    // fork twice on this thread, one arrow firing right along the row, one
+    // firing up and away from it
+    SpaceFork forks[2];
+    cpVect velocity[2] = { cpv(25, 0), cpv(0, 25) };
+    for (int i = 0; i < 2; i++) {
+        forks[i].fork(*ecs.get<Space>());
+        forks[i].pass_through = true;
+        cpBody *body = cpBodyNew(1, INFINITY);
+        cpBodySetVelocity(body, velocity[i]);
+        forks[i].add_probe(body, cpCircleShapeNew(body, 1, {0, 0}));
+    }
+
+    // run both forks in parallel with the live simulation
+    auto run = [](SpaceFork *fork) { return fork->run(60, 1/60.0).size(); };
+    auto along = std::async(std::launch::async, run, &forks[0]);
+    auto away = std::async(std::launch::async, run, &forks[1]);
+    for (int i = 0; i < 60; i++) {
+        ecs.progress(1/60.0);
+    }
+
+    EXPECT_EQ(along.get(), 5u) << "arrow along the row should hit every apple";
+    EXPECT_EQ(away.get(), 0u) << "arrow fired away should hit nothing";
+    EXPECT_EQ(ecs.count<Apple>(), 5) << "live apples were affected";
+}
+
+/// predict where a shot lands, both in a straight line and under gravity,
+/// without stepping the world
+TEST(simple_struct, predict_trajectory) {
+    flecs::world ecs;
+    ecs.import<chipmunk2d>();
+    Space &space = *ecs.get_mut<Space>();
+
+    // an apple directly in front of the turret
+    flecs::entity apple = ecs.entity("apple");
+    cpBody *body = cpBodyNew(1, INFINITY);
+    cpBodySetPosition(body, {10, 0});
+    apple.set<Body>(body);
+    apple.set<Shape>(cpBoxShapeNew(body, 5, 5, 3));
+
+    // and the ground below it
+    flecs::entity ground = ecs.entity("ground");
+    body = cpBodyNewStatic();
+    ground.set<Body>(body);
+    ground.set<Shape>(cpSegmentShapeNew(body, {-100, -5}, {100, -5}, 0));
+
+    // fire straight at the apple; its rounded edge is at x = 4.5, so a
+    // radius 1 arrow at 10 units/sec reaches it at t = 0.35
+    TrajectoryHit hit;
+    ASSERT_TRUE(predict_trajectory(space, {0, 0}, {10, 0}, 1,
+                CP_SHAPE_FILTER_ALL, 2, 16, &hit))
+        << "shot at the apple missed";
+    EXPECT_EQ(hit.entity, apple.id()) << "wrong entity hit";
+    EXPECT_NEAR(hit.time, 0.35, 1e-3) << "wrong impact time";
+    EXPECT_NEAR(hit.point.x, 3.5, 1e-3) << "wrong impact point";
+
+    // lob a shot over the apple under gravity; it lands on the ground when
+    // 10t - 5t^2 = -4, at t = 1 + sqrt(1.8)
+    cpSpaceSetGravity(space, {0, -10});
+    ASSERT_TRUE(predict_trajectory(space, {0, 0}, {-10, 10}, 1,
+                CP_SHAPE_FILTER_ALL, 3, 64, &hit))
+        << "lobbed shot never landed";
+    EXPECT_EQ(hit.entity, ground.id()) << "lobbed shot hit the wrong entity";
+    EXPECT_NEAR(hit.time, 1 + std::sqrt(1.8), 1e-2) << "wrong landing time";
+
+    // fired straight up it does not come down within a second
+    EXPECT_FALSE(predict_trajectory(space, {0, 0}, {0, 20}, 1,
+                CP_SHAPE_FILTER_ALL, 1, 16, &hit))
+        << "shot fired upwards hit something";
+
+    // predicting did not move anything
+    EXPECT_EQ(cpBodyGetPosition(*apple.get<Body>()), cpv(10, 0));
+}
+
+/// shoot a lightweight projectile at an object, destroying both when they
+/// collide, without the projectile ever having a cpBody
+TEST(simple_struct, lightweight_projectile) {
+    flecs::world ecs;
+    ecs.import<chipmunk2d>();
+
+    // remove any entity struck in a collision, both projectile and object
+    ecs.system<>()
+        .with<Collision>(flecs::Wildcard)
+        .each([](flecs::entity e) {
+                log_debug("{} collided; removing", e);
+                e.destruct();
+            });
+
+    // an arrow moving to the right at 10 units/sec
+    flecs::entity arrow = ecs.entity("arrow")
+        .set<Projectile>({ {0, 0}, {10, 0}, 1, CP_SHAPE_FILTER_ALL });
+
+    // an apple with a 5x5 shape in its way
+    flecs::entity apple = ecs.entity("apple");
+    cpBody *body = cpBodyNew(1, INFINITY);
+    cpBodySetPosition(body, {10, 0});
+    apple.set<Body>(body);
+    apple.set<Shape>(cpBoxShapeNew(body, 5, 5, 3));
+
+    for (int i = 0; i < 60; i++) {
+        ecs.progress(1/60.0);
+        if (!arrow.is_valid() || !apple.is_valid()) {
+            break;
+        }
+    }
+
+    EXPECT_EQ(arrow.is_valid(), false) << "arrow should have been destroyed";
+    EXPECT_EQ(apple.is_valid(), false) << "apple should have been destroyed";
+}
+
+/// a lightweight projectile that strikes a wall stops there, and is not
+/// swept again
+TEST(simple_struct, lightweight_projectile_spent) {
+    flecs::world ecs;
+    ecs.import<chipmunk2d>();
+
+    // a wall owned by no entity, so nothing gets a Collision
+    cpSpace *space = *ecs.get<Space>();
+    cpShape *wall = cpSpaceAddShape(space, cpSegmentShapeNew(
+                cpSpaceGetStaticBody(space), cpv(5, -5), cpv(5, 5), 0));
+
+    flecs::entity arrow = ecs.entity("arrow")
+        .set<Projectile>({ {0, 0}, {10, 0}, 0.1, CP_SHAPE_FILTER_ALL });
+    for (int i = 0; i < 60; i++) {
+        ecs.progress(1/60.0);
+    }
+
+    ASSERT_EQ(arrow.is_alive(), true) << "arrow should be left alive";
+    EXPECT_EQ(arrow.has<Projectile>(), false)
+        << "spent arrow is still swept every frame";
+
+    cpSpaceRemoveShape(space, wall);
+    cpShapeFree(wall);
+}
+
+/// a piercing lightweight projectile destroys a row of objects and keeps
+/// travelling at the same speed
+TEST(simple_struct, lightweight_piercing_projectile) {
+    flecs::world ecs;
+    ecs.import<chipmunk2d>();
+
+    ecs.system<>()
+        .with<Collision>(flecs::Wildcard)
+        .each([](flecs::entity e) {
+                log_debug("{} collided; removing", e);
+                e.destruct();
+            });
+
+    flecs::entity arrow = ecs.entity("arrow")
+        .add<Piercing>()
+        .set<Projectile>({ {0, 0}, {25, 0}, 1, CP_SHAPE_FILTER_ALL });
+
+    struct Apple {};
+    for (int i = 0; i < 5; i++) {
+        cpBody *body = cpBodyNew(1, INFINITY);
+        cpBodySetPosition(body, cpv(5.0 + (i * 5), 0));
+        ecs.entity()
+            .add<Apple>()
+            .set<Body>(body)
+            .set<Shape>(cpBoxShapeNew(body, 1, 1, 0));
+    }
+
+    for (int i = 0; i < 60; i++) {
+        ecs.progress(1/60.0);
+    }
+
+    EXPECT_EQ(ecs.count<Apple>(), 0) << "not all apples were destroyed";
+    ASSERT_EQ(arrow.is_valid(), true) << "arrow was unexpectedly destroyed";
+    EXPECT_EQ(arrow.get<Projectile>()->velocity, cpv(25, 0))
+        << "arrow did not maintain velocity";
+}
+
+/// compare the cost of body projectiles against lightweight ones
+TEST(simple_struct, DISABLED_bench_projectiles) {
+    const int count = 2000, frames = 30;
+    spdlog::set_level(spdlog::level::info);
+
+    for (int lightweight = 0; lightweight < 2; lightweight++) {
+        flecs::world ecs;
+        ecs.import<chipmunk2d>();
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<flecs::entity> shots;
+        for (int i = 0; i < count; i++) {
+            cpVect p = cpv(i * 3, 0), v = cpv(0, 100);
+            flecs::entity e = ecs.entity();
+            if (lightweight) {
+                e.set<Projectile>({ p, v, 0.1, CP_SHAPE_FILTER_ALL });
+            } else {
+                cpBody *body = cpBodyNew(1, INFINITY);
+                cpBodySetPosition(body, p);
+                cpBodySetVelocity(body, v);
+                e.set<Body>(body);
+                e.set<Shape>(cpCircleShapeNew(body, 0.1, {0, 0}));
+            }
+            shots.push_back(e);
+        }
+        for (int i = 0; i < frames; i++) {
+            ecs.progress(1/60.0);
+        }
+        for (auto& e : shots) {
+            e.destruct();
+        }
+        std::chrono::duration<double, std::micro> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        log_info("{} projectiles: {:.3f} us per projectile "
+                "(spawn, {} frames, destroy)",
+                lightweight ? "lightweight" : "body",
+                elapsed.count() / count, frames);
+    }
+
+    spdlog::set_level(spdlog::level::trace);
+}
+
+/// fire a fast arrow at a thin wall; without CCD it tunnels through, with
+/// FastMoving it either stops at the wall or reports the hit
+TEST(simple_struct, fast_moving_ccd) {
+    struct Result {
+        bool begin;         // collision handler ran
+        bool collision;     // arrow has (Collision, wall)
+        cpFloat x;          // arrow position after half a second
+    };
+
+    auto shoot = [](bool ccd, CcdMode mode) -> Result {
+        flecs::world ecs;
+        ecs.import<chipmunk2d>();
+        Space &space = *ecs.get_mut<Space>();
+
+        bool begin = false;
+        cpCollisionHandler* handler =
+            cpSpaceAddWildcardHandler(space, CT_Projectile);
+        handler->userData  = &begin;
+        handler->beginFunc = [](cpArbiter*, cpSpace*,
+                                 cpDataPointer data) -> cpBool {
+            *static_cast<bool *>(data) = true;
+            return true;
+        };
+
+        // a wall 0.2 units thick
+        flecs::entity wall = ecs.entity("wall");
+        cpBody *body = cpBodyNewStatic();
+        cpBodySetPosition(body, {5, 0});
+        wall.set<Body>(body);
+        wall.set<Shape>(cpBoxShapeNew(body, 0.2, 10, 0));
+
+        // an arrow moving 10 units per frame at 60 Hz
+        flecs::entity arrow = ecs.entity("arrow");
+        body = cpBodyNew(1, INFINITY);
+        cpBodySetVelocity(body, {600, 0});
+        arrow.set<Body>(body);
+        cpShape *shape = cpCircleShapeNew(body, 1, {0, 0});
+        cpShapeSetCollisionType(shape, CT_Projectile);
+        arrow.set<Shape>(shape);
+        if (ccd) {
+            arrow.set<FastMoving>({ mode, cpvzero });
+        }
+
+        for (int i = 0; i < 30; i++) {
+            ecs.progress(1/60.0);
+        }
+
+        return { begin,
+                 arrow.has<Collision>(wall),
+                 cpBodyGetPosition(*arrow.get<Body>()).x };
+    };
+
+    Result r = shoot(false, CCD_Clamp);
+    EXPECT_FALSE(r.begin) << "arrow did not tunnel without CCD";
+    EXPECT_GT(r.x, 5) << "arrow did not tunnel without CCD";
+
+    r = shoot(true, CCD_Clamp);
+    EXPECT_TRUE(r.begin) << "collision handler never ran with CCD";
+    EXPECT_LT(r.x, 5) << "arrow passed through the wall with CCD";
+
+    r = shoot(true, CCD_Report);
+    EXPECT_TRUE(r.collision) << "hit was not reported";
+    EXPECT_GT(r.x, 5) << "reported arrow should not be clamped";
+}
+
+/// a box is swept as itself: a tall bar clips a wall with its tip, where a
+/// circle around its center would pass under it, and a square passing just
+/// under a wall misses it, where the circle around the square would not
+TEST(simple_struct, fast_moving_ccd_box) {
+    auto clips = [](cpFloat w, cpFloat h, cpBB wall_bb) {
+        flecs::world ecs;
+        ecs.import<chipmunk2d>();
+
+        flecs::entity wall = ecs.entity("wall");
+        cpBody *body = cpBodyNewStatic();
+        wall.set<Body>(body);
+        wall.set<Shape>(cpBoxShapeNew2(body, wall_bb, 0));
+
+        // 10 units per frame at 60 Hz
+        flecs::entity bar = ecs.entity("bar");
+        body = cpBodyNew(1, INFINITY);
+        cpBodySetVelocity(body, {600, 0});
+        bar.set<Body>(body);
+        bar.set<Shape>(cpBoxShapeNew(body, w, h, 0));
+        bar.set<FastMoving>({ CCD_Report, cpvzero });
+
+        for (int i = 0; i < 10; i++) {
+            ecs.progress(1/60.0);
+        }
+        return bar.has<Collision>(wall);
+    };
+
+    EXPECT_TRUE(clips(0.2, 4, cpBBNew(4.9, 1, 5.1, 3)))
+        << "tip of the bar passed through the wall";
+    EXPECT_FALSE(clips(2, 2, cpBBNew(4.9, 1.1, 5.1, 3)))
+        << "square reported hitting a wall it passed under";
+}
+
+TEST(simple_struct, lod_bands) {
+    flecs::world ecs;
+    ecs.set<LodConfig>({ { 50, 100, 200 }, 1, 0 });
+    ecs.import<chipmunk2d_lod>();
+    Space &space = *ecs.get_mut<Space>();
+
+    // the player at the origin
+    flecs::entity player = ecs.entity("player").add<Interest>();
+    cpBody *body = cpBodyNew(1, INFINITY);
+    player.set<Body>(body);
+    player.set<Shape>(cpCircleShapeNew(body, 1, {0, 0}));
+
+    // a crate far enough away to be in band 2, stepped every fourth frame
+    flecs::entity crate = ecs.entity("crate");
+    cpBody *crate_body = cpBodyNew(1, INFINITY);
+    cpBodySetPosition(crate_body, {150, 0});
+    cpBodySetVelocity(crate_body, {0, 1});
+    crate.set<Body>(crate_body);
+    crate.set<Shape>(cpCircleShapeNew(crate_body, 1, {0, 0}));
+
+    for (int i = 0; i < 3; i++) {
+        ecs.progress(1/60.0);
+        EXPECT_EQ(cpBodyGetPosition(crate_body).y, 0)
+            << "band 2 stepped on frame " << i + 1;
+    }
+    ASSERT_TRUE(crate.has<LodBand>());
+    EXPECT_EQ(crate.get<LodBand>()->band, 2);
+    EXPECT_NE(cpBodyGetSpace(crate_body), space.ptr);
+    EXPECT_EQ(cpBodyGetSpace(body), space.ptr);
+
+    ecs.progress(1/60.0);
+    EXPECT_NEAR(cpBodyGetPosition(crate_body).y, 4/60.0, 1e-5)
+        << "band 2 was not stepped with the elapsed time";
+
+    // walk the player over to the crate; it moves back to the main space
+    // without being recreated
+    cpBodySetPosition(body, {150, 10});
+    ecs.progress(1/60.0);
+    EXPECT_EQ(crate.get<LodBand>()->band, 0);
+    EXPECT_EQ(*crate.get<Body>(), crate_body);
+    EXPECT_EQ(cpBodyGetSpace(crate_body), space.ptr);
+}
+
+TEST(simple_struct, lod_far_bands) {
+    flecs::world ecs;
+    ecs.set<LodConfig>({ { 50, 100, 200 }, 1, 5 });
+    ecs.import<chipmunk2d_lod>();
+    cpSpace *space = *ecs.get<Space>();
+    cpSpaceSetGravity(space, {0, -10});
+
+    int begins = 0;
+    cpCollisionHandler *handler = cpSpaceAddDefaultCollisionHandler(space);
+    handler->userData = &begins;
+    handler->beginFunc = [](cpArbiter *, cpSpace *,
+                            cpDataPointer data) -> cpBool {
+        (*static_cast<int *>(data))++;
+        return true;
+    };
+
+    flecs::entity player = ecs.entity("player").add<Interest>();
+    cpBody *body = cpBodyNewKinematic();
+    player.set<Body>(body);
+    player.set<Shape>(cpCircleShapeNew(body, 1, {0, 0}));
+
+    // a ledge and a crate above it, out in band 1
+    flecs::entity ledge = ecs.entity("ledge");
+    cpBody *ledge_body = cpBodyNewStatic();
+    cpBodySetPosition(ledge_body, {75, 0});
+    ledge.set<Body>(ledge_body);
+    ledge.set<Shape>(cpSegmentShapeNew(ledge_body, {-5, 0}, {5, 0}, 0));
+
+    flecs::entity crate = ecs.entity("crate");
+    cpBody *crate_body = cpBodyNew(1, INFINITY);
+    cpBodySetPosition(crate_body, {75, 1});
+    crate.set<Body>(crate_body);
+    crate.set<Shape>(cpCircleShapeNew(crate_body, 0.5, {0, 0}));
+
+    for (int i = 0; i < 60; i++) {
+        ecs.progress(1/60.0);
+    }
+    ASSERT_EQ(crate.get<LodBand>()->band, 1);
+    EXPECT_GT(begins, 0) << "handler did not run in the far band";
+    EXPECT_NEAR(cpBodyGetPosition(crate_body).y, 0.5, 0.1)
+        << "crate fell through the mirrored ledge";
+
+    // move the ledge down; the mirror follows, and so does the crate
+    cpBodySetPosition(ledge_body, {75, -10});
+    cpSpaceReindexShapesForBody(space, ledge_body);
+    for (int i = 0; i < 120; i++) {
+        ecs.progress(1/60.0);
+    }
+    EXPECT_NEAR(cpBodyGetPosition(crate_body).y, -9.5, 0.1)
+        << "mirror of the ledge did not move with it";
+
+    // the player pacing back & forth across the band 1 radius from the
+    // crate doesn't move it between spaces
+    cpSpace *band = cpBodyGetSpace(crate_body);
+    for (int i = 0; i < 10; i++) {
+        cpBodySetPosition(body, cpv(i % 2 ? 23 : 27, 0));
+        ecs.progress(1/60.0);
+        EXPECT_EQ(cpBodyGetSpace(crate_body), band) << "frame " << i;
+    }
+
+    // but it does once the player is well inside the radius
+    cpBodySetPosition(body, {35, 0});
+    ecs.progress(1/60.0);
+    EXPECT_EQ(crate.get<LodBand>()->band, 0);
+}
+
+TEST(simple_struct, lod_static_mirrors) {
+    flecs::world ecs;
+    ecs.set<LodConfig>({ { 50, 100, 200 }, 1, 5 });
+    ecs.import<chipmunk2d_lod>();
+    ecs.import<chipmunk2d_tilemap>();
+
+    // a static ledge, a static compound wall, and a level of 3 tiles, each
+    // added to the space a different way
+    flecs::entity ledge = ecs.entity("ledge");
+    cpBody *body = cpBodyNewStatic();
+    ledge.set<Body>(body);
+    ledge.set<Shape>(cpSegmentShapeNew(body, {-5, 0}, {5, 0}, 0));
+
+    flecs::entity wall = ecs.entity("wall");
+    CompoundBody compound(1, 1, { ShapeDef::box(1, 10),
+            ShapeDef::box(10, 1) });
+    cpBodySetType(compound.body, CP_BODY_TYPE_STATIC);
+    wall.set<CompoundBody>(std::move(compound));
+
+    flecs::entity level = ecs.entity("level");
+    Tilemap map(8, 8, 2, TM_Boxes, 4);
+    map.set(0, 0, true);
+    map.set(4, 0, true);
+    map.set(0, 4, true);
+    level.set<Tilemap>(std::move(map));
+    size_t tiles = level.get<Tilemap>()->shape_count();
+    ASSERT_EQ(tiles, 3u);
+
+    // all of them are mirrored into the far bands
+    ecs.progress(1/60.0);
+    ecs.progress(1/60.0);
+    const LodSpaces *lod = ecs.get<LodSpaces>();
+    EXPECT_EQ(lod->statics.size(), 1 + 2 + tiles);
+    for (auto& [shape, mirror] : lod->statics) {
+        for (int i = 1; i < LOD_BANDS; i++) {
+            EXPECT_EQ(cpShapeGetSpace(mirror.shape[i]), lod->bands[i].ptr);
+        }
+    }
+
+    // and the mirrors go with them
+    wall.destruct();
+    level.destruct();
+    ecs.progress(1/60.0);
+    ecs.progress(1/60.0);
+    lod = ecs.get<LodSpaces>();
+    EXPECT_EQ(lod->statics.size(), 1u);
+    EXPECT_EQ(lod->statics.count(*ledge.get<Shape>()), 1u);
+}
+
+TEST(simple_struct, aoi_regions) {
+    flecs::world ecs;
+    ecs.set<AoiConfig>({ 10, 30, 50, 1 });
+    ecs.import<chipmunk2d_aoi>();
+    Space &space = *ecs.get_mut<Space>();
+
+    // the player at the origin
+    flecs::entity player = ecs.entity("player").add<Interest>();
+    cpBody *body = cpBodyNew(1, INFINITY);
+    player.set<Body>(body);
+    player.set<Shape>(cpCircleShapeNew(body, 1, {0, 0}));
+
+    // a crate drifting upwards in region (10, 0), 100 units away
+    flecs::entity crate = ecs.entity("crate");
+    cpBody *crate_body = cpBodyNew(1, INFINITY);
+    cpBodySetPosition(crate_body, {100, 5});
+    cpBodySetVelocity(crate_body, {0, 1});
+    crate.set<Body>(crate_body);
+    cpShape *crate_shape = cpCircleShapeNew(crate_body, 1, {0, 0});
+    crate.set<Shape>(crate_shape);
+
+    for (int i = 0; i < 3; i++) {
+        ecs.progress(1/60.0);
+    }
+    EXPECT_TRUE(crate.has<Frozen>());
+    EXPECT_EQ(cpBodyGetSpace(crate_body), nullptr);
+    EXPECT_EQ(cpShapeGetSpace(crate_shape), nullptr);
+    EXPECT_EQ(cpBodyGetPosition(crate_body).y, 5) << "frozen body moved";
+    EXPECT_FALSE(player.has<Frozen>());
+
+    // approach within the activate radius; the crate thaws with its state
+    cpBodySetPosition(body, {75, 5});
+    ecs.progress(1/60.0);
+    EXPECT_FALSE(crate.has<Frozen>());
+    EXPECT_EQ(cpBodyGetSpace(crate_body), space.ptr);
+    EXPECT_EQ(cpShapeGetSpace(crate_shape), space.ptr);
+    EXPECT_EQ(cpBodyGetVelocity(crate_body).y, 1);
+
+    // backing off to between the radii leaves it active
+    cpBodySetPosition(body, {60, 5});
+    ecs.progress(1/60.0);
+    EXPECT_FALSE(crate.has<Frozen>()) << "region thrashed inside hysteresis";
+
+    // beyond the deactivate radius it freezes again
+    cpBodySetPosition(body, {40, 5});
+    ecs.progress(1/60.0);
+    EXPECT_TRUE(crate.has<Frozen>());
+
+    // deleting a frozen entity is fine, and its empty region is forgotten
+    uint64_t key = crate.get<Frozen>()->region;
+    crate.destruct();
+    ecs.progress(1/60.0);
+    EXPECT_EQ(ecs.get<AoiRegions>()->regions.count(key), 0u);
+
+    // removing the Shape of a live body doesn't mark its entity Frozen
+    player.remove<Shape>();
+    EXPECT_FALSE(player.has<Frozen>());
+    ecs.progress(1/60.0);
+    EXPECT_EQ(cpBodyGetSpace(body), space.ptr);
+}
+
+TEST(simple_struct, tilemap) {
+    flecs::world ecs;
+    ecs.import<chipmunk2d_tilemap>();
+    Space &space = *ecs.get_mut<Space>();
+
+    // an L of solid tiles: a 4x1 floor with a 1x3 wall on the left
+    Tilemap map(8, 8, 2, TM_Boxes, 4);
+    for (int x = 0; x < 4; x++) {
+        map.set(x, 0, true);
+    }
+    for (int y = 1; y < 4; y++) {
+        map.set(0, y, true);
+    }
+    flecs::entity level = ecs.entity("level");
+    level.set<Tilemap>(std::move(map));
+    EXPECT_EQ(level.get<Tilemap>()->shape_count(), 2u);
+
+    // points inside the tiles hit the map, and resolve to the level entity
+    cpPointQueryInfo info;
+    cpShape *hit = cpSpacePointQueryNearest(space, {7, 1}, 0,
+            CP_SHAPE_FILTER_ALL, &info);
+    ASSERT_NE(hit, nullptr);
+    EXPECT_EQ((flecs::entity_t)(uintptr_t)
+            cpBodyGetUserData(cpShapeGetBody(hit)), level.id());
+    EXPECT_EQ(cpSpacePointQueryNearest(space, {3, 3}, 0,
+            CP_SHAPE_FILTER_ALL, &info), nullptr);
+
+    // extending the floor into the next chunk only rebuilds that chunk
+    Tilemap *tiles = level.get_mut<Tilemap>();
+    cpShape *first = tiles->shapes[0][0];
+    tiles->set(4, 0, true);
+    tiles->set(5, 0, true);
+    ecs.progress(1/60.0);
+    EXPECT_EQ(tiles->shape_count(), 3u);
+    EXPECT_EQ(tiles->shapes[0][0], first) << "clean chunk was rebuilt";
+    EXPECT_NE(cpSpacePointQueryNearest(space, {11, 1}, 0,
+            CP_SHAPE_FILTER_ALL, &info), nullptr);
+
+    // removing the map removes its shapes from the space
+    level.remove<Tilemap>();
+    EXPECT_EQ(cpSpacePointQueryNearest(space, {7, 1}, 0,
+            CP_SHAPE_FILTER_ALL, &info), nullptr);
+
+    // under Deterministic, a map is queued as a Body & Shape are, and only
+    // enters the space just before the next step
+    ecs.set<Deterministic>({ 1/60.0, 0, 0, 0, {}, {}, 0, {} });
+    ecs.import<chipmunk2d_deterministic>();
+    Tilemap queued(8, 8, 2, TM_Boxes, 4);
+    queued.set(0, 0, true);
+    level.set<Tilemap>(std::move(queued));
+    EXPECT_EQ(cpBodyGetSpace(level.get<Tilemap>()->body), nullptr);
+    EXPECT_EQ(cpSpacePointQueryNearest(space, {1, 1}, 0,
+            CP_SHAPE_FILTER_ALL, &info), nullptr);
+    ecs.progress(1/60.0);
+    EXPECT_EQ(cpBodyGetSpace(level.get<Tilemap>()->body), space.ptr);
+    EXPECT_NE(cpSpacePointQueryNearest(space, {1, 1}, 0,
+            CP_SHAPE_FILTER_ALL, &info), nullptr);
+}
+
+TEST(simple_struct, tilemap_segments) {
+    flecs::world ecs;
+    ecs.import<chipmunk2d_tilemap>();
+
+    // a 2x2 block on the corner of four chunks is outlined by 2 segments in
+    // each of them
+    Tilemap map(8, 8, 1, TM_Segments, 4);
+    for (int y = 3; y < 5; y++) {
+        for (int x = 3; x < 5; x++) {
+            map.set(x, y, true);
+        }
+    }
+    flecs::entity level = ecs.entity("level");
+    level.set<Tilemap>(std::move(map));
+    EXPECT_EQ(level.get<Tilemap>()->shape_count(), 8u);
+
+    // a solid 3x2 block in one chunk is 4 segments
+    Tilemap *tiles = level.get_mut<Tilemap>();
+    for (int y = 3; y < 5; y++) {
+        tiles->set(3, y, false);
+        tiles->set(4, y, false);
+        for (int x = 0; x < 3; x++) {
+            tiles->set(x, y - 3, true);
+        }
+    }
+    ecs.progress(1/60.0);
+    EXPECT_EQ(tiles->shape_count(), 4u);
+}
+
+TEST(simple_struct, DISABLED_bench_tilemap) {
+    spdlog::set_level(spdlog::level::info);
+
+    // a 1024x1024 map with a cave-ish mix of open & solid areas
+    const int size = 1024;
+    Tilemap map(size, size, 1, TM_Boxes, 32);
+    size_t solid = 0;
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            bool value = std::sin(x * 0.05) + std::cos(y * 0.07) > 0.3;
+            map.set(x, y, value);
+            solid += value;
+        }
+    }
+
+    for (TilemapMode mode : { TM_Boxes, TM_Segments }) {
+        flecs::world ecs;
+        ecs.import<chipmunk2d_tilemap>();
+
+        Tilemap copy(size, size, 1, mode, 32);
+        copy.tiles = map.tiles;
+
+        auto start = std::chrono::steady_clock::now();
+        flecs::entity level = ecs.entity("level");
+        level.set<Tilemap>(std::move(copy));
+        auto build = std::chrono::steady_clock::now() - start;
+
+        // flip one tile, and time the chunk rebuild
+        Tilemap *tiles = level.get_mut<Tilemap>();
+        start = std::chrono::steady_clock::now();
+        tiles->set(100, 100, !tiles->solid(100, 100));
+        chipmunk2d_tilemap::rebuild(level, *tiles);
+        auto rebuild = std::chrono::steady_clock::now() - start;
+
+        log_info("tilemap {}: {} solid tiles -> {} shapes, build {} us, "
+                "single tile rebuild {} us",
+                mode == TM_Boxes ? "boxes" : "segments",
+                solid,
+                tiles->shape_count(),
+                std::chrono::duration_cast<std::chrono::microseconds>(build)
+                    .count(),
+                std::chrono::duration_cast<std::chrono::microseconds>(rebuild)
+                    .count());
+    }
+
+    spdlog::set_level(spdlog::level::trace);
+}
+
+TEST(simple_struct, static_dirty) {
+    for (int threshold : { 64, 0 }) {
+        flecs::world ecs;
+        ecs.set<StaticReindex>({ threshold });
+        ecs.import<chipmunk2d>();
+        Space &space = *ecs.get_mut<Space>();
+
+        // a door, and a wall it isn't touching
+        flecs::entity door = ecs.entity("door");
+        cpBody *body = cpBodyNewStatic();
+        door.set<Body>(body);
+        door.set<Shape>(cpBoxShapeNew(body, 1, 4, 0));
+
+        flecs::entity wall = ecs.entity("wall");
+        cpBody *wall_body = cpBodyNewStatic();
+        cpBodySetPosition(wall_body, {-10, 0});
+        wall.set<Body>(wall_body);
+        wall.set<Shape>(cpBoxShapeNew(wall_body, 1, 4, 0));
+
+        // slide the door open; the static index doesn't know until it is
+        // reindexed
+        cpBodySetPosition(body, {0, 5});
+        cpPointQueryInfo info;
+        EXPECT_EQ(cpSpacePointQueryNearest(space, {0, 6}, 0,
+                CP_SHAPE_FILTER_ALL, &info), nullptr);
+
+        door.add<StaticDirty>();
+        ecs.progress(1/60.0);
+        EXPECT_FALSE(door.has<StaticDirty>());
+        EXPECT_NE(cpSpacePointQueryNearest(space, {0, 6}, 0,
+                CP_SHAPE_FILTER_ALL, &info), nullptr)
+            << "door not reindexed, threshold " << threshold;
+        EXPECT_EQ(cpSpacePointQueryNearest(space, {0, 0}, 0,
+                CP_SHAPE_FILTER_ALL, &info), nullptr);
+        EXPECT_NE(cpSpacePointQueryNearest(space, {-10, 0}, 0,
+                CP_SHAPE_FILTER_ALL, &info), nullptr);
+    }
+}
+
+TEST(simple_struct, DISABLED_bench_static_reindex) {
+    spdlog::set_level(spdlog::level::info);
+
+    for (int threshold : { 64, 0 }) {
+        flecs::world ecs;
+        ecs.set<StaticReindex>({ threshold });
+        ecs.import<chipmunk2d>();
+
+        // 10k static wall segments, and one door
+        for (int i = 0; i < 10000; i++) {
+            flecs::entity e = ecs.entity();
+            cpBody *body = cpBodyNewStatic();
+            cpBodySetPosition(body, cpv((i % 100) * 4.0, (i / 100) * 4.0));
+            e.set<Body>(body);
+            e.set<Shape>(cpBoxShapeNew(body, 1, 1, 0));
+        }
+        flecs::entity door = ecs.entity("door");
+        cpBody *body = cpBodyNewStatic();
+        door.set<Body>(body);
+        door.set<Shape>(cpBoxShapeNew(body, 1, 2, 0));
+        ecs.progress(1/60.0);
+
+        // open & close the door, timing the frames it is dirty
+        const int frames = 100;
+        std::chrono::nanoseconds total{0};
+        for (int i = 0; i < frames; i++) {
+            cpBodySetPosition(body, cpv(0, (i % 2) * 2.0));
+            door.add<StaticDirty>();
+            auto start = std::chrono::steady_clock::now();
+            ecs.progress(1/60.0);
+            total += std::chrono::steady_clock::now() - start;
+        }
+
+        log_info("static reindex {}: {} us per door frame",
+                threshold ? "incremental" : "full",
+                std::chrono::duration_cast<std::chrono::microseconds>(total)
+                    .count() / frames);
+    }
+
+    spdlog::set_level(spdlog::level::trace);
+}
+
+TEST(simple_struct, compound_body) {
+    flecs::world ecs;
+    ecs.import<chipmunk2d>();
+    Space &space = *ecs.get_mut<Space>();
+    cpSpaceSetGravity(space, {0, -10});
+
+    flecs::entity ground = ecs.entity("ground");
+    cpBody *body = cpBodyNewStatic();
+    ground.set<Body>(body);
+    ground.set<Shape>(cpSegmentShapeNew(body, {-10, 0}, {10, 0}, 0));
+
+    // a box with a circle on top, in a single allocation
+    flecs::entity crate = ecs.entity("crate");
+    crate.set<CompoundBody>({ 1, cpMomentForBox(1, 2, 2), {
+            ShapeDef::box(2, 2),
+            ShapeDef::circle(0.5, {0, 1.5}),
+        } });
+    const CompoundBody *compound = crate.get<CompoundBody>();
+    ASSERT_EQ(compound->count, 2);
+    cpBodySetPosition(*compound, {0, 5});
+    EXPECT_EQ(cpBodyGetSpace(*compound), space.ptr);
+    EXPECT_EQ(cpShapeGetSpace(compound->shape(0)), space.ptr);
+    EXPECT_EQ(cpShapeGetSpace(compound->shape(1)), space.ptr);
+    EXPECT_EQ(cpShapeGetBody(compound->shape(1)), compound->body);
+    EXPECT_EQ((char *)compound->shape(0),
+            (char *)compound->body + sizeof(cpBody))
+        << "shapes are not co-allocated with the body";
+
+    // it falls & lands on the ground like any other body
+    for (int i = 0; i < 180; i++) {
+        ecs.progress(1/60.0);
+    }
+    EXPECT_NEAR(cpBodyGetPosition(*compound).y, 1, 0.1);
+
+    crate.destruct();
+    ecs.progress(1/60.0);
+}
+
+TEST(simple_struct, DISABLED_bench_compound_body) {
+    spdlog::set_level(spdlog::level::info);
+
+    // bodies piled up on the floor, each a box with a circle on top
+    const int count = 5000, steps = 300;
+    auto run = [&](bool compound) {
+        flecs::world ecs;
+        ecs.import<chipmunk2d>();
+        Space &space = *ecs.get_mut<Space>();
+        cpSpaceSetGravity(space, {0, -10});
+
+        flecs::entity ground = ecs.entity();
+        cpBody *body = cpBodyNewStatic();
+        ground.set<Body>(body);
+        ground.set<Shape>(cpSegmentShapeNew(body, {-500, 0}, {500, 0}, 0));
+
+        // other allocations between the bodies and shapes, as happens in a
+        // real game, spread separately allocated pieces over the heap; both
+        // arms make the same ones at the same points, and the same entities,
+        // so only the layout of the chipmunk2d objects differs
+        std::vector<void *> noise;
+        for (int i = 0; i < count; i++) {
+            cpVect p = cpv((i % 200) * 5.0 - 500, 2 + (i / 200) * 5.0);
+            flecs::entity e = ecs.entity();
+            noise.push_back(malloc(64 + (i * 37) % 512));
+            if (compound) {
+                e.set<CompoundBody>({ 1, cpMomentForBox(1, 2, 2), {
+                        ShapeDef::box(2, 2),
+                        ShapeDef::circle(0.5, {0, 1.5}),
+                    } });
+                cpBodySetPosition(*e.get<CompoundBody>(), p);
+                noise.push_back(malloc(64 + (i * 53) % 512));
+                ecs.entity().child_of(e);
+            } else {
+                body = cpBodyNew(1, cpMomentForBox(1, 2, 2));
+                cpBodySetPosition(body, p);
+                e.set<Body>(body);
+                e.set<Shape>(cpBoxShapeNew(body, 2, 2, 0));
+                noise.push_back(malloc(64 + (i * 53) % 512));
+                ecs.entity().child_of(e)
+                    .set<Shape>(cpCircleShapeNew(body, 0.5, {0, 1.5}));
+            }
+        }
+
+        PerfCounter misses;
+        auto start = std::chrono::steady_clock::now();
+        misses.start();
+        for (int i = 0; i < steps; i++) {
+            cpSpaceStep(space, 1/60.0);
+        }
+        uint64_t total = misses.stop();
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        log_info("{}: {} cache misses, {} ms for {} steps",
+                compound ? "compound" : "separate",
+                total,
+                std::chrono::duration_cast<std::chrono::milliseconds>(elapsed)
+                    .count(),
+                steps);
+        for (void *p : noise) {
+            free(p);
+        }
+    };
+
+    run(false);
+    run(true);
+
+    spdlog::set_level(spdlog::level::trace);
+}
+
+TEST(simple_struct, morton_order) {
+    flecs::world ecs;
+    ecs.set<MortonConfig>({ 1, 1 });
+    ecs.import<chipmunk2d_morton>();
+    Space &space = *ecs.get_mut<Space>();
+
+    // spawn a row of bodies right to left
+    for (int i = 0; i < 100; i++) {
+        flecs::entity e = ecs.entity();
+        cpBody *body = cpBodyNew(1, INFINITY);
+        cpBodySetPosition(body, cpv(99 - i, 0));
+        e.set<Body>(body);
+        e.set<Shape>(cpCircleShapeNew(body, 0.4, {0, 0}));
+    }
+    ecs.progress(1/60.0);
+
+    // the solver sees them left to right
+    cpArray *bodies = space.ptr->dynamicBodies;
+    ASSERT_EQ(bodies->num, 100);
+    for (int i = 1; i < bodies->num; i++) {
+        EXPECT_LT(cpBodyGetPosition((cpBody *)bodies->arr[i - 1]).x,
+                cpBodyGetPosition((cpBody *)bodies->arr[i]).x);
+    }
+
+    // and so does any system iterating the table
+    cpFloat last = -INFINITY;
+    ecs.query<const Body>().each([&](const Body& body) {
+            EXPECT_LT(last, cpBodyGetPosition(body).x);
+            last = cpBodyGetPosition(body).x;
+        });
+
+    // two bodies in the same cell go by entity id, whatever their
+    // addresses; a body without an entity goes last
+    cpBody *second = cpBodyNew(1, INFINITY);
+    cpBody *first = cpBodyNew(1, INFINITY);
+    cpBodySetPosition(first, cpv(-10.25, 0));
+    cpBodySetPosition(second, cpv(-10.75, 0));
+    flecs::entity e1 = ecs.entity(), e2 = ecs.entity();
+    ASSERT_LT(e1.id(), e2.id());
+    e1.set<Body>(first);
+    e2.set<Body>(second);
+    cpBody *raw = cpSpaceAddBody(space, cpBodyNew(1, INFINITY));
+    cpBodySetPosition(raw, cpv(-20, 0));
+    ecs.progress(1/60.0);
+
+    ASSERT_EQ(bodies->num, 103);
+    EXPECT_EQ(bodies->arr[0], first);
+    EXPECT_EQ(bodies->arr[1], second);
+    EXPECT_EQ(bodies->arr[102], raw);
+    cpSpaceRemoveBody(space, raw);
+    cpBodyFree(raw);
+}
+
+TEST(simple_struct, DISABLED_bench_morton_order) {
+    spdlog::set_level(spdlog::level::info);
+
+    const int side = 150, steps = 300, interval = 60;
+    auto run = [&](bool morton) {
+        flecs::world ecs;
+        if (morton) {
+            ecs.set<MortonConfig>({ interval, 1 });
+            ecs.import<chipmunk2d_morton>();
+        } else {
+            ecs.import<chipmunk2d>();
+        }
+
+        // a grid of slowly drifting bodies, spawned in random order
+        std::vector<int> cells(side * side);
+        for (int i = 0; i < side * side; i++) {
+            cells[i] = i;
+        }
+        std::mt19937 rng(1234);
+        std::shuffle(cells.begin(), cells.end(), rng);
+        for (int cell : cells) {
+            flecs::entity e = ecs.entity();
+            cpBody *body = cpBodyNew(1, INFINITY);
+            cpBodySetPosition(body, cpv((cell % side) * 1.1,
+                        (cell / side) * 1.1));
+            cpBodySetVelocity(body, cpv((cell % 7) * 0.01, (cell % 5) * 0.01));
+            e.set<Body>(body);
+            e.set<Shape>(cpCircleShapeNew(body, 0.5, {0, 0}));
+        }
+
+        // a stand-in for syncing transforms into the renderer
+        std::vector<cpVect> render;
+        render.reserve(side * side);
+        auto sync = ecs.query<const Body>();
+
+        // the first reorder runs on frame `interval`; let it happen before
+        // measuring, and run the unordered world just as long
+        for (int i = 0; i < interval; i++) {
+            ecs.progress(1/60.0);
+        }
+
+        PerfCounter misses;
+        std::chrono::nanoseconds step_time{0}, sync_time{0};
+        uint64_t step_misses = 0, sync_misses = 0;
+        for (int i = 0; i < steps; i++) {
+            auto start = std::chrono::steady_clock::now();
+            misses.start();
+            ecs.progress(1/60.0);
+            step_misses += misses.stop();
+            step_time += std::chrono::steady_clock::now() - start;
+
+            start = std::chrono::steady_clock::now();
+            misses.start();
+            render.clear();
+            sync.each([&](const Body& body) {
+                    render.push_back(cpBodyGetPosition(body));
+                });
+            sync_misses += misses.stop();
+            sync_time += std::chrono::steady_clock::now() - start;
+        }
+
+        log_info("{}: step {} ms, {} misses; sync {} us, {} misses",
+                morton ? "morton order" : "spawn order",
+                std::chrono::duration_cast<std::chrono::milliseconds>(
+                    step_time).count(),
+                step_misses,
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    sync_time).count(),
+                sync_misses);
+    };
+
+    run(false);
+    run(true);
+
+    spdlog::set_level(spdlog::level::trace);
+}
+
+TEST(simple_struct, reserve) {
+    flecs::world ecs;
+    ecs.import<chipmunk2d>();
+    cpSpace *space = *ecs.get<Space>();
+    chipmunk2d::reserve(ecs, 256, 256, 2048, 1024);
+    EXPECT_GE(space->dynamicBodies->max, 256);
+    EXPECT_GE(space->rousedBodies->max, 256);
+    EXPECT_GE(space->arbiters->max, 1024);
+    EXPECT_GE(space->pooledArbiters->num, 1024);
+    EXPECT_NE(space->contactBuffersHead, nullptr);
+    EXPECT_EQ(space->dynamicBodies->num, 0);
+    EXPECT_EQ(space->arbiters->num, 0);
+    EXPECT_EQ(ecs.count<Body>(), 0) << "table entities left behind";
+    EXPECT_EQ(ecs.count<Shape>(), 0) << "table entities left behind";
+
+#ifdef ALLOC_TRACKING
+    // a pile of boxes landing on the ground, well within what was reserved;
+    // count allocations made by the steps from the first, and once
+    // everything has settled
+    auto brawl = [](bool reserve) -> std::pair<uint64_t, uint64_t> {
+        flecs::world ecs;
+        ecs.import<chipmunk2d>();
+        Space &space = *ecs.get_mut<Space>();
+        cpSpaceSetGravity(space, {0, -10});
+
+        if (reserve) {
+            chipmunk2d::reserve(ecs, 256, 256, 2048, 1024);
+        }
+
+        flecs::entity ground = ecs.entity("ground");
+        cpBody *body = cpBodyNewStatic();
+        ground.set<Body>(body);
+        ground.set<Shape>(cpSegmentShapeNew(body, {-50, 0}, {50, 0}, 0));
+        for (int i = 0; i < 100; i++) {
+            flecs::entity e = ecs.entity();
+            body = cpBodyNew(1, cpMomentForBox(1, 1, 1));
+            cpBodySetPosition(body, cpv((i % 10) * 1.5 - 7.5,
+                        1 + (i / 10) * 1.1));
+            e.set<Body>(body);
+            e.set<Shape>(cpBoxShapeNew(body, 1, 1, 0));
+        }
+
+        uint64_t start = alloc_count();
+        for (int i = 0; i < 120; i++) {
+            cpSpaceStep(space, 1/60.0);
+        }
+        uint64_t warmup = alloc_count() - start;
+
+        start = alloc_count();
+        for (int i = 0; i < 60; i++) {
+            cpSpaceStep(space, 1/60.0);
+        }
+        return { warmup, alloc_count() - start };
+    };
+
+    auto [cold, steady] = brawl(false);
+    EXPECT_GT(cold, 0u) << "without reserve, the first contacts allocate";
+    EXPECT_EQ(steady, 0u) << "steps allocated after warm-up";
+
+    uint64_t warm;
+    std::tie(warm, steady) = brawl(true);
+    EXPECT_EQ(warm, 0u) << "the first steps after reserve() allocated";
+    EXPECT_EQ(steady, 0u) << "steps allocated after warm-up";
+#endif
+}
+
+TEST(simple_struct, alloc_tracking) {
+#ifndef ALLOC_TRACKING
+    GTEST_SKIP() << "built without -DALLOC_TRACKING=ON";
+#else
+    // the steady-state scenario: a settled pile of boxes, with a collision
+    // handler counting contacts.  None of these phases may allocate once it
+    // has warmed up.
+    const AllocPhase quiet[] = {
+        AllocPhase_Systems,
+        AllocPhase_Observers,
+        AllocPhase_Step,
+        AllocPhase_Callbacks,
+    };
+
+    flecs::world ecs;
+    ecs.import<chipmunk2d>();
+    Space &space = *ecs.get_mut<Space>();
+    cpSpaceSetGravity(space, {0, -10});
+
+    int contacts = 0;
+    cpCollisionHandler *handler = cpSpaceAddDefaultCollisionHandler(space);
+    handler->userData = &contacts;
+    handler->preSolveFunc = [](cpArbiter *, cpSpace *,
+                               cpDataPointer data) -> cpBool {
+        ALLOC_PHASE(AllocPhase_Callbacks);
+        (*static_cast<int *>(data))++;
+        return true;
+    };
+
+    flecs::entity ground = ecs.entity("ground");
+    cpBody *body = cpBodyNewStatic();
+    ground.set<Body>(body);
+    ground.set<Shape>(cpSegmentShapeNew(body, {-50, 0}, {50, 0}, 0));
+    for (int i = 0; i < 100; i++) {
+        flecs::entity e = ecs.entity();
+        body = cpBodyNew(1, cpMomentForBox(1, 1, 1));
+        cpBodySetPosition(body, cpv((i % 10) * 1.5 - 7.5,
+                    1 + (i / 10) * 1.1));
+        e.set<Body>(body);
+        e.set<Shape>(cpBoxShapeNew(body, 1, 1, 0));
+    }
+
+    for (int i = 0; i < 120; i++) {
+        ecs.progress(1/60.0);
+    }
+    EXPECT_GT(ecs.get<AllocStats>()->frames, 0u);
+
+    // another world churning entities on another thread must not be charged
+    // to this one
+    std::atomic<bool> done{false};
+    std::thread churn([&done] {
+            flecs::world other;
+            other.import<chipmunk2d>();
+            while (!done.load()) {
+                flecs::entity e = other.entity();
+                cpBody *body = cpBodyNew(1, cpMomentForCircle(1, 0, 1, {}));
+                e.set<Body>(body);
+                e.set<Shape>(cpCircleShapeNew(body, 1, {}));
+                other.progress(1/60.0);
+                e.destruct();
+            }
+        });
+
+    for (int frame = 0; frame < 60; frame++) {
+        ecs.progress(1/60.0);
+        const AllocStats *stats = ecs.get<AllocStats>();
+        for (AllocPhase phase : quiet) {
+            for (int s = 0; s < AllocSource_Count; s++) {
+                EXPECT_EQ(stats->frame.count[phase][s], 0u)
+                    << alloc_phase_name(phase) << " allocated "
+                    << stats->frame.bytes[phase][s] << " bytes from "
+                    << alloc_source_name((AllocSource)s)
+                    << " in steady-state frame " << frame;
+            }
+        }
+    }
+    done = true;
+    churn.join();
+    EXPECT_GT(contacts, 0);
+#endif
+}
+
+TEST(simple_struct, trace_export) {
+#ifndef TRACING
+    GTEST_SKIP() << "built without -DTRACING=ON";
+#else
+    std::string prefix = ::testing::TempDir() + "trace_export";
+
+    // a budget no frame can meet, so the first frame is dumped, and the
+    // ones after it are skipped until the interval is up
+    flecs::world ecs;
+    ecs.set<Tracer>(Tracer(1e-9, prefix, 3));
+    ecs.import<chipmunk2d>();
+    trace_clear();
+
+    flecs::entity e = ecs.entity();
+    cpBody *body = cpBodyNew(1, INFINITY);
+    e.set<Body>(body);
+    e.set<Shape>(cpCircleShapeNew(body, 1, {0, 0}));
+    {
+        TRACE_SCOPE("user_work");
+    }
+    ecs.progress(1/60.0);
+    ecs.get<Tracer>()->flush();
+
+    std::string path = prefix + "-1.json";
+    FILE *file = fopen(path.c_str(), "r");
+    ASSERT_NE(file, nullptr) << "over-budget frame was not dumped";
+    std::string json;
+    char buf[4096];
+    for (size_t n; (n = fread(buf, 1, sizeof(buf), file)) > 0; ) {
+        json.append(buf, n);
+    }
+    fclose(file);
+    remove(path.c_str());
+
+    EXPECT_EQ(json.rfind("{\"traceEvents\":[", 0), 0u);
+    for (const char *name : { "\"frame\"", "\"step_space\"",
+            "\"body_on_set\"", "\"shape_on_set\"", "\"user_work\"" }) {
+        EXPECT_NE(json.find(name), std::string::npos)
+            << name << " missing from trace";
+    }
+
+    // frames 2 & 3 are within the interval of the first dump, frame 4 isn't
+    for (int i = 0; i < 3; i++) {
+        ecs.progress(1/60.0);
+    }
+    ecs.get<Tracer>()->flush();
+    EXPECT_EQ(ecs.get<Tracer>()->dumps, 2);
+    EXPECT_EQ(ecs.get<Tracer>()->skipped, 2);
+    for (int frame = 2; frame <= 4; frame++) {
+        path = fmt::format("{}-{}.json", prefix, frame);
+        EXPECT_EQ(remove(path.c_str()) == 0, frame == 4)
+            << "frame " << frame;
+    }
+
+    // threads run one after another share a recycled buffer, & so a tid
+    trace_clear();
+    for (int i = 0; i < 8; i++) {
+        std::thread([] { TRACE_SCOPE("thread_work"); }).join();
+    }
+    path = prefix + "-threads.json";
+    ASSERT_TRUE(trace_dump(path.c_str()));
+    file = fopen(path.c_str(), "r");
+    ASSERT_NE(file, nullptr);
+    json.clear();
+    for (size_t n; (n = fread(buf, 1, sizeof(buf), file)) > 0; ) {
+        json.append(buf, n);
+    }
+    fclose(file);
+    remove(path.c_str());
+
+    std::string first_tid;
+    int events = 0;
+    for (size_t pos = json.find("\"thread_work\"");
+            pos != std::string::npos;
+            pos = json.find("\"thread_work\"", pos + 1)) {
+        size_t at = json.find("\"tid\":", pos);
+        std::string tid = json.substr(at, json.find(',', at) - at);
+        if (events++ == 0) {
+            first_tid = tid;
+        }
+        EXPECT_EQ(tid, first_tid) << "exited thread's buffer not reused";
+    }
+    EXPECT_EQ(events, 8);
+#endif
+}
+
+TEST(simple_struct, flight_recorder) {
+    std::string prefix = ::testing::TempDir() + "flight_recorder";
+
+    flecs::world ecs;
+    ecs.set<RecorderConfig>({ 4, 1000, 0, prefix });
+    ecs.import<chipmunk2d_recorder>();
+
+    // two overlapping bodies spawned before the first frame
+    for (int i = 0; i < 2; i++) {
+        flecs::entity e = ecs.entity();
+        cpBody *body = cpBodyNew(1, INFINITY);
+        cpBodySetPosition(body, cpv(i * 0.5, 0));
+        e.set<Body>(body);
+        e.set<Shape>(cpCircleShapeNew(body, 1, {0, 0}));
+    }
+    ecs.progress(1/60.0);
+
+    const FlightRecorder *recorder = ecs.get<FlightRecorder>();
+    ASSERT_EQ(recorder->head, 1u);
+    const FrameRecord& first = recorder->ring[0];
+    EXPECT_EQ(first.frame, 1u);
+    EXPECT_EQ(first.bodies_added, 2u);
+    EXPECT_EQ(first.shapes_added, 2u);
+    EXPECT_EQ(first.observer_calls, 4u);
+    EXPECT_EQ(first.contacts, 1u);
+    EXPECT_EQ(first.first_contacts, 1u);
+    EXPECT_NE(first.slowest_observer, nullptr);
+    EXPECT_GT(first.bt_depth, 0) << "backtrace not captured";
+
+    // the ring wraps, keeping the last 4 frames
+    for (int i = 0; i < 10; i++) {
+        ecs.progress(1/60.0);
+    }
+    EXPECT_EQ(recorder->dumps, 0);
+    EXPECT_EQ(recorder->ring.size(), 5u);
+
+    // a frame over the threshold writes the window out, and the slow frames
+    // right after it don't write another
+    ecs.get_mut<RecorderConfig>()->threshold_ms = 0;
+    ecs.progress(1/60.0);
+    EXPECT_EQ(recorder->dumps, 1);
+    ecs.progress(1/60.0);
+    EXPECT_EQ(recorder->dumps, 1) << "dumps were not rate limited";
+    EXPECT_EQ(recorder->skipped, 1);
+    recorder->flush();
+
+    std::string path = prefix + "-12.txt";
+    FILE *file = fopen(path.c_str(), "r");
+    ASSERT_NE(file, nullptr) << "slow frame was not written";
+    std::vector<uint64_t> frames;
+    bool maps = false;
+    char line[4096];
+    while (fgets(line, sizeof(line), file)) {
+        if (line[0] == '#') {
+            maps = maps || strstr(line, "/proc/self/maps");
+            continue;
+        }
+        if (!maps) {
+            frames.push_back(strtoull(line, nullptr, 10));
+        }
+    }
+    fclose(file);
+    remove(path.c_str());
+
+    EXPECT_TRUE(maps) << "memory map missing";
+    EXPECT_EQ(frames, (std::vector<uint64_t>{ 9, 10, 11, 12 }));
+
+    // another world on the same thread, without a recorder, is not recorded
+    // into this one
+    flecs::world other;
+    other.import<chipmunk2d>();
+    flecs::entity e = other.entity();
+    cpBody *body = cpBodyNew(1, INFINITY);
+    e.set<Body>(body);
+    e.set<Shape>(cpCircleShapeNew(body, 1, {0, 0}));
+    other.progress(1/60.0);
+    EXPECT_EQ(recorder->recording->bodies_added, 0u);
+    EXPECT_EQ(recorder->recording->observer_calls, 0u);
+}
+
+TEST(simple_struct, deterministic_lockstep) {
+    struct Result {
+        uint64_t hash;
+        std::vector<CollisionEvent> events;
+    };
+
+    // the same scene, but with components set in a different order, and
+    // frames of a different length
+    auto simulate = [](bool reversed, double frame_dt) -> Result {
+        flecs::world ecs;
+        ecs.set<Deterministic>({ 1/60.0, 0, 0, 0, {}, {}, 0, {} });
+        ecs.import<chipmunk2d_deterministic>();
+        Space &space = *ecs.get_mut<Space>();
+        cpSpaceSetGravity(space, {0, -10});
+
+        cpCollisionHandler *handler = cpSpaceAddDefaultCollisionHandler(space);
+        handler->userData = &ecs;
+        handler->beginFunc = Deterministic::begin;
+
+        std::vector<flecs::entity> entities;
+        flecs::entity ground = ecs.entity("ground");
+        for (int i = 0; i < 20; i++) {
+            entities.push_back(ecs.entity());
+        }
+        if (reversed) {
+            std::reverse(entities.begin(), entities.end());
+        }
+
+        cpBody *body = cpBodyNewStatic();
+        ground.set<Body>(body);
+        ground.set<Shape>(cpSegmentShapeNew(body, {-20, 0}, {20, 0}, 0));
+        for (flecs::entity e : entities) {
+            body = cpBodyNew(1, cpMomentForBox(1, 1, 1));
+            cpBodySetPosition(body, cpv((e.id() % 5) * 1.05,
+                        1 + (e.id() % 4) * 1.5));
+            e.set<Body>(body);
+            e.set<Shape>(cpBoxShapeNew(body, 1, 1, 0));
+        }
+
+        std::vector<CollisionEvent> events;
+        for (int i = 0; i < 60; i++) {
+            ecs.progress(frame_dt);
+            auto& frame = ecs.get<Deterministic>()->events;
+            events.insert(events.end(), frame.begin(), frame.end());
+        }
+        EXPECT_EQ(ecs.get<Deterministic>()->frame, 60u);
+        return { ecs.get<Deterministic>()->hash, events };
+    };
+
+    Result a = simulate(false, 1/60.0);
+    Result b = simulate(true, 1/30.0);
+    EXPECT_EQ(a.hash, b.hash) << "simulations diverged";
+    ASSERT_EQ(a.events.size(), b.events.size());
+    EXPECT_GT(a.events.size(), 0u);
+    for (size_t i = 0; i < a.events.size(); i++) {
+        EXPECT_EQ(a.events[i].a, b.events[i].a);
+        EXPECT_EQ(a.events[i].b, b.events[i].b);
+        EXPECT_LT(a.events[i].a, a.events[i].b);
+    }
+
+    // and the hash does notice a difference in state
+    flecs::world ecs;
+    ecs.set<Deterministic>({ 1/60.0, 0, 0, 0, {}, {}, 0, {} });
+    ecs.import<chipmunk2d_deterministic>();
+    flecs::entity e = ecs.entity();
+    cpBody *body = cpBodyNew(1, INFINITY);
+    e.set<Body>(body);
+    ecs.progress(0);
+    uint64_t before = ecs.get<Deterministic>()->state_hash;
+    cpBodySetPosition(body, {0, 1e-9});
+    ecs.progress(0);
+    EXPECT_NE(ecs.get<Deterministic>()->state_hash, before);
+
+    // static bodies are hashed incrementally, but still noticed when added,
+    // moved with StaticDirty, and removed
+    uint64_t without = ecs.get<Deterministic>()->state_hash;
+    flecs::entity wall = ecs.entity();
+    cpBody *wall_body = cpBodyNewStatic();
+    wall.set<Body>(wall_body);
+    wall.set<Shape>(cpSegmentShapeNew(wall_body, {-1, -5}, {1, -5}, 0));
+    ecs.progress(0);
+    before = ecs.get<Deterministic>()->state_hash;
+    EXPECT_NE(before, without);
+    cpBodySetPosition(wall_body, {0, -1});
+    wall.add<StaticDirty>();
+    ecs.progress(0);
+    EXPECT_NE(ecs.get<Deterministic>()->state_hash, before);
+    wall.destruct();
+    ecs.progress(0);
+    EXPECT_EQ(ecs.get<Deterministic>()->state_hash, without);
+
+    // a CompoundBody is queued for the step like a Body
+    flecs::entity crate = ecs.entity();
+    crate.set<CompoundBody>({ 1, cpMomentForBox(1, 2, 2), {
+            ShapeDef::box(2, 2),
+        } });
+    cpBody *crate_body = *crate.get<CompoundBody>();
+    EXPECT_EQ(cpBodyGetSpace(crate_body), nullptr);
+    ecs.progress(0);
+    EXPECT_NE(cpBodyGetSpace(crate_body), nullptr);
+    EXPECT_NE(ecs.get<Deterministic>()->state_hash, without);
+}
+
+TEST(simple_struct, rollback) {
+    flecs::world ecs;
+    ecs.set<RollbackConfig>({ 8, 64, 8, 64 });
+    ecs.import<chipmunk2d_rollback>();
+    Space &space = *ecs.get_mut<Space>();
+    cpSpaceSetGravity(space, {0, -10});
+
+    std::vector<flecs::entity> entities;
+    for (int i = 0; i < 10; i++) {
+        flecs::entity e = ecs.entity();
+        cpBody *body = cpBodyNew(1, cpMomentForCircle(1, 0, 0.5, cpvzero));
+        cpBodySetPosition(body, cpv(i * 2, 0));
+        cpBodySetAngularVelocity(body, i);
+        e.set<Body>(body);
+        e.set<Shape>(cpCircleShapeNew(body, 0.5, {0, 0}));
+        entities.push_back(e);
+    }
+    flecs::entity proj = ecs.entity("projectile")
+        .set<Projectile>({ {0, 100}, {10, 0}, 0.1, CP_SHAPE_FILTER_ALL });
+
+    // the state after each frame
+    auto snapshot = [&]() {
+        std::vector<cpVect> state;
+        for (auto e : entities) {
+            cpBody *body = *e.get<Body>();
+            state.push_back(cpBodyGetPosition(body));
+            state.push_back(cpBodyGetVelocity(body));
+            state.push_back(cpv(cpBodyGetAngle(body), 0));
+        }
+        state.push_back(proj.get<Projectile>()->position);
+        return state;
+    };
+    auto same = [](const std::vector<cpVect>& a,
+            const std::vector<cpVect>& b) {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < a.size(); i++) {
+            if (!cpveql(a[i], b[i])) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    std::vector<std::vector<cpVect>> history = { snapshot() };
+    for (int i = 0; i < 10; i++) {
+        ecs.progress(1/60.0);
+        history.push_back(snapshot());
+    }
+
+    Rollback *rollback = ecs.get_mut<Rollback>();
+    EXPECT_EQ(rollback->available(), 8u);
+    EXPECT_FALSE(rollback->rewind(ecs, 9)) << "rewound past the history";
+
+    ASSERT_TRUE(rollback->rewind(ecs, 4));
+    EXPECT_EQ(rollback->frame, 6u);
+    EXPECT_TRUE(same(snapshot(), history[6])) << "state not restored";
+
+    std::vector<uint64_t> hooked;
+    rollback->resimulate(ecs, 4, [&](uint64_t frame) {
+            EXPECT_TRUE(ecs.get<Rollback>()->resimulating);
+            hooked.push_back(frame);
+        });
+    EXPECT_EQ(hooked, (std::vector<uint64_t>{ 6, 7, 8, 9 }));
+    EXPECT_FALSE(rollback->resimulating);
+    EXPECT_TRUE(same(snapshot(), history[10])) << "resimulation diverged";
+
+    // a body removed since the frame rewound to is left alone
+    entities.back().destruct();
+    entities.pop_back();
+    ecs.progress(1/60.0);
+    ASSERT_TRUE(rollback->rewind(ecs, 3));
+    EXPECT_EQ(rollback->frame, 8u);
+    history[8].erase(history[8].end() - 4, history[8].end() - 1);
+    EXPECT_TRUE(same(snapshot(), history[8])) << "state not restored";
+}
+
+TEST(simple_struct, rollback_contacts) {
+    flecs::world ecs;
+    ecs.set<RollbackConfig>({ 30, 64, 0, 256 });
+    ecs.import<chipmunk2d_rollback>();
+    cpSpace *space = *ecs.get<Space>();
+    cpSpaceSetGravity(space, {0, -10});
+
+    // a settled pile: stacks of boxes, each warm-starting from its contacts
+    // every step, and none moving far enough to be reinserted in the index
+    flecs::entity ground = ecs.entity("ground");
+    cpBody *body = cpBodyNewStatic();
+    ground.set<Body>(body);
+    ground.set<Shape>(cpSegmentShapeNew(body, {-20, 0}, {20, 0}, 0));
+    std::vector<cpBody *> boxes;
+    for (int i = 0; i < 30; i++) {
+        flecs::entity e = ecs.entity();
+        body = cpBodyNew(1, cpMomentForBox(1, 1, 1));
+        cpBodySetPosition(body, cpv((i % 6) * 1.5 - 4,
+                    0.5 + (i / 6) * 1.01));
+        e.set<Body>(body);
+        e.set<Shape>(cpBoxShapeNew(body, 1, 1, 0));
+        boxes.push_back(body);
+    }
+    for (int i = 0; i < 120; i++) {
+        ecs.progress(1/60.0);
+    }
+    ASSERT_GT(space->arbiters->num, 0);
+
+    // every bit of body state, to compare the replay with
+    auto snapshot = [&]() {
+        std::vector<Rollback::BodyState> state(boxes.size());
+        for (size_t i = 0; i < boxes.size(); i++) {
+            state[i].save(boxes[i]);
+        }
+        return state;
+    };
+    auto same = [](const std::vector<Rollback::BodyState>& a,
+            const std::vector<Rollback::BodyState>& b) {
+        return memcmp(a.data(), b.data(),
+                a.size() * sizeof(Rollback::BodyState)) == 0;
+    };
+
+    Rollback *rollback = ecs.get_mut<Rollback>();
+    cpTimestamp stamp = space->stamp;
+    auto start = snapshot();
+    for (int i = 0; i < 20; i++) {
+        ecs.progress(1/60.0);
+    }
+    auto end = snapshot();
+    ASSERT_FALSE(same(start, end)) << "the pile stopped moving entirely";
+
+    ASSERT_TRUE(rollback->rewind(ecs, 20));
+    EXPECT_EQ(rollback->dropped, 0u);
+    EXPECT_EQ(space->stamp, stamp);
+    EXPECT_TRUE(same(snapshot(), start)) << "state not restored";
+    rollback->resimulate(ecs, 20, nullptr);
+    EXPECT_TRUE(same(snapshot(), end)) << "replay diverged";
+
+    // and again, from the replayed frames
+    ASSERT_TRUE(rollback->rewind(ecs, 10));
+    rollback->resimulate(ecs, 10, nullptr);
+    EXPECT_TRUE(same(snapshot(), end)) << "second replay diverged";
+}
+
+TEST(simple_struct, DISABLED_bench_rollback) {
+    spdlog::set_level(spdlog::level::info);
+
+    // a settled pile, so every frame saves & restores its arbiters along
+    // with the bodies
+    const int count = 5000, frames = 10;
+    flecs::world ecs;
+    ecs.set<RollbackConfig>({ frames, count, 0, 4 * count });
+    ecs.import<chipmunk2d_rollback>();
+    cpSpace *space = *ecs.get<Space>();
+    cpSpaceSetGravity(space, {0, -10});
+
+    flecs::entity ground = ecs.entity("ground");
+    cpBody *body = cpBodyNewStatic();
+    ground.set<Body>(body);
+    ground.set<Shape>(cpSegmentShapeNew(body, {-1, 0}, {111, 0}, 0));
+    for (int i = 0; i < count; i++) {
+        flecs::entity e = ecs.entity();
+        body = cpBodyNew(1, cpMomentForBox(1, 1, 1));
+        cpBodySetPosition(body,
+                cpv((i % 100) * 1.1, 0.5 + (i / 100) * 1.01));
+        e.set<Body>(body);
+        e.set<Shape>(cpBoxShapeNew(body, 1, 1, 0));
+    }
+    for (int i = 0; i < 180; i++) {
+        ecs.progress(1/60.0);
+    }
+    Rollback *rollback = ecs.get_mut<Rollback>();
+    ASSERT_GE(space->arbiters->num, count / 2) << "the pile fell apart";
+    ASSERT_EQ(rollback->dropped, 0u) << "increase the arbiters kept";
+
+    // sleeping is off, so every body is restored
+    std::chrono::nanoseconds rewind_time{0}, resim_time{0};
+    const int rounds = 100;
+    for (int i = 0; i < rounds; i++) {
+        auto start = std::chrono::steady_clock::now();
+        ASSERT_TRUE(rollback->rewind(ecs, 10));
+        rewind_time += std::chrono::steady_clock::now() - start;
+
+        start = std::chrono::steady_clock::now();
+        rollback->resimulate(ecs, 10, nullptr);
+        resim_time += std::chrono::steady_clock::now() - start;
+    }
+
+    log_info("{} bodies, {} arbiters: rewind {} us, resimulate 10 frames "
+            "{} us", count, space->arbiters->num,
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                rewind_time).count() / rounds,
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                resim_time).count() / rounds);
+
+    spdlog::set_level(spdlog::level::trace);
+}
+
+TEST(simple_struct, replication) {
+    ReplicationConfig config = { 1/512.0, 1/256.0, 12, 8 };
+
+    flecs::world server;
+    server.set<ReplicationConfig>(config);
+    server.import<chipmunk2d_replication>();
+    Space &space = *server.get_mut<Space>();
+    cpSpaceSetGravity(space, {0, -10});
+    cpSpaceSetSleepTimeThreshold(space, 0.5);
+
+    flecs::entity ground = server.entity("ground");
+    cpBody *body = cpBodyNewStatic();
+    ground.set<Body>(body);
+    ground.set<Shape>(cpSegmentShapeNew(body, {-20, 0}, {20, 0}, 0));
+    std::vector<flecs::entity> boxes;
+    for (int i = 0; i < 10; i++) {
+        flecs::entity e = server.entity();
+        body = cpBodyNew(1, cpMomentForBox(1, 1, 1));
+        cpBodySetPosition(body, cpv(i * 2 - 10, 1 + i * 0.25));
+        e.set<Body>(body);
+        e.set<Shape>(cpBoxShapeNew(body, 1, 1, 0));
+        boxes.push_back(e);
+    }
+    flecs::entity client = server.entity("client")
+        .set<ReplicationClient>({ 0, {} });
+
+    // the client world has no gravity; its bodies only move by replication
+    flecs::world remote;
+    remote.import<chipmunk2d>();
+    ReplicationReceiver receiver(config);
+
+    std::vector<flecs::entity_t> removed;
+    size_t first_size = 0, last_size = 0;
+    for (int frame = 0; frame < 300; frame++) {
+        if (frame == 100) {
+            boxes.back().destruct();
+            boxes.pop_back();
+        }
+        server.progress(1/60.0);
+        const std::vector<uint8_t>& packet =
+            client.get<ReplicationClient>()->packet;
+        if (frame == 0) {
+            first_size = packet.size();
+        }
+        last_size = packet.size();
+
+        // lose every third packet
+        if (frame % 3 == 2) {
+            continue;
+        }
+        ASSERT_TRUE(receiver.receive(packet.data(), packet.size()));
+        client.get_mut<ReplicationClient>()->acked = receiver.latest;
+        for (const NetBody& net : receiver.unbound) {
+            cpBody *body = cpBodyNew(1, cpMomentForBox(1, 1, 1));
+            remote.entity().set<Body>(body);
+            receiver.bodies[net.id] = body;
+            receiver.set_body(net, body);
+        }
+        removed.insert(removed.end(), receiver.removed.begin(),
+                receiver.removed.end());
+
+        for (flecs::entity box : boxes) {
+            cpVect live = cpBodyGetPosition(*box.get<Body>());
+            cpVect copy = cpBodyGetPosition(receiver.bodies.at(box.id()));
+            EXPECT_NEAR(live.x, copy.x, config.position_precision);
+            EXPECT_NEAR(live.y, copy.y, config.position_precision);
+        }
+    }
+
+    EXPECT_EQ(receiver.bodies.size(), 9u);
+    EXPECT_EQ(removed.size(), 1u);
+
+    // once everything is asleep, nothing but the header is sent
+    for (flecs::entity box : boxes) {
+        EXPECT_TRUE(cpBodyIsSleeping(*box.get<Body>()));
+    }
+    EXPECT_GT(first_size, 10 * 4u) << "first packet should hold every body";
+    EXPECT_EQ(last_size, 9u);
+
+    // a packet delta'd from a baseline the receiver never had is refused
+    ReplicationReceiver late(config);
+    const std::vector<uint8_t>& packet =
+        client.get<ReplicationClient>()->packet;
+    EXPECT_FALSE(late.receive(packet.data(), packet.size()));
+}
+
+TEST(simple_struct, replication_lod) {
+    // a body chipmunk2d_lod moved into a far band is still replicated
+    flecs::world ecs;
+    ecs.set<LodConfig>({ { 50, 100, 200 }, 1, 0 });
+    ecs.import<chipmunk2d_lod>();
+    ecs.import<chipmunk2d_replication>();
+
+    flecs::entity player = ecs.entity("player").add<Interest>();
+    cpBody *body = cpBodyNew(1, INFINITY);
+    player.set<Body>(body);
+    player.set<Shape>(cpCircleShapeNew(body, 1, {0, 0}));
+    flecs::entity crate = ecs.entity("crate");
+    cpBody *crate_body = cpBodyNew(1, INFINITY);
+    cpBodySetPosition(crate_body, {150, 0});
+    crate.set<Body>(crate_body);
+    crate.set<Shape>(cpCircleShapeNew(crate_body, 1, {0, 0}));
+
+    ecs.progress(1/60.0);
+    ASSERT_NE(cpBodyGetSpace(crate_body), ecs.get<Space>()->ptr);
+
+    const NetSnapshot& snap = ecs.get_mut<Replication>()->latest();
+    ASSERT_EQ(snap.bodies.size(), 2u);
+    EXPECT_EQ(snap.bodies[0].id, std::min(player.id(), crate.id()));
+    EXPECT_EQ(snap.bodies[1].id, std::max(player.id(), crate.id()));
+}
+
+TEST(simple_struct, DISABLED_bench_replication) {
+    spdlog::set_level(spdlog::level::info);
+
+    const int count = 5000, steps = 120;
+    ReplicationConfig config = { 1/512.0, 1/256.0, 12, 32 };
+    flecs::world ecs;
+    ecs.import<chipmunk2d>();
+    Space &space = *ecs.get_mut<Space>();
+
+    // a quarter of the bodies move; the rest are at rest
+    for (int i = 0; i < count; i++) {
+        flecs::entity e = ecs.entity();
+        cpBody *body = cpBodyNew(1, INFINITY);
+        cpBodySetPosition(body, cpv((i % 100) * 1.1, (i / 100) * 1.1));
+        if (i % 4 == 0) {
+            cpBodySetVelocity(body, cpv((i % 7) * 0.1, (i % 5) * 0.1));
+        }
+        e.set<Body>(body);
+    }
+
+    Replication replication(config);
+    std::vector<uint8_t> packet;
+    replication.capture(ecs);
+    replication.encode(0, packet);
+    size_t full = packet.size();
+
+    std::chrono::nanoseconds capture_time{0}, encode_time{0};
+    size_t delta = 0;
+    for (int i = 0; i < steps; i++) {
+        cpSpaceStep(space, 1/60.0);
+        uint32_t acked = replication.sequence;
+
+        auto start = std::chrono::steady_clock::now();
+        replication.capture(ecs);
+        capture_time += std::chrono::steady_clock::now() - start;
+
+        start = std::chrono::steady_clock::now();
+        replication.encode(acked, packet);
+        encode_time += std::chrono::steady_clock::now() - start;
+        delta += packet.size();
+    }
+
+    log_info("{} bodies; raw {} bytes/body; full {:.2f} bytes/body; "
+            "delta {:.2f} bytes/body",
+            count, sizeof(flecs::entity_t) + 6 * sizeof(cpFloat),
+            (double)full / count, (double)delta / steps / count);
+    log_info("capture {} us, encode {} us",
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                capture_time).count() / steps,
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                encode_time).count() / steps);
+
+    spdlog::set_level(spdlog::level::trace);
+}
+
+TEST(simple_struct, shm_transforms) {
+    std::string name = fmt::format("/chipmunk2d-test-{}", getpid());
+    flecs::world ecs;
+    ecs.set<ShmConfig>({ name, 256 });
+    ecs.import<chipmunk2d_shm>();
+
+    // every body moves in lockstep, so a torn frame would mix x values
+    std::vector<flecs::entity> entities;
+    for (int i = 0; i < 200; i++) {
+        flecs::entity e = ecs.entity();
+        cpBody *body = cpBodyNew(1, INFINITY);
+        cpBodySetPosition(body, cpv(0, i));
+        cpBodySetVelocity(body, cpv(1, 0));
+        e.set<Body>(body);
+        entities.push_back(e);
+    }
+
+    TransformReader reader(name.c_str());
+    ASSERT_TRUE(reader.ok());
+
+    std::atomic<bool> done{false};
+    std::atomic<int> torn{0}, reads{0};
+    std::thread thread([&]() {
+            std::vector<ShmTransform> frame;
+            while (!done) {
+                reader.read(frame);
+                for (auto& t : frame) {
+                    if (t.x != frame.front().x) {
+                        torn++;
+                        break;
+                    }
+                }
+                reads++;
+            }
+        });
+    for (int i = 0; i < 500; i++) {
+        ecs.progress(1/60.0);
+    }
+    done = true;
+    thread.join();
+    EXPECT_EQ(torn.load(), 0) << "reader saw a torn frame";
+    EXPECT_GT(reads.load(), 0);
+
+    std::vector<ShmTransform> frame;
+    EXPECT_EQ(reader.read(frame), 500u);
+    ASSERT_EQ(frame.size(), entities.size());
+
+    // read in place, and find by entity
+    uint64_t seq;
+    const ShmFrame *latest = reader.begin_read(seq);
+    for (flecs::entity e : entities) {
+        const ShmTransform *t = latest->find(e.id());
+        ASSERT_NE(t, nullptr);
+        cpVect p = cpBodyGetPosition(*e.get<Body>());
+        EXPECT_EQ(t->x, p.x);
+        EXPECT_EQ(t->y, p.y);
+    }
+    EXPECT_EQ(latest->find(0), nullptr);
+    EXPECT_TRUE(reader.end_read(latest, seq));
+
+    // a second publisher can't take the region over
+    {
+        flecs::world other;
+        other.set<ShmConfig>({ name, 256 });
+        other.import<chipmunk2d_shm>();
+        EXPECT_FALSE(other.get<TransformPublisher>()->ok());
+    }
+    EXPECT_EQ(reader.read(frame), 500u) << "region lost to a second world";
+    EXPECT_TRUE(TransformReader(name.c_str()).ok());
+
+    // a publisher that dies without cleaning up leaves the region behind,
+    // which the next one takes over
+    std::string crashed = name + "-crashed";
+    pid_t child = fork();
+    ASSERT_GE(child, 0);
+    if (child == 0) {
+        TransformPublisher publisher(crashed.c_str(), 16);
+        _exit(publisher.ok() ? 0 : 1);
+    }
+    int status;
+    ASSERT_EQ(waitpid(child, &status, 0), child);
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+    ASSERT_TRUE(TransformReader(crashed.c_str()).ok()) << "nothing left behind";
+    {
+        TransformPublisher publisher(crashed.c_str(), 32);
+        EXPECT_TRUE(publisher.ok()) << "crashed publisher's region kept";
+        EXPECT_EQ(TransformReader(crashed.c_str()).header->capacity, 32u);
+    }
+
+    // & two worlds left to name their regions get their own
+    flecs::world a, b;
+    a.import<chipmunk2d_shm>();
+    b.import<chipmunk2d_shm>();
+    EXPECT_NE(a.get<ShmConfig>()->name, b.get<ShmConfig>()->name);
+    EXPECT_TRUE(a.get<TransformPublisher>()->ok());
+    EXPECT_TRUE(b.get<TransformPublisher>()->ok());
+}
+
+TEST(simple_struct, shm_lod) {
+    // a body chipmunk2d_lod moved into a far band is still published
+    std::string name = fmt::format("/chipmunk2d-test-lod-{}", getpid());
+    flecs::world ecs;
+    ecs.set<LodConfig>({ { 50, 100, 200 }, 1, 0 });
+    ecs.import<chipmunk2d_lod>();
+    ecs.set<ShmConfig>({ name, 16 });
+    ecs.import<chipmunk2d_shm>();
+
+    flecs::entity player = ecs.entity("player").add<Interest>();
+    cpBody *body = cpBodyNew(1, INFINITY);
+    player.set<Body>(body);
+    player.set<Shape>(cpCircleShapeNew(body, 1, {0, 0}));
+    flecs::entity crate = ecs.entity("crate");
+    cpBody *crate_body = cpBodyNew(1, INFINITY);
+    cpBodySetPosition(crate_body, {150, 0});
+    crate.set<Body>(crate_body);
+    crate.set<Shape>(cpCircleShapeNew(crate_body, 1, {0, 0}));
+
+    ecs.progress(1/60.0);
+    ASSERT_NE(cpBodyGetSpace(crate_body), ecs.get<Space>()->ptr);
+
+    TransformReader reader(name.c_str());
+    ASSERT_TRUE(reader.ok());
+    uint64_t seq;
+    const ShmFrame *latest = reader.begin_read(seq);
+    EXPECT_NE(latest->find(player.id()), nullptr);
+    const ShmTransform *t = latest->find(crate.id());
+    ASSERT_NE(t, nullptr) << "far band body not published";
+    EXPECT_EQ(t->x, 150);
+    EXPECT_TRUE(reader.end_read(latest, seq));
+}
+
+TEST(simple_struct, render_buffer) {
+    flecs::world ecs;
+    ecs.set<RenderConfig>({ 256 });
+    ecs.import<chipmunk2d_render>();
+
+    // every body moves in lockstep, so a torn frame would mix x values
+    for (int i = 0; i < 200; i++) {
+        cpBody *body = cpBodyNew(1, INFINITY);
+        cpBodySetPosition(body, cpv(0, i));
+        cpBodySetVelocity(body, cpv(1, 0));
+        ecs.entity().set<Body>(body);
+    }
+
+    RenderBuffer *buffer = *ecs.get<RenderTransforms>();
+    EXPECT_EQ(buffer->read().frame, 0u) << "no frame synced yet";
+
+    std::atomic<bool> done{false};
+    std::atomic<int> torn{0}, backwards{0}, reads{0};
+    std::thread render([&]() {
+            uint64_t last = 0;
+            while (!done) {
+                const RenderFrame& frame = buffer->read();
+                for (auto& t : frame.transforms) {
+                    if (t.p.x != frame.transforms.front().p.x) {
+                        torn++;
+                        break;
+                    }
+                }
+                if (frame.frame < last) {
+                    backwards++;
+                }
+                last = frame.frame;
+                reads++;
+            }
+        });
+
+    // adding another singleton moves the component, but not the buffer
+    ecs.set<MortonConfig>({ 60, 1 });
+    for (int i = 0; i < 500; i++) {
+        ecs.progress(1/60.0);
+    }
+    done = true;
+    render.join();
+    EXPECT_EQ(torn.load(), 0) << "render thread saw a torn frame";
+    EXPECT_EQ(backwards.load(), 0) << "render thread went back a frame";
+    EXPECT_GT(reads.load(), 0);
+
+    const RenderFrame& frame = buffer->read();
+    EXPECT_EQ(frame.frame, 500u);
+    ASSERT_EQ(frame.transforms.size(), 200u);
+    EXPECT_NEAR(frame.transforms.front().p.x, 500 / 60.0, 1e-3);
+}
+
+TEST(simple_struct, render_lod) {
+    // a body chipmunk2d_lod moved into a far band is still handed over
+    flecs::world ecs;
+    ecs.set<LodConfig>({ { 50, 100, 200 }, 1, 0 });
+    ecs.import<chipmunk2d_lod>();
+    ecs.set<RenderConfig>({ 16 });
+    ecs.import<chipmunk2d_render>();
+
+    flecs::entity player = ecs.entity("player").add<Interest>();
+    cpBody *body = cpBodyNew(1, INFINITY);
+    player.set<Body>(body);
+    player.set<Shape>(cpCircleShapeNew(body, 1, {0, 0}));
+    flecs::entity crate = ecs.entity("crate");
+    cpBody *crate_body = cpBodyNew(1, INFINITY);
+    cpBodySetPosition(crate_body, {150, 0});
+    crate.set<Body>(crate_body);
+    crate.set<Shape>(cpCircleShapeNew(crate_body, 1, {0, 0}));
+
+    ecs.progress(1/60.0);
+    ASSERT_NE(cpBodyGetSpace(crate_body), ecs.get<Space>()->ptr);
+
+    RenderBuffer *buffer = *ecs.get<RenderTransforms>();
+    const RenderFrame& frame = buffer->read();
+    EXPECT_EQ(frame.frame, 1u);
+    std::vector<flecs::entity_t> ids;
+    for (const RenderTransform& t : frame.transforms) {
+        ids.push_back(t.entity);
+    }
+    std::sort(ids.begin(), ids.end());
+    EXPECT_EQ(ids, (std::vector<flecs::entity_t>{
+                std::min(player.id(), crate.id()),
+                std::max(player.id(), crate.id()) }));
+}
+
+TEST(simple_struct, async_physics) {
+    // the same pile of boxes, stepped inline & on the physics thread
+    auto simulate = [](bool async) -> std::vector<cpVect> {
+        flecs::world ecs;
+        if (async) {
+            ecs.import<chipmunk2d_async>();
+        } else {
+            ecs.import<chipmunk2d>();
+        }
+        cpSpaceSetGravity(*ecs.get_mut<Space>(), {0, -10});
+
+        flecs::entity ground = ecs.entity("ground");
+        cpBody *body = cpBodyNewStatic();
+        ground.set<Body>(body);
+        ground.set<Shape>(cpSegmentShapeNew(body, {-20, 0}, {20, 0}, 0));
+        std::vector<flecs::entity> boxes;
+        for (int i = 0; i < 20; i++) {
+            flecs::entity e = ecs.entity();
+            body = cpBodyNew(1, cpMomentForBox(1, 1, 1));
+            cpBodySetPosition(body, cpv((i % 5) * 1.05, 1 + (i / 5) * 1.5));
+            e.set<Body>(body);
+            e.set<Shape>(cpBoxShapeNew(body, 1, 1, 0));
+            boxes.push_back(e);
+        }
+
+        // gameplay spawning & destroying mid-step
+        ecs.system<>()
+            .kind(flecs::OnUpdate)
+            .iter([&boxes](flecs::iter& it) {
+                flecs::world ecs = it.world();
+                int64_t tick = ecs.get_tick();
+                if (tick == 10) {
+                    flecs::entity e = ecs.entity();
+                    cpBody *body = cpBodyNew(1, cpMomentForBox(1, 1, 1));
+                    cpBodySetPosition(body, cpv(10, 1));
+                    e.set<Body>(body);
+                    e.set<Shape>(cpBoxShapeNew(body, 1, 1, 0));
+                    boxes.push_back(e);
+                } else if (tick == 20) {
+                    boxes.front().destruct();
+                    boxes.erase(boxes.begin());
+                }
+            });
+
+        for (int i = 0; i < 60; i++) {
+            ecs.progress(1/60.0);
+        }
+
+        std::vector<cpVect> state;
+        for (flecs::entity e : boxes) {
+            if (!async) {
+                state.push_back(cpBodyGetPosition(*e.get<Body>()));
+                continue;
+            }
+            // the last step was joined & copied out at PreStore
+            const BodyTransform *transform = e.get<BodyTransform>();
+            EXPECT_NE(transform, nullptr);
+            state.push_back(transform ? transform->front.p : cpvzero);
+        }
+
+        if (async) {
+            PhysicsThread *thread = *ecs.get<AsyncPhysics>();
+            EXPECT_FALSE(thread->in_flight) << "step not joined in frame";
+            EXPECT_EQ(thread->steps, 60u);
+        }
+        for (flecs::entity e : boxes) {
+            EXPECT_EQ(cpBodyGetSpace(*e.get<Body>()), ecs.get<Space>()->ptr);
+        }
+        int count = 0;
+        cpSpaceEachBody(*ecs.get<Space>(), [](cpBody *, void *data) {
+                (*static_cast<int *>(data))++;
+            }, &count);
+        EXPECT_EQ(count, 21) << "ground, 20 boxes";
+        return state;
+    };
+
+    std::vector<cpVect> inline_state = simulate(false);
+    std::vector<cpVect> async_state = simulate(true);
+    ASSERT_EQ(inline_state.size(), async_state.size());
+    for (size_t i = 0; i < inline_state.size(); i++) {
+        EXPECT_TRUE(cpveql(inline_state[i], async_state[i]))
+            << "box " << i << " diverged";
+    }
+}
+
+TEST(simple_struct, async_remove_observers) {
+    // what another module's remove hook saw, such as chipmunk2d_rollback's,
+    // which can't be used with async
+    struct Removed {
+        std::unordered_set<void *> ptrs;
+    };
+
+    flecs::world ecs;
+    ecs.import<chipmunk2d_async>();
+    ecs.set<Removed>({});
+    PhysicsHook hook;
+    hook.remove = [](flecs::world& ecs, const PhysicsChange& change) {
+            ecs.get_mut<Removed>()->ptrs.insert(change.ptr);
+            return false;
+        };
+    chipmunk2d::hook(ecs, hook);
+
+    flecs::entity e = ecs.entity();
+    cpBody *body = cpBodyNew(1, INFINITY);
+    cpShape *shape = cpCircleShapeNew(body, 1, {0, 0});
+    e.set<Body>(body);
+    e.set<Shape>(shape);
+    ecs.progress(1/60.0);
+
+    // destroyed with a step in flight, kicked here as async_kick would; the
+    // other modules' hooks still see both
+    PhysicsThread *thread = *ecs.get<AsyncPhysics>();
+    ASSERT_FALSE(thread->in_flight);
+    thread->kick(1/60.0);
+    e.destruct();
+    EXPECT_EQ(thread->commands.size(), 2u) << "removal not queued";
+    thread->sync();
+
+    const Removed *removed = ecs.get<Removed>();
+    EXPECT_EQ(removed->ptrs.count(body), 1u);
+    EXPECT_EQ(removed->ptrs.count(shape), 1u);
+    int count = 0;
+    cpSpaceEachBody(*ecs.get<Space>(), [](cpBody *, void *data) {
+            (*static_cast<int *>(data))++;
+        }, &count);
+    EXPECT_EQ(count, 0) << "body not removed after the step";
+}
+
+TEST(simple_struct, async_overlap) {
+    // the first step blocks in a collision handler until OnUpdate has run,
+    // which it can only do if the step overlaps it
+    struct Latch {
+        std::promise<void> promise;
+        std::future<void> future;
+        bool waited;
+    } latch;
+    latch.future = latch.promise.get_future();
+    latch.waited = false;
+
+    flecs::world ecs;
+    ecs.import<chipmunk2d_async>();
+    Space &space = *ecs.get_mut<Space>();
+    cpCollisionHandler *handler = cpSpaceAddDefaultCollisionHandler(space);
+    handler->userData = &latch;
+    handler->beginFunc = [](cpArbiter *, cpSpace *, void *data) {
+            auto *latch = static_cast<Latch *>(data);
+            if (!latch->waited) {
+                latch->waited = true;
+                latch->future.wait_for(std::chrono::seconds(10));
+            }
+            return cpTrue;
+        };
+
+    // two overlapping circles, so begin runs in the first step
+    for (int i = 0; i < 2; i++) {
+        flecs::entity e = ecs.entity();
+        cpBody *body = cpBodyNew(1, cpMomentForCircle(1, 0, 1, cpvzero));
+        cpBodySetPosition(body, cpv(i * 0.5, 0));
+        e.set<Body>(body);
+        e.set<Shape>(cpCircleShapeNew(body, 1, cpvzero));
+    }
+
+    struct Seen {
+        bool pending;
+        bool in_flight;
+        int frames;
+    } seen = { false, false, 0 };
+    ecs.system<>()
+        .kind(flecs::OnUpdate)
+        .iter([&seen, &latch](flecs::iter& it) {
+                PhysicsThread *thread = *it.world().get<AsyncPhysics>();
+                if (seen.frames++ == 0) {
+                    std::lock_guard<std::mutex> lock(thread->mutex);
+                    seen.pending = thread->pending;
+                    seen.in_flight = thread->in_flight;
+                    latch.promise.set_value();
+                }
+            });
+
+    ecs.progress(1/60.0);
+    EXPECT_EQ(seen.frames, 1);
+    EXPECT_TRUE(seen.in_flight) << "step not kicked before OnUpdate";
+    EXPECT_TRUE(seen.pending) << "step finished before OnUpdate ran";
+
+    PhysicsThread *thread = *ecs.get<AsyncPhysics>();
+    EXPECT_TRUE(latch.waited) << "circles didn't collide in the first step";
+    EXPECT_FALSE(thread->in_flight) << "step not joined by the frame's end";
+    EXPECT_EQ(thread->steps, 1u);
+}
+
+TEST(simple_struct, async_unsupported) {
+    // modules that use the space while the step is in flight abort, imported
+    // before or after; the message goes to the log, on stdout
+    EXPECT_DEATH({
+            flecs::world ecs;
+            ecs.import<chipmunk2d_async>();
+            ecs.import<chipmunk2d_lod>();
+        }, "");
+    EXPECT_DEATH({
+            flecs::world ecs;
+            ecs.import<chipmunk2d_rollback>();
+            ecs.import<chipmunk2d_async>();
+        }, "");
+    EXPECT_DEATH({
+            flecs::world ecs;
+            ecs.import<chipmunk2d_async>();
+            ecs.entity().set<FastMoving>({ CCD_Clamp, cpvzero });
+        }, "");
+}
+
+TEST(simple_struct, command_queue) {
+    struct Hit {};
+    struct Marked {};
+
+    flecs::world ecs;
+    ecs.import<chipmunk2d_commands>();
+    Space &space = *ecs.get_mut<Space>();
+    cpSpaceSetGravity(space, {0, -10});
+    WorldCommandQueue *queue = *ecs.get<WorldCommands>();
+
+    // ids are looked up before the step
+    struct Context {
+        WorldCommandQueue *queue;
+        flecs::entity_t collision, hit, body;
+        int begins;
+    } context = { queue, ecs.component<Collision>(), ecs.component<Hit>(),
+        ecs.component<Body>(), 0 };
+
+    cpCollisionHandler *handler = cpSpaceAddDefaultCollisionHandler(space);
+    handler->userData = &context;
+    handler->beginFunc = [](cpArbiter *arb, cpSpace *,
+            cpDataPointer data) -> cpBool {
+        auto *context = static_cast<Context *>(data);
+        cpBody *a, *b;
+        cpArbiterGetBodies(arb, &a, &b);
+        auto id_a = (flecs::entity_t)(uintptr_t)cpBodyGetUserData(a);
+        auto id_b = (flecs::entity_t)(uintptr_t)cpBodyGetUserData(b);
+        context->queue->add(id_a, context->collision, id_b);
+        context->queue->add(id_b, context->collision, id_a);
+        context->queue->emit(id_a, context->hit, context->body);
+        context->begins++;
+        return cpTrue;
+    };
+
+    int hits = 0;
+    ecs.observer<Body>()
+        .event<Hit>()
+        .each([&hits](flecs::entity, Body&) { hits++; });
+
+    flecs::entity ground = ecs.entity("ground");
+    cpBody *body = cpBodyNewStatic();
+    ground.set<Body>(body);
+    ground.set<Shape>(cpSegmentShapeNew(body, {-20, 0}, {20, 0}, 0));
+    flecs::entity ball = ecs.entity("ball");
+    body = cpBodyNew(1, cpMomentForCircle(1, 0, 0.5, cpvzero));
+    cpBodySetPosition(body, {0, 2});
+    ball.set<Body>(body);
+    ball.set<Shape>(cpCircleShapeNew(body, 0.5, {0, 0}));
+
+    for (int i = 0; i < 60 && !ball.has<Collision>(ground); i++) {
+        ecs.progress(1/60.0);
+    }
+    EXPECT_TRUE(ball.has<Collision>(ground));
+    EXPECT_TRUE(ground.has<Collision>(ball));
+    EXPECT_GT(context.begins, 0);
+    EXPECT_EQ(hits, context.begins);
+
+    // impulses are applied to the entity's body on drain
+    cpBodySetVelocity(body, cpvzero);
+    queue->impulse(ball, cpv(0, 5), cpBodyGetPosition(body));
+    EXPECT_EQ(queue->drain(ecs), 1u);
+    EXPECT_TRUE(cpveql(cpBodyGetVelocity(body), cpv(0, 5)));
+
+    // many threads pushing at once, as cpHastySpace workers would
+    const int threads = 8, per_thread = 1000;
+    std::vector<flecs::entity> entities;
+    for (int i = 0; i < threads * per_thread; i++) {
+        entities.push_back(ecs.entity());
+    }
+    flecs::entity_t marked = ecs.component<Marked>();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+                for (int i = 0; i < per_thread; i++) {
+                    queue->add(entities[t * per_thread + i], marked);
+                }
+            });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    EXPECT_EQ(queue->drain(ecs), (size_t)(threads * per_thread));
+    for (flecs::entity e : entities) {
+        EXPECT_TRUE(e.has<Marked>());
+    }
+
+    // destroyed in bulk
+    for (flecs::entity e : entities) {
+        queue->destroy(e);
+    }
+    EXPECT_EQ(queue->drain(ecs), entities.size());
+    for (flecs::entity e : entities) {
+        EXPECT_FALSE(e.is_alive());
+    }
+    EXPECT_EQ(queue->drain(ecs), 0u);
+
+    // commands for dead entities are skipped, and not counted
+    queue->add(entities[0], marked);
+    queue->destroy(entities[1]);
+    queue->add(ball, marked);
+    EXPECT_EQ(queue->drain(ecs), 1u);
+    EXPECT_TRUE(ball.has<Marked>());
+
+    // as are commands for an entity destroyed earlier in the same drain,
+    // though it's still alive until the drain ends
+    flecs::entity doomed = ecs.entity();
+    queue->destroy(doomed);
+    queue->add(doomed, marked);
+    queue->impulse(ball, cpv(0, 5), cpBodyGetPosition(body));
+    queue->destroy(ball);
+    queue->impulse(ball, cpv(0, 5), cpBodyGetPosition(body));
+    EXPECT_EQ(queue->drain(ecs), 2u);
+    EXPECT_FALSE(doomed.is_alive());
+    EXPECT_FALSE(ball.is_alive());
+}
+
+TEST(simple_struct, command_queue_in_frame) {
+    struct Hit {};
+
+    // drained by step_space's post_step hook, inside the frame, where the
+    // world is already deferred
+    flecs::world ecs;
+    ecs.import<chipmunk2d_commands>();
+    Space &space = *ecs.get_mut<Space>();
+
+    flecs::entity a = ecs.entity("a"), b = ecs.entity("b");
+    cpBody *body_a = cpBodyNew(1, cpMomentForCircle(1, 0, 0.5, cpvzero));
+    cpBody *body_b = cpBodyNew(1, cpMomentForCircle(1, 0, 0.5, cpvzero));
+    cpBodySetPosition(body_b, {0.5, 0});
+    a.set<Body>(body_a);
+    a.set<Shape>(cpCircleShapeNew(body_a, 0.5, {0, 0}));
+    b.set<Body>(body_b);
+    b.set<Shape>(cpCircleShapeNew(body_b, 0.5, {0, 0}));
+
+    struct Context {
+        WorldCommandQueue *queue;
+        flecs::entity_t a, b, hit;
+    } context = { *ecs.get<WorldCommands>(), a, b, ecs.component<Hit>() };
+
+    // the collision is ignored, so only the impulses move the bodies
+    cpCollisionHandler *handler = cpSpaceAddDefaultCollisionHandler(space);
+    handler->userData = &context;
+    handler->beginFunc = [](cpArbiter *, cpSpace *,
+            cpDataPointer data) -> cpBool {
+        auto *context = static_cast<Context *>(data);
+        context->queue->impulse(context->b, cpv(1, 0), cpvzero);
+        context->queue->destroy(context->b);
+        context->queue->add(context->b, context->hit);
+        context->queue->add(context->a, context->hit);
+        context->queue->impulse(context->a, cpv(1, 0), cpvzero);
+        return cpFalse;
+    };
+
+    // b's velocity as its body leaves the space, at the merge after the
+    // drain
+    struct Removed {
+        cpVect velocity;
+        int bodies;
+    };
+    ecs.set<Removed>({ cpvzero, 0 });
+    PhysicsHook hook;
+    hook.remove = [](flecs::world& ecs, const PhysicsChange& change) {
+            if (change.kind == Physics_Body) {
+                Removed *removed = ecs.get_mut<Removed>();
+                removed->velocity = cpBodyGetVelocity((cpBody *)change.ptr);
+                removed->bodies++;
+            }
+            return false;
+        };
+    chipmunk2d::hook(ecs, hook);
+
+    ecs.progress(1/60.0);
+    EXPECT_TRUE(a.has<Hit>());
+    EXPECT_TRUE(cpveql(cpBodyGetVelocity(body_a), cpv(1, 0)));
+    EXPECT_FALSE(b.is_alive());
+    const Removed *removed = ecs.get<Removed>();
+    EXPECT_EQ(removed->bodies, 1);
+    EXPECT_TRUE(cpveql(removed->velocity, cpvzero))
+        << "impulse applied to a body destroyed in the same drain";
+}
+
+TEST(simple_struct, world_scheduler) {
+    // matches of different sizes
+    std::vector<std::unique_ptr<flecs::world>> worlds;
+    WorldScheduler scheduler(4, 1000);
+    for (int i = 0; i < 12; i++) {
+        auto ecs = std::make_unique<flecs::world>();
+        ecs->import<chipmunk2d>();
+        cpSpaceSetGravity(*ecs->get_mut<Space>(), {0, -10});
+        for (int j = 0; j < (i + 1) * 20; j++) {
+            cpBody *body = cpBodyNew(1, INFINITY);
+            cpBodySetPosition(body, cpv(j * 1.1, 0));
+            ecs->entity().set<Body>(body);
+        }
+        EXPECT_EQ(scheduler.add(ecs.get()), (size_t)i);
+        worlds.push_back(std::move(ecs));
+    }
+
+    for (int i = 0; i < 30; i++) {
+        scheduler.step(1/60.0);
+    }
+    for (size_t i = 0; i < worlds.size(); i++) {
+        const WorldStats& stats = scheduler.stats(i);
+        EXPECT_EQ(stats.frames, 30u);
+        EXPECT_EQ(stats.overruns, 0u);
+        EXPECT_GE(stats.worker, 0);
+        EXPECT_LT(stats.worker, 4);
+
+        // every world stepped once per frame
+        worlds[i]->each([](flecs::entity, Body& body) {
+                EXPECT_NEAR(cpBodyGetVelocity(body).y, -10 * 30 / 60.0, 1e-3);
+            });
+    }
+    EXPECT_TRUE(scheduler.overran().empty());
+
+    // and with no time to spare, every world is reported over budget
+    WorldScheduler strict(2, 0);
+    for (auto& ecs : worlds) {
+        strict.add(ecs.get());
+    }
+    strict.step(1/60.0);
+    EXPECT_EQ(strict.overran().size(), worlds.size());
+
+    // where the systems of worlds on different workers wait for each other,
+    // so which worker runs what doesn't depend on timing; each arrival
+    // waits, for at most 10 s, until `count` have arrived
+    struct Latch {
+        std::mutex mutex;
+        std::condition_variable cv;
+        int count;
+        int arrived = 0;
+        uint64_t round = 0;     // times all `count` arrived
+        bool timed_out = false;
+
+        void arrive() {
+            std::unique_lock<std::mutex> lock(mutex);
+            uint64_t mine = round;
+            if (++arrived == count) {
+                arrived = 0;
+                round++;
+                cv.notify_all();
+                return;
+            }
+            timed_out |= !cv.wait_for(lock, std::chrono::seconds(10),
+                    [&]() { return round != mine; });
+        }
+    };
+    auto latched = [](Latch *latch) {
+        auto ecs = std::make_unique<flecs::world>();
+        ecs->system<>()
+            .iter([latch](flecs::iter&) {
+                    if (latch) {
+                        latch->arrive();
+                    }
+                });
+        return ecs;
+    };
+
+    // two worlds that must run at the same time each take a worker, and
+    // stay on it from frame to frame
+    Latch both;
+    both.count = 2;
+    std::vector<std::unique_ptr<flecs::world>> pinned;
+    pinned.push_back(latched(&both));
+    pinned.push_back(latched(&both));
+    WorldScheduler pair(2, 1000);
+    pair.add(pinned[0].get());
+    pair.add(pinned[1].get());
+    // the first step has no costs to deal by, so deals both to one worker,
+    // and the other steals one
+    pair.step(1/60.0);
+    int first = pair.stats(0).worker;
+    EXPECT_NE(pair.stats(1).worker, first);
+    for (int i = 0; i < 10; i++) {
+        pair.step(1/60.0);
+        EXPECT_EQ(pair.stats(0).worker, first);
+        EXPECT_NE(pair.stats(1).worker, first);
+    }
+    EXPECT_FALSE(both.timed_out);
+
+    // with costs of 10, 9, 2 & 1, worker 0 is dealt worlds 0 & 3, and
+    // worker 1 worlds 1 & 2.  World 0 waits for world 3, which is queued
+    // behind it, so worker 1 must steal world 3 once done with its own.
+    Latch behind;
+    behind.count = 2;
+    std::vector<std::unique_ptr<flecs::world>> dealt;
+    dealt.push_back(latched(&behind));
+    dealt.push_back(latched(nullptr));
+    dealt.push_back(latched(nullptr));
+    dealt.push_back(latched(&behind));
+    WorldScheduler stealing(2, 1000);
+    const double costs[] = { 10, 9, 2, 1 };
+    for (size_t i = 0; i < dealt.size(); i++) {
+        stealing.add(dealt[i].get());
+        stealing.entries[i].stats.cost_ms = costs[i];
+    }
+    stealing.step(1/60.0);
+    EXPECT_FALSE(behind.timed_out) << "world 3 was not stolen";
+    EXPECT_EQ(stealing.steals(), 1u);
+    EXPECT_EQ(stealing.stats(0).worker, 0);
+    EXPECT_EQ(stealing.stats(1).worker, 1);
+    EXPECT_EQ(stealing.stats(2).worker, 1);
+    EXPECT_EQ(stealing.stats(3).worker, 1);
+}
+
+TEST(simple_struct, DISABLED_bench_world_scheduler) {
+    spdlog::set_level(spdlog::level::info);
+
+    const int count = 64, bodies = 2000, steps = 120;
+    const double budget_ms = 1000 / 60.0;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // 64 matches of at least `bodies` boxes piling up, up to half again as
+    // many in the last; each arm gets its own, so both time the same piles
+    // from the start
+    auto build = [&]() {
+        std::vector<std::unique_ptr<flecs::world>> worlds;
+        for (int i = 0; i < count; i++) {
+            auto ecs = std::make_unique<flecs::world>();
+            ecs->import<chipmunk2d>();
+            Space &space = *ecs->get_mut<Space>();
+            cpSpaceSetGravity(space, {0, -10});
+            flecs::entity ground = ecs->entity("ground");
+            cpBody *body = cpBodyNewStatic();
+            ground.set<Body>(body);
+            ground.set<Shape>(cpSegmentShapeNew(body, {-100, 0}, {100, 0},
+                        0));
+            int n = bodies + (bodies * i) / (2 * count);
+            for (int j = 0; j < n; j++) {
+                flecs::entity e = ecs->entity();
+                body = cpBodyNew(1, cpMomentForBox(1, 1, 1));
+                cpBodySetPosition(body, cpv((j % 150) * 1.2 - 90,
+                            1 + (j / 150) * 1.2));
+                e.set<Body>(body);
+                e.set<Shape>(cpBoxShapeNew(body, 1, 1, 0));
+            }
+            worlds.push_back(std::move(ecs));
+        }
+        return worlds;
+    };
+
+    auto worlds = build();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < steps; i++) {
+        for (auto& ecs : worlds) {
+            ecs->progress(1/60.0);
+        }
+    }
+    auto serial = std::chrono::steady_clock::now() - start;
+
+    worlds = build();
+    WorldScheduler scheduler(threads, budget_ms);
+    for (auto& ecs : worlds) {
+        scheduler.add(ecs.get());
+    }
+    uint64_t overruns = 0;
+    double worst = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < steps; i++) {
+        auto frame_start = std::chrono::steady_clock::now();
+        scheduler.step(1/60.0);
+        worst = std::max(worst, std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - frame_start).count());
+        overruns += scheduler.overran().size();
+    }
+    auto pooled = std::chrono::steady_clock::now() - start;
+
+    log_info("{} worlds, {} threads: serial {:.2f} ms/frame; "
+            "scheduled {:.2f} ms/frame, worst {:.2f} ms; {} steals; "
+            "{} world frames over {:.1f} ms",
+            count, threads,
+            std::chrono::duration<double, std::milli>(serial).count() / steps,
+            std::chrono::duration<double, std::milli>(pooled).count() / steps,
+            worst, scheduler.steals(), overruns, budget_ms);
+
+    spdlog::set_level(spdlog::level::trace);
+}
+
+/// agents dropped into an arena of boxes on the ground, for Rollout
+static std::vector<flecs::entity>
+rollout_arena(flecs::world& ecs, int)
+{
+    Space &space = *ecs.get_mut<Space>();
+    cpSpaceSetGravity(space, {0, -10});
+    flecs::entity ground = ecs.entity("ground");
+    cpBody *static_body = cpBodyNewStatic();
+    ground.set<Body>(static_body);
+    ground.set<Shape>(cpSegmentShapeNew(static_body, {-20, 0}, {20, 0}, 0));
+    for (int i = 0; i < 16; i++) {
+        cpBody *body = cpBodyNew(1, cpMomentForBox(1, 1, 1));
+        cpBodySetPosition(body, cpv(i * 2 - 16, 0.5));
+        flecs::entity e = ecs.entity();
+        e.set<Body>(body);
+        e.set<Shape>(cpBoxShapeNew(body, 1, 1, 0));
+    }
+    std::vector<flecs::entity> agents;
+    for (int i = 0; i < 8; i++) {
+        cpBody *body = cpBodyNew(1, cpMomentForCircle(1, 0, 0.4, cpvzero));
+        cpBodySetPosition(body, cpv(i * 4 - 14, 3));
+        flecs::entity e = ecs.entity();
+        e.set<Body>(body);
+        e.set<Shape>(cpCircleShapeNew(body, 0.4, {0, 0}));
+        agents.push_back(e);
+    }
+    return agents;
+}
+
+TEST(simple_struct, rollout) {
+    const int envs = 8, agents = 8, steps = 90;
+    Rollout rollout(envs, agents, 4, rollout_arena);
+    std::vector<float> initial = rollout.observations;
+    EXPECT_EQ(initial[1 * agents * ROLLOUT_OBS + ROLLOUT_OBS], -10.0f)
+        << "x of env 1, agent 1";
+
+    // push the agents apart, harder in each environment, so they land on
+    // the boxes & the ground and shove the boxes into each other
+    for (int env = 0; env < envs; env++) {
+        for (int agent = 0; agent < agents; agent++) {
+            float *action = &rollout.actions[
+                (env * agents + agent) * ROLLOUT_ACT];
+            action[0] = (agent % 2 ? 1 : -1) * (env + 1) * 0.5f;
+            action[1] = 0;
+        }
+    }
+    for (int i = 0; i < steps; i++) {
+        rollout.step(1/60.0);
+    }
+    std::vector<float> episode = rollout.observations;
+    for (int env = 0; env < envs; env++) {
+        cpSpace *space = *rollout.envs[env].world->get<Space>();
+        EXPECT_GT(space->arbiters->num, agents) << "env " << env;
+        for (int agent = 0; agent < agents; agent++) {
+            const float *obs = &episode[(env * agents + agent) * ROLLOUT_OBS];
+            EXPECT_GT(obs[1], 0.3) << "agent below the ground";
+            EXPECT_LT(obs[1], 3.0) << "agent didn't fall";
+        }
+    }
+
+    // one environment reset in place; the rest carry on
+    flecs::world *world = rollout.envs[3].world.get();
+    cpSpace *space = *world->get<Space>();
+    rollout.reset(3);
+    EXPECT_EQ(world->get<Space>()->ptr, space) << "space reallocated";
+    EXPECT_EQ(rollout.envs[3].steps, 0u);
+    for (int i = 0; i < agents * ROLLOUT_OBS; i++) {
+        size_t at = 3 * agents * ROLLOUT_OBS + i;
+        EXPECT_EQ(rollout.observations[at], initial[at]);
+        at = 4 * agents * ROLLOUT_OBS + i;
+        EXPECT_EQ(rollout.observations[at], episode[at]);
+    }
+
+    // a second episode plays out just as the first did
+    for (int env = 0; env < envs; env++) {
+        rollout.reset(env);
+    }
+    EXPECT_EQ(rollout.observations, initial);
+    for (int i = 0; i < steps; i++) {
+        rollout.step(1/60.0);
+    }
+    EXPECT_EQ(rollout.observations, episode);
+}
+
+TEST(simple_struct, DISABLED_bench_rollout) {
+    spdlog::set_level(spdlog::level::info);
+
+    const int envs = 64, agents = 8, steps = 200;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+
+    auto start = std::chrono::steady_clock::now();
+    Rollout rollout(envs, agents, threads, rollout_arena);
+    auto built = std::chrono::steady_clock::now() - start;
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> force(-20, 20);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < steps; i++) {
+        for (float& action : rollout.actions) {
+            action = force(rng);
+        }
+        rollout.step(1/60.0);
+    }
+    auto stepped = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int env = 0; env < envs; env++) {
+        rollout.reset(env);
+    }
+    auto reset = std::chrono::steady_clock::now() - start;
+
+    log_info("{} envs x {} agents, {} threads: {:.0f} env steps/s; "
+            "reset {:.1f} us/env, vs {:.1f} us/env to build",
+            envs, agents, threads,
+            envs * steps / std::chrono::duration<double>(stepped).count(),
+            std::chrono::duration<double, std::micro>(reset).count() / envs,
+            std::chrono::duration<double, std::micro>(built).count() / envs);
+
+    spdlog::set_level(spdlog::level::trace);
+}
+
+TEST(simple_struct, reset) {
+    flecs::world ecs;
+    ecs.import<chipmunk2d_tilemap>();
+    cpSpace *space = *ecs.get<Space>();
+    cpSpaceSetGravity(space, {0, -10});
+    cpSpaceSetSleepTimeThreshold(space, 0.5);
+    chipmunk2d::reserve(ecs, 256, 256, 2048, 1024);
+    int pooled = space->pooledArbiters->num;
+
+    int contacts = 0;
+    cpCollisionHandler *handler = cpSpaceAddDefaultCollisionHandler(space);
+    handler->userData = &contacts;
+    handler->beginFunc = [](cpArbiter *, cpSpace *,
+                            cpDataPointer data) -> cpBool {
+        (*static_cast<int *>(data))++;
+        return true;
+    };
+
+    // added to the space without an entity; reset() leaves it alone
+    cpBody *static_body = cpSpaceGetStaticBody(space);
+    cpShape *rail = cpSpaceAddShape(space,
+            cpSegmentShapeNew(static_body, {-50, -5}, {50, -5}, 0));
+
+    // a match: ground, a wall on the space's static body, a pile of boxes,
+    // some crates dropped on top, and a tile off to the side
+    auto play = [&]() {
+        flecs::entity ground = ecs.entity();
+        cpBody *body = cpBodyNewStatic();
+        ground.set<Body>(body);
+        ground.set<Shape>(cpSegmentShapeNew(body, {-50, 0}, {50, 0}, 0));
+        ecs.entity().set<Shape>(cpSegmentShapeNew(static_body, {-9, 0},
+                    {-9, 20}, 0));
+        for (int i = 0; i < 100; i++) {
+            flecs::entity e = ecs.entity();
+            body = cpBodyNew(1, cpMomentForBox(1, 1, 1));
+            cpBodySetPosition(body, cpv((i % 10) * 1.5 - 7.5,
+                        1 + (i / 10) * 1.1));
+            e.set<Body>(body);
+            e.set<Shape>(cpBoxShapeNew(body, 1, 1, 0));
+        }
+        for (int i = 0; i < 4; i++) {
+            flecs::entity crate = ecs.entity();
+            crate.set<CompoundBody>({ 1, cpMomentForBox(1, 2, 2), {
+                    ShapeDef::box(2, 2),
+                    ShapeDef::circle(0.5, {0, 1.5}),
+                } });
+            cpBodySetPosition(crate.get<CompoundBody>()->body,
+                    cpv(i * 3 - 4.5, 14));
+        }
+        Tilemap map(24, 4, 1, TM_Boxes, 8);
+        map.set(20, 0, true);
+        ecs.entity().set<Tilemap>(std::move(map));
+    };
+    auto step = [space]() {
+        for (int i = 0; i < 180; i++) {
+            cpSpaceStep(space, 1/60.0);
+        }
+    };
+
+    play();
+
+    // constraints added without an entity, between two boxes and between a
+    // box & the space's static body; reset() takes them out of the space,
+    // but they are still ours to free
+    std::vector<cpBody *> boxes;
+    ecs.each([&](Body& body) {
+            if (cpBodyGetType(body.ptr) == CP_BODY_TYPE_DYNAMIC) {
+                boxes.push_back(body.ptr);
+            }
+        });
+    cpConstraint *pin = cpSpaceAddConstraint(space,
+            cpPinJointNew(boxes[0], boxes[1], cpvzero, cpvzero));
+    cpConstraint *pivot = cpSpaceAddConstraint(space,
+            cpPivotJointNew(static_body, boxes[2],
+                cpBodyGetPosition(boxes[2])));
+
+    step();
+    EXPECT_GT(contacts, 0);
+    EXPECT_GT(space->arbiters->num, 0);
+
+    // the bodies & shapes are taken out in bulk, not one at a time
+    static int removes;
+    removes = 0;
+    PhysicsHook hook;
+    hook.remove = [](flecs::world&, const PhysicsChange&) {
+            removes++;
+            return false;
+        };
+    chipmunk2d::hook(ecs, hook);
+
+    chipmunk2d::reset(ecs);
+    EXPECT_EQ(removes, 0) << "observers ran during reset()";
+    EXPECT_EQ(ecs.count<Body>(), 0);
+    EXPECT_EQ(ecs.count<Shape>(), 0);
+    EXPECT_EQ(ecs.count<CompoundBody>(), 0);
+    EXPECT_EQ(ecs.count<Tilemap>(), 0);
+    EXPECT_EQ(ecs.get<Space>()->ptr, space);
+    EXPECT_EQ(space->dynamicBodies->num, 0);
+    EXPECT_EQ(space->staticBodies->num, 0);
+    EXPECT_EQ(space->sleepingComponents->num, 0);
+    EXPECT_EQ(space->arbiters->num, 0);
+    EXPECT_EQ(space->pooledArbiters->num, pooled)
+        << "arbiters not returned to the pool";
+
+    // the wall was unlinked from the static body, the rail was not
+    EXPECT_TRUE(cpSpaceContainsShape(space, rail));
+    EXPECT_EQ(static_body->shapeList, rail);
+    EXPECT_EQ(rail->next, nullptr);
+    EXPECT_EQ(static_body->arbiterList, nullptr);
+
+    EXPECT_FALSE(cpSpaceContainsConstraint(space, pin));
+    EXPECT_FALSE(cpSpaceContainsConstraint(space, pivot));
+    EXPECT_EQ(space->constraints->num, 0);
+    EXPECT_EQ(static_body->constraintList, nullptr);
+    cpConstraintFree(pin);
+    cpConstraintFree(pivot);
+
+    // the next match runs with the same handler, on the same buffers
+    contacts = 0;
+    play();
+#ifdef ALLOC_TRACKING
+    uint64_t start = alloc_count();
+    step();
+    EXPECT_EQ(alloc_count() - start, 0u) << "steps allocated after reset()";
+#else
+    step();
+#endif
+    EXPECT_GT(contacts, 0) << "collision handler lost";
+
+    chipmunk2d::reset(ecs);
+    cpSpaceRemoveShape(space, rail);
+    cpShapeFree(rail);
+}
+
+TEST(simple_struct, DISABLED_bench_reset) {
+    spdlog::set_level(spdlog::level::info);
+
+    // a settled level of 4000 boxes, cleared three ways
+    const int count = 4000;
+    auto fill = [](flecs::world& ecs) {
+        Space &space = *ecs.get_mut<Space>();
+        cpSpaceSetGravity(space, {0, -10});
+        flecs::entity ground = ecs.entity();
+        cpBody *body = cpBodyNewStatic();
+        ground.set<Body>(body);
+        ground.set<Shape>(cpSegmentShapeNew(body, {-200, 0}, {200, 0}, 0));
+        for (int i = 0; i < count; i++) {
+            flecs::entity e = ecs.entity();
+            body = cpBodyNew(1, cpMomentForBox(1, 1, 1));
+            cpBodySetPosition(body, cpv((i % 200) * 1.5 - 150,
+                        1 + (i / 200) * 1.1));
+            e.set<Body>(body);
+            e.set<Shape>(cpBoxShapeNew(body, 1, 1, 0));
+        }
+        for (int i = 0; i < 30; i++) {
+            cpSpaceStep(space, 1/60.0);
+        }
+    };
+    using ms = std::chrono::duration<double, std::milli>;
+
+    flecs::world ecs;
+    ecs.import<chipmunk2d>();
+    fill(ecs);
+    auto start = std::chrono::steady_clock::now();
+    chipmunk2d::reset(ecs);
+    ms reset = std::chrono::steady_clock::now() - start;
+
+    fill(ecs);
+    start = std::chrono::steady_clock::now();
+    ecs.delete_with<Body>();
+    ecs.delete_with<Shape>();
+    ms deleted = std::chrono::steady_clock::now() - start;
+
+    auto rebuilt = std::make_unique<flecs::world>();
+    rebuilt->import<chipmunk2d>();
+    fill(*rebuilt);
+    start = std::chrono::steady_clock::now();
+    rebuilt = std::make_unique<flecs::world>();
+    rebuilt->import<chipmunk2d>();
+    ms rebuild = std::chrono::steady_clock::now() - start;
+
+    log_info("clear {} bodies: reset {:.2f} ms, delete_with {:.2f} ms, "
+            "new world {:.2f} ms",
+            count, reset.count(), deleted.count(), rebuild.count());
+
+    spdlog::set_level(spdlog::level::trace);
+}
@@ -0,0 +1,144 @@
+#include "trace.hpp"
+
+#ifdef TRACING
+
+#include <atomic>
+#include <cstdio>
+
+#include "common.hpp"
+
+/// one complete event
+struct TraceEvent {
+    const char *name;
+    uint64_t start;
+    uint64_t end;
+};
+
+/// ring of events written by a single thread
+///
+/// The owning thread writes the next slot, then publishes it by bumping
+/// `head`.  Readers take `head`, and read back at most `size` events from
+/// it; if the writer laps them mid-dump, the oldest events may be torn,
+/// which is acceptable for a diagnostic trace.
+struct TraceBuffer {
+    static constexpr uint64_t size = 1 << 16;
+
+    TraceEvent events[size];
+    std::atomic<uint64_t> head{0};      // events ever written
+    std::atomic<uint64_t> cleared{0};   // head at the last trace_clear()
+    std::atomic<bool> owned{true};      // a live thread is writing it
+    int tid;
+    TraceBuffer *next;
+};
+
+// every buffer ever created; only ever pushed to, so it needs no lock.
+// Buffers are never freed, so their events can still be dumped after their
+// thread exits; instead the next new thread takes over an unowned buffer,
+// keeping the list as long as the most threads ever tracing at once.
+static std::atomic<TraceBuffer *> buffers{nullptr};
+static std::atomic<int> next_tid{1};
+
+/// releases this thread's buffer when the thread exits
+struct LocalBuffer {
+    TraceBuffer *buffer = nullptr;
+
+    ~LocalBuffer() {
+        if (buffer) {
+            buffer->owned.store(false, std::memory_order_release);
+            buffer = nullptr;
+        }
+    }
+};
+static thread_local LocalBuffer local;
+
+static TraceBuffer *
+thread_buffer(void)
+{
+    if (local.buffer) {
+        return local.buffer;
+    }
+
+    // reuse an exited thread's buffer, and its tid; its events stay in the
+    // ring until overwritten
+    for (TraceBuffer *buffer = buffers.load(std::memory_order_acquire);
+            buffer;
+            buffer = buffer->next) {
+        bool owned = false;
+        if (buffer->owned.compare_exchange_strong(owned, true,
+                    std::memory_order_acquire,
+                    std::memory_order_relaxed)) {
+            return local.buffer = buffer;
+        }
+    }
+
+    TraceBuffer *buffer = new TraceBuffer();
+    buffer->tid = next_tid++;
+    buffer->next = buffers.load(std::memory_order_relaxed);
+    while (!buffers.compare_exchange_weak(buffer->next, buffer,
+                std::memory_order_release,
+                std::memory_order_relaxed));
+    return local.buffer = buffer;
+}
+
+void
+trace_event(const char *name, uint64_t start, uint64_t end)
+{
+    TraceBuffer *buffer = thread_buffer();
+    uint64_t head = buffer->head.load(std::memory_order_relaxed);
+    buffer->events[head % TraceBuffer::size] = { name, start, end };
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+bool
+trace_dump(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        log_errno("failed to open trace file {}", path);
+        return false;
+    }
+
+    fprintf(file, "{\"traceEvents\":[");
+    bool first = true;
+    for (TraceBuffer *buffer = buffers.load(std::memory_order_acquire);
+            buffer;
+            buffer = buffer->next) {
+        uint64_t head = buffer->head.load(std::memory_order_acquire);
+        uint64_t tail = buffer->cleared.load(std::memory_order_relaxed);
+        if (head - tail > TraceBuffer::size) {
+            tail = head - TraceBuffer::size;
+        }
+        for (uint64_t i = tail; i < head; i++) {
+            const TraceEvent &event = buffer->events[i % TraceBuffer::size];
+            fprintf(file,
+                    "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                    "\"ts\":%.3f,\"dur\":%.3f}",
+                    first ? "" : ",",
+                    event.name,
+                    buffer->tid,
+                    event.start / 1000.0,
+                    (event.end - event.start) / 1000.0);
+            first = false;
+        }
+    }
+    fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+    if (fclose(file) != 0) {
+        log_errno("failed to write trace file {}", path);
+        return false;
+    }
+    return true;
+}
+
+void
+trace_clear(void)
+{
+    for (TraceBuffer *buffer = buffers.load(std::memory_order_acquire);
+            buffer;
+            buffer = buffer->next) {
+        buffer->cleared.store(buffer->head.load(std::memory_order_acquire),
+                std::memory_order_relaxed);
+    }
+}
+
+#endif
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+/// Chrome trace-event recorder for frame phases
+///
+/// Built with TRACING, `TRACE_SCOPE("name")` records a complete event from
+/// there to the end of the scope into a per-thread ring buffer.  Recording
+/// takes no locks; each thread only ever writes its own buffer.  A thread's
+/// buffer is handed to the next new thread once it exits.
+/// `trace_dump()` writes whatever the buffers hold as Chrome trace-event
+/// JSON, for chrome://tracing or https://ui.perfetto.dev.  Names must be
+/// string literals, or otherwise outlive the trace.
+///
+/// Without TRACING, TRACE_SCOPE() compiles to nothing.
+
+#ifdef TRACING
+
+/// monotonic time in nanoseconds, the clock events are recorded with
+inline uint64_t
+trace_now(void)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// record a complete event in this thread's buffer
+void
+trace_event(const char *name, uint64_t start, uint64_t end);
+
+/// write every buffered event, from every thread, to a Chrome trace-event
+/// JSON file; returns false if the file could not be written
+bool
+trace_dump(const char *path);
+
+/// forget all the events recorded so far
+void
+trace_clear(void);
+
+struct TraceScope {
+    TraceScope(const char *name) : name{name}, start{trace_now()} {}
+    TraceScope(const TraceScope&) = delete;
+    ~TraceScope() { trace_event(name, start, trace_now()); }
+
+    TraceScope& operator=(const TraceScope&) = delete;
+
+    const char *name;
+    uint64_t start;
+};
+
+#define TRACE_SCOPE(name) TraceScope __trace_scope(name)
+
+#else
+
+#define TRACE_SCOPE(name)
+
+#endif
@@ -0,0 +1,280 @@
+#include "transform_shm.hpp"
+#include "common.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TRANSFORM_SHM_MAGIC 0x6d68737032706863ull   // "chp2pshm"
+#define TRANSFORM_SHM_SLOTS 3
+
+const ShmTransform *
+ShmFrame::find(uint64_t entity) const
+{
+    const ShmTransform *begin = transforms(), *end = begin + count;
+    auto it = std::lower_bound(begin, end, entity,
+            [](const ShmTransform& t, uint64_t id) { return t.entity < id; });
+    return it != end && it->entity == entity ? it : nullptr;
+}
+
+TransformPublisher::TransformPublisher()
+    : name{}, header{nullptr}, size{0}, fd{-1}, writing{0}, frame{0}
+{
+}
+
+/// open the region & take its lock, creating it if needed; returns -1 if a
+/// live publisher holds the lock
+static int
+shm_lock(const char *name)
+{
+    // the owner may unlink the region between our open & lock, leaving us
+    // the lock on an orphan no reader can find, so check it's still linked
+    for (int attempt = 0; attempt < 8; attempt++) {
+        int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+        if (fd < 0) {
+            log_errno("failed to create shared memory {}", name);
+            return -1;
+        }
+        if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+            if (errno == EWOULDBLOCK) {
+                log_error("shared memory {} has another publisher", name);
+            } else {
+                log_errno("failed to lock shared memory {}", name);
+            }
+            close(fd);
+            return -1;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_nlink > 0) {
+            return fd;
+        }
+        close(fd);
+    }
+    log_error("shared memory {} keeps being unlinked", name);
+    return -1;
+}
+
+TransformPublisher::TransformPublisher(const char *name, uint32_t capacity)
+    : name{}, header{nullptr}, size{0}, fd{-1}, writing{0}, frame{0}
+{
+    snprintf(this->name, sizeof(this->name), "%s", name);
+    size_t slot_bytes = sizeof(ShmFrame) + capacity * sizeof(ShmTransform);
+    size_t bytes = sizeof(ShmHeader) + TRANSFORM_SHM_SLOTS * slot_bytes;
+
+    // the lock is held for as long as we publish, and released by the
+    // kernel if we die, so a region whose lock we get is either new or was
+    // left behind by a publisher that crashed; either way it's ours
+    int fd = shm_lock(name);
+    if (fd < 0) {
+        return;
+    }
+
+    // readers still mapping a crashed publisher's region see no magic while
+    // it is laid out again
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(ShmHeader)) {
+        log_warn("taking over shared memory {} from a dead publisher", name);
+        void *old = mmap(nullptr, sizeof(ShmHeader), PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, 0);
+        if (old != MAP_FAILED) {
+            static_cast<ShmHeader *>(old)->magic = 0;
+            munmap(old, sizeof(ShmHeader));
+        }
+    }
+
+    if (ftruncate(fd, bytes) != 0) {
+        log_errno("failed to size shared memory {}", name);
+        shm_unlink(name);
+        close(fd);
+        return;
+    }
+    void *map = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        log_errno("failed to map shared memory {}", name);
+        shm_unlink(name);
+        close(fd);
+        return;
+    }
+
+    // the header is filled in last, so a reader mapping the region early
+    // sees no magic rather than half a layout
+    this->fd = fd;
+    size = bytes;
+    header = static_cast<ShmHeader *>(map);
+    header->version = TRANSFORM_SHM_VERSION;
+    header->capacity = capacity;
+    header->slot_bytes = slot_bytes;
+    header->latest.store(0, std::memory_order_relaxed);
+    for (uint32_t i = 0; i < TRANSFORM_SHM_SLOTS; i++) {
+        ShmFrame *s = slot(i);
+        s->seq.store(0, std::memory_order_relaxed);
+        s->frame = 0;
+        s->count = 0;
+        s->capacity = capacity;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = TRANSFORM_SHM_MAGIC;
+}
+
+TransformPublisher::TransformPublisher(TransformPublisher&& other)
+    : header{nullptr}, fd{-1}
+{
+    *this = std::move(other);
+}
+
+TransformPublisher::~TransformPublisher()
+{
+    release();
+}
+
+TransformPublisher&
+TransformPublisher::operator=(TransformPublisher&& other)
+{
+    if (this != &other) {
+        release();
+        memcpy(name, other.name, sizeof(name));
+        header  = other.header;
+        size    = other.size;
+        fd      = other.fd;
+        writing = other.writing;
+        frame   = other.frame;
+        other.header = nullptr;
+        other.fd = -1;
+    }
+    return *this;
+}
+
+void
+TransformPublisher::release()
+{
+    if (!header) {
+        return;
+    }
+    // unlinked before the lock is dropped, so the next publisher of the
+    // name gets a new region rather than this one
+    munmap(header, size);
+    shm_unlink(name);
+    close(fd);
+    header = nullptr;
+    fd = -1;
+}
+
+ShmFrame *
+TransformPublisher::slot(uint32_t index) const
+{
+    auto *base = reinterpret_cast<uint8_t *>(header + 1);
+    return reinterpret_cast<ShmFrame *>(base + index * header->slot_bytes);
+}
+
+ShmTransform *
+TransformPublisher::begin()
+{
+    writing = (header->latest.load(std::memory_order_relaxed) + 1)
+        % TRANSFORM_SHM_SLOTS;
+    ShmFrame *s = slot(writing);
+    s->seq.store(s->seq.load(std::memory_order_relaxed) + 1,
+            std::memory_order_relaxed);
+    // keep the writes to the slot from being seen before the odd seq
+    std::atomic_thread_fence(std::memory_order_release);
+    return s->transforms();
+}
+
+void
+TransformPublisher::publish(uint32_t count)
+{
+    ShmFrame *s = slot(writing);
+    ShmTransform *t = s->transforms();
+    std::sort(t, t + count, [](const ShmTransform& l, const ShmTransform& r) {
+            return l.entity < r.entity;
+        });
+    s->frame = ++frame;
+    s->count = count;
+    s->seq.store(s->seq.load(std::memory_order_relaxed) + 1,
+            std::memory_order_release);
+    header->latest.store(writing, std::memory_order_release);
+}
+
+TransformReader::TransformReader(const char *name)
+    : header{nullptr}, size{0}
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        log_errno("failed to open shared memory {}", name);
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ShmHeader)) {
+        log_error("shared memory {} is not a transform region", name);
+        close(fd);
+        return;
+    }
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        log_errno("failed to map shared memory {}", name);
+        return;
+    }
+
+    auto *h = static_cast<const ShmHeader *>(map);
+    if (h->magic != TRANSFORM_SHM_MAGIC
+            || h->version != TRANSFORM_SHM_VERSION
+            || sizeof(ShmHeader) + TRANSFORM_SHM_SLOTS * h->slot_bytes
+                > (size_t)st.st_size) {
+        log_error("shared memory {} has an unknown layout", name);
+        munmap(map, st.st_size);
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    header = h;
+    size = st.st_size;
+}
+
+TransformReader::~TransformReader()
+{
+    if (header) {
+        munmap(const_cast<ShmHeader *>(header), size);
+    }
+}
+
+const ShmFrame *
+TransformReader::begin_read(uint64_t& seq) const
+{
+    auto *base = reinterpret_cast<const uint8_t *>(header + 1);
+    while (true) {
+        uint32_t index = header->latest.load(std::memory_order_acquire);
+        auto *frame = reinterpret_cast<const ShmFrame *>(
+                base + index * header->slot_bytes);
+        seq = frame->seq.load(std::memory_order_acquire);
+        if ((seq & 1) == 0) {
+            return frame;
+        }
+        // the publisher lapped us into the slot it is writing; take the
+        // new latest
+    }
+}
+
+bool
+TransformReader::end_read(const ShmFrame *frame, uint64_t seq) const
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return frame->seq.load(std::memory_order_relaxed) == seq;
+}
+
+uint64_t
+TransformReader::read(std::vector<ShmTransform>& out) const
+{
+    while (true) {
+        uint64_t seq;
+        const ShmFrame *frame = begin_read(seq);
+        uint32_t count = std::min(frame->count, header->capacity);
+        out.assign(frame->transforms(), frame->transforms() + count);
+        uint64_t number = frame->frame;
+        if (end_read(frame, seq)) {
+            return number;
+        }
+    }
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// body transforms published to shared memory for other processes
+///
+/// The region is a header followed by three frame slots.  The publisher
+/// writes each frame into the slot after the last one published, bracketed
+/// by the slot's sequence number going odd then even, and then points
+/// `latest` at it.  A reader takes `latest`, reads the slot in place, and
+/// checks the sequence number didn't change; the publisher would have to
+/// publish two more frames during the read for that to happen, in which case
+/// the reader tries again.  The publisher never waits on readers, and any
+/// number of readers can map the region.
+///
+/// Transforms in a frame are sorted by entity id, so readers can find an
+/// entity with a binary search.  Values are always doubles, whatever cpFloat
+/// the publisher was built with.
+
+/// bumped whenever the layout changes
+#define TRANSFORM_SHM_VERSION 1
+
+struct ShmTransform {
+    uint64_t entity;
+    double x, y, angle;
+};
+
+struct ShmFrame {
+    std::atomic<uint64_t> seq;  // odd while the slot is being written
+    uint64_t frame;             // frames published, including this one
+    uint32_t count;             // transforms in the slot
+    uint32_t capacity;
+
+    ShmTransform *transforms() {
+        return reinterpret_cast<ShmTransform *>(this + 1);
+    }
+    const ShmTransform *transforms() const {
+        return reinterpret_cast<const ShmTransform *>(this + 1);
+    }
+
+    /// find the transform for an entity, nullptr if it isn't in the frame
+    const ShmTransform *find(uint64_t entity) const;
+};
+
+struct ShmHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t capacity;          // transforms each slot can hold
+    uint64_t slot_bytes;        // ShmFrame plus its transforms
+    std::atomic<uint32_t> latest;   // slot last published
+};
+
+/// creates the region & writes frames into it
+///
+/// The publisher holds a flock() on the region for as long as it lives.  If
+/// another publisher holds it, the publisher fails rather than share the
+/// region.  A region left behind by a publisher that crashed has no lock
+/// held on it, and is taken over.
+struct TransformPublisher {
+    TransformPublisher();
+    TransformPublisher(const char *name, uint32_t capacity);
+    TransformPublisher(const TransformPublisher&) = delete;
+    TransformPublisher(TransformPublisher&& other);
+    ~TransformPublisher();
+
+    TransformPublisher& operator=(const TransformPublisher&) = delete;
+    TransformPublisher& operator=(TransformPublisher&& other);
+
+    /// check the region was created
+    bool ok() const { return header != nullptr; }
+
+    /// start writing the next frame; fill in up to `capacity` transforms,
+    /// then publish()
+    ShmTransform *begin();
+
+    /// sort the `count` transforms written, and make them the latest frame
+    void publish(uint32_t count);
+
+    ShmFrame *slot(uint32_t index) const;
+
+    /// unmap, unlink & unlock the region
+    void release();
+
+    char name[256];
+    ShmHeader *header;
+    size_t size;
+    int fd;             // kept open to hold the lock
+    uint32_t writing;   // slot being written
+    uint64_t frame;     // frames published
+};
+
+/// maps a region read-only & reads consistent frames from it
+struct TransformReader {
+    TransformReader(const char *name);
+    TransformReader(const TransformReader&) = delete;
+    ~TransformReader();
+
+    TransformReader& operator=(const TransformReader&) = delete;
+
+    /// check the region was mapped, and has a layout we understand
+    bool ok() const { return header != nullptr; }
+
+    /// get the latest frame to read in place, with its sequence number; the
+    /// frame must then be checked with end_read()
+    const ShmFrame *begin_read(uint64_t& seq) const;
+
+    /// check a frame was not overwritten while being read
+    bool end_read(const ShmFrame *frame, uint64_t seq) const;
+
+    /// copy out the latest frame; returns its frame number
+    uint64_t read(std::vector<ShmTransform>& out) const;
+
+    const ShmHeader *header;
+    size_t size;
+};
@@ -286,7 +286,7 @@ TEST(unique_ptr, indestructable_projectile) {
     struct Apple {};
     for (int i = 0; i < 5; i++) {
         cpBody *body = cpBodyNew(1, INFINITY);
-        cpBodySetPosition(body, {5.0 + (i * 5), 0});
+        cpBodySetPosition(body, cpv(5.0 + (i * 5), 0));
         cpShape *shape = cpBoxShapeNew(body, 1, 1, 0);
         cpShapeSetCollisionType(shape, CT_Object);
         ecs.entity()
@@ -0,0 +1,176 @@
+#include "world_scheduler.hpp"
+#include "common.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+/// weight of the last frame in a world's moving average cost
+#define WORLD_COST_ALPHA 0.2
+
+WorldScheduler::WorldScheduler(int threads, double budget_ms)
+    : deques(std::max(threads, 1)), budget_ms{budget_ms}, dt{0},
+      generation{0}, running{0}, quit{false}, stolen{0}
+{
+    // the thread calling step() is worker 0
+    for (int i = 1; i < (int)deques.size(); i++) {
+        this->threads.emplace_back([this, i]() {
+                uint64_t seen = 0;
+                while (true) {
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        cv.wait(lock, [&]() {
+                                return quit || generation != seen;
+                            });
+                        if (quit) {
+                            return;
+                        }
+                        seen = generation;
+                    }
+                    work(i);
+                }
+            });
+    }
+}
+
+WorldScheduler::~WorldScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    cv.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+size_t
+WorldScheduler::add(flecs::world *world)
+{
+    entries.push_back({ world, { 0, 0, 0, 0, 0, -1 } });
+    order.push_back(entries.size() - 1);
+    for (auto& deque : deques) {
+        deque.items.reserve(entries.size());
+    }
+    return entries.size() - 1;
+}
+
+void
+WorldScheduler::step(flecs::ftime_t dt)
+{
+    this->dt = dt;
+
+    // deal the worlds out longest first, each to the least loaded worker,
+    // or back to the one that ran it last if that isn't much worse
+    std::sort(order.begin(), order.end(), [this](uint32_t l, uint32_t r) {
+            return entries[l].stats.cost_ms > entries[r].stats.cost_ms;
+        });
+    for (auto& deque : deques) {
+        deque.items.clear();
+        deque.load = 0;
+    }
+    for (uint32_t item : order) {
+        const WorldStats& stats = entries[item].stats;
+        int best = 0;
+        for (int i = 1; i < (int)deques.size(); i++) {
+            if (deques[i].load < deques[best].load) {
+                best = i;
+            }
+        }
+        int last = stats.worker;
+        if (last >= 0 && last < (int)deques.size()
+                && deques[last].load <= deques[best].load
+                    + stats.cost_ms / 2) {
+            best = last;
+        }
+        deques[best].items.push_back(item);
+        deques[best].load += stats.cost_ms;
+    }
+    for (auto& deque : deques) {
+        deque.ends.store(deque.items.size(), std::memory_order_relaxed);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = deques.size();
+        generation++;
+    }
+    cv.notify_all();
+    work(0);
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this]() { return running == 0; });
+    }
+
+    overran_last.clear();
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (entries[i].stats.last_ms > budget_ms) {
+            overran_last.push_back(i);
+        }
+    }
+}
+
+bool
+WorldScheduler::take(int worker, uint32_t& item)
+{
+    // our own worlds from the front
+    Deque& own = deques[worker];
+    uint64_t ends = own.ends.load(std::memory_order_acquire);
+    while ((ends >> 32) < (ends & 0xffffffff)) {
+        if (own.ends.compare_exchange_weak(ends, ends + (1ull << 32),
+                    std::memory_order_acq_rel)) {
+            item = own.items[ends >> 32];
+            return true;
+        }
+    }
+
+    // then steal from the back of the others, starting with our neighbour
+    for (int i = 1; i < (int)deques.size(); i++) {
+        Deque& other = deques[(worker + i) % deques.size()];
+        ends = other.ends.load(std::memory_order_acquire);
+        while ((ends >> 32) < (ends & 0xffffffff)) {
+            if (other.ends.compare_exchange_weak(ends, ends - 1,
+                        std::memory_order_acq_rel)) {
+                item = other.items[(ends & 0xffffffff) - 1];
+                stolen++;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void
+WorldScheduler::run(int worker, uint32_t item)
+{
+    Entry& entry = entries[item];
+    auto start = std::chrono::steady_clock::now();
+    entry.world->progress(dt);
+    double ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+
+    WorldStats& stats = entry.stats;
+    stats.cost_ms = stats.frames == 0 ? ms
+        : stats.cost_ms + (ms - stats.cost_ms) * WORLD_COST_ALPHA;
+    stats.last_ms = ms;
+    stats.max_ms = std::max(stats.max_ms, ms);
+    stats.frames++;
+    stats.worker = worker;
+    if (ms > budget_ms) {
+        stats.overruns++;
+    }
+}
+
+void
+WorldScheduler::work(int worker)
+{
+    uint32_t item;
+    while (take(worker, item)) {
+        run(worker, item);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--running == 0) {
+        cv.notify_all();
+    }
+}
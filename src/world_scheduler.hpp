@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <flecs.h>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// frame timings of one world run by a WorldScheduler
+struct WorldStats {
+    double last_ms;     // last frame
+    double cost_ms;     // moving average, used to balance the workers
+    double max_ms;
+    uint64_t frames;
+    uint64_t overruns;  // frames over the scheduler's budget
+    int worker;         // ran the last frame
+};
+
+/// steps many independent flecs worlds on a shared pool of threads
+///
+/// Each step() progresses every world once.  A world is only ever
+/// progressed by one thread at a time, so its systems & physics stay
+/// single-threaded, and it usually stays on the same worker from frame to
+/// frame, keeping its data in that core's cache.
+///
+/// Worlds are dealt to the workers longest first by their measured cost,
+/// each to the least loaded worker, unless the worker that ran it last is
+/// close enough.  A worker that finishes its own worlds steals from the
+/// back of the others' lists, so a world that runs long doesn't hold up the
+/// whole step.
+struct WorldScheduler {
+    WorldScheduler(int threads, double budget_ms);
+    WorldScheduler(const WorldScheduler&) = delete;
+    ~WorldScheduler();
+
+    WorldScheduler& operator=(const WorldScheduler&) = delete;
+
+    /// add a world to be stepped; returns its index for stats()
+    size_t add(flecs::world *world);
+
+    /// progress every world by `dt`, returning once all are done; call from
+    /// one thread only
+    void step(flecs::ftime_t dt);
+
+    const WorldStats& stats(size_t index) const { return entries[index].stats; }
+
+    /// worlds that went over budget in the last step
+    const std::vector<size_t>& overran() const { return overran_last; }
+
+    /// worlds a worker ran that were dealt to another, over every step
+    uint64_t steals() const { return stolen.load(); }
+
+    struct Entry {
+        flecs::world *world;
+        WorldStats stats;
+    };
+
+    /// worlds dealt to a worker for one step
+    ///
+    /// The owner takes from the front and thieves from the back; both ends
+    /// are packed into one word, so taking is a single compare-and-swap.
+    struct Deque {
+        std::vector<uint32_t> items;
+        std::atomic<uint64_t> ends;     // front << 32 | back
+        double load;
+    };
+
+    void work(int worker);
+    bool take(int worker, uint32_t& item);
+    void run(int worker, uint32_t item);
+
+    std::vector<Entry> entries;
+    std::vector<Deque> deques;
+    std::vector<std::thread> threads;
+    std::vector<uint32_t> order;
+    std::vector<size_t> overran_last;
+    double budget_ms;
+    flecs::ftime_t dt;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    uint64_t generation;    // steps started
+    int running;            // workers still in the current step
+    bool quit;
+    std::atomic<uint64_t> stolen;
+};